@@ -120,6 +120,23 @@ $$;
 
 ALTER FUNCTION bitfinex._diff_order_books(p_order_book_before bitfinex.transient_raw_book_events[], p_order_book_after bitfinex.transient_raw_book_events[]) OWNER TO "ob-analytics";
 
+--
+-- Name: _diff_order_books_fast(bitfinex.transient_raw_book_events[], bitfinex.transient_raw_book_events[]); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
+--
+
+CREATE FUNCTION bitfinex._diff_order_books_fast(p_order_book_before bitfinex.transient_raw_book_events[], p_order_book_after bitfinex.transient_raw_book_events[]) RETURNS bitfinex.transient_raw_book_events[]
+    LANGUAGE c IMMUTABLE
+    AS '$libdir/libobadiah_db.so.1', 'diff_order_books';
+
+
+ALTER FUNCTION bitfinex._diff_order_books_fast(p_order_book_before bitfinex.transient_raw_book_events[], p_order_book_after bitfinex.transient_raw_book_events[]) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION _diff_order_books_fast(p_order_book_before bitfinex.transient_raw_book_events[], p_order_book_after bitfinex.transient_raw_book_events[]); Type: COMMENT; Schema: bitfinex; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION bitfinex._diff_order_books_fast(p_order_book_before bitfinex.transient_raw_book_events[], p_order_book_after bitfinex.transient_raw_book_events[]) IS 'The same as _diff_order_books() but implemented in C. Joins the order books by order_id via a hash table';
+
 --
 -- Name: _level3_matchable_events(timestamp with time zone, timestamp with time zone, integer, integer); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
 --
@@ -272,6 +289,23 @@ $$;
 
 ALTER FUNCTION bitfinex._update_order_book(p_order_book bitfinex.transient_raw_book_events[], p_update bitfinex.transient_raw_book_events[]) OWNER TO "ob-analytics";
 
+--
+-- Name: _update_order_book_fast(bitfinex.transient_raw_book_events[], bitfinex.transient_raw_book_events[]); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
+--
+
+CREATE FUNCTION bitfinex._update_order_book_fast(p_order_book bitfinex.transient_raw_book_events[], p_update bitfinex.transient_raw_book_events[]) RETURNS bitfinex.transient_raw_book_events[]
+    LANGUAGE c STABLE
+    AS '$libdir/libobadiah_db.so.1', 'update_order_book';
+
+
+ALTER FUNCTION bitfinex._update_order_book_fast(p_order_book bitfinex.transient_raw_book_events[], p_update bitfinex.transient_raw_book_events[]) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION _update_order_book_fast(p_order_book bitfinex.transient_raw_book_events[], p_update bitfinex.transient_raw_book_events[]); Type: COMMENT; Schema: bitfinex; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION bitfinex._update_order_book_fast(p_order_book bitfinex.transient_raw_book_events[], p_update bitfinex.transient_raw_book_events[]) IS 'The same as _update_order_book() but implemented in C. Joins the order book and the update by order_id via a hash table';
+
 --
 -- Name: capture_transient_raw_book_events(timestamp with time zone, timestamp with time zone, text, interval); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
 --
@@ -355,7 +389,7 @@ begin
 				)
 				insert into bitfinex.transient_raw_book_events
 				select (d).* 
-				from unnest(bitfinex._diff_order_books(v_open_orders, array(select base_events::bitfinex.transient_raw_book_events
+				from unnest(bitfinex._diff_order_books_fast(v_open_orders, array(select base_events::bitfinex.transient_raw_book_events
 																					  	from base_events))) d
 				;
 			end if;
@@ -570,6 +604,23 @@ $$;
 
 ALTER FUNCTION bitfinex.match_price_and_fill_exact(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_max_delay interval, p_price_decimal_places integer) OWNER TO "ob-analytics";
 
+--
+-- Name: match_price_and_fill_exact_fast(timestamp with time zone, timestamp with time zone, integer, interval, integer); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
+--
+
+CREATE FUNCTION bitfinex.match_price_and_fill_exact_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_max_delay interval DEFAULT '00:00:01'::interval, p_price_decimal_places integer DEFAULT NULL::integer) RETURNS SETOF obanalytics.matches
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'match_price_and_fill_exact';
+
+
+ALTER FUNCTION bitfinex.match_price_and_fill_exact_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_max_delay interval, p_price_decimal_places integer) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION match_price_and_fill_exact_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_max_delay interval, p_price_decimal_places integer); Type: COMMENT; Schema: bitfinex; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION bitfinex.match_price_and_fill_exact_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_max_delay interval, p_price_decimal_places integer) IS 'The same as match_price_and_fill_exact() but implemented in C. Reads the trades and the matchable events once and matches them within a sliding time window indexed by (price, fill, side)';
+
 --
 -- Name: match_price_and_sum_of_fill_exact(timestamp with time zone, timestamp with time zone, smallint, interval, integer, integer, integer); Type: FUNCTION; Schema: bitfinex; Owner: ob-analytics
 --
@@ -812,7 +863,7 @@ begin
 	
 	v_price_precision := v_max_price_precision;
 	loop
-		perform bitfinex.match_price_and_fill_exact(o_start, o_end, v_pair_id, p_price_decimal_places := v_price_precision);
+		perform bitfinex.match_price_and_fill_exact_fast(o_start, o_end, v_pair_id, p_price_decimal_places := v_price_precision);
 		if not found then 
 			if v_max_price_precision - v_price_precision > 1 then 
 				exit;
@@ -892,7 +943,7 @@ ALTER FUNCTION bitfinex.update_symbol_details(p_pair text, p_price_precision sma
 --
 
 CREATE AGGREGATE bitfinex.transient_raw_book_agg(bitfinex.transient_raw_book_events[]) (
-    SFUNC = bitfinex._update_order_book,
+    SFUNC = bitfinex._update_order_book_fast,
     STYPE = bitfinex.transient_raw_book_events[]
 );
 
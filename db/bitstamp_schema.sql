@@ -1374,6 +1374,23 @@ $$;
 
 ALTER FUNCTION bitstamp.match_trades_to_sequential_events(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair text, p_tolerance_percentage numeric, p_offset integer) OWNER TO "ob-analytics";
 
+--
+-- Name: match_trades_to_sequential_events_fast(timestamp with time zone, timestamp with time zone, text, numeric[], integer); Type: FUNCTION; Schema: bitstamp; Owner: ob-analytics
+--
+
+CREATE FUNCTION bitstamp.match_trades_to_sequential_events_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair text DEFAULT 'BTCUSD'::text, p_tolerance_percentages numeric[] DEFAULT '{0.0001,0.001,0.01,0.1,1}'::numeric[], p_max_offset integer DEFAULT 4) RETURNS SETOF bitstamp.live_trades
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'match_trades_to_sequential_events';
+
+
+ALTER FUNCTION bitstamp.match_trades_to_sequential_events_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair text, p_tolerance_percentages numeric[], p_max_offset integer) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION match_trades_to_sequential_events_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair text, p_tolerance_percentages numeric[], p_max_offset integer); Type: COMMENT; Schema: bitstamp; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION bitstamp.match_trades_to_sequential_events_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair text, p_tolerance_percentages numeric[], p_max_offset integer) IS 'The same as calling match_trades_to_sequential_events() for each tolerance in p_tolerance_percentages and each offset from 1 to p_max_offset but implemented in C. Reads the events and the trades once. An event is matched to one trade only, even if several trades compete for it within a pass';
+
 --
 -- Name: move_events(timestamp with time zone, timestamp with time zone, integer); Type: FUNCTION; Schema: bitstamp; Owner: ob-analytics
 --
@@ -1788,7 +1805,6 @@ declare
 	v_end timestamptz;
 	v_trade bitstamp.live_trades;
 	v_trade_id bigint;
-	v_tolerance_percentage numeric;
 	v_pair_id bitstamp.pairs.pair_id%type;
 	
 	MAX_OFFSET constant integer := 4;	-- the maximum distance (in terms of events) between considered as caused by one trade
@@ -1846,15 +1862,11 @@ begin
 	
 	raise debug 'pga_match() inferred_trades cycle exec time: %', clock_timestamp() - v_execution_start_time;	
 
-	foreach v_tolerance_percentage in array '{0.0001, 0.001, 0.01, 0.1, 1}'::numeric[] loop
-		for v_offset in 1..MAX_OFFSET loop
-			v_execution_start_time := clock_timestamp();
-			return query select * from bitstamp.match_trades_to_sequential_events(v_start, v_end, p_pair, 
-																					p_tolerance_percentage := v_tolerance_percentage,
-																					p_offset := v_offset);
-			raise debug 'pga_match() match_trades_to_sequential events with tolerance: %, offset: %, time: %', v_tolerance_percentage, v_offset,  clock_timestamp() - v_execution_start_time;																						
-		end loop;
-	end loop; 
+	v_execution_start_time := clock_timestamp();
+	return query select * from bitstamp.match_trades_to_sequential_events_fast(v_start, v_end, p_pair, 
+																				p_tolerance_percentages := '{0.0001, 0.001, 0.01, 0.1, 1}'::numeric[],
+																				p_max_offset := MAX_OFFSET);
+	raise debug 'pga_match() match_trades_to_sequential_events_fast() exec time: %', clock_timestamp() - v_execution_start_time;
 
 	raise debug 'pga_match() exec time: %', clock_timestamp() - v_current_timestamp;		
 	return;
@@ -0,0 +1,213 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// The same as BitfinexMessageHandler and its channel handlers of
+// python/obadiah/bitfinex.py. The subscription is expected to be made with
+// the flags TIMESTAMP and DEC_S, i.e. the messages are
+// [chanId, payload, mts] and the numbers in payloads are strings
+
+#include <map>
+#include <string>
+#include "capture.h"
+#include "copy_buffer.h"
+
+namespace obad {
+namespace {
+
+enum table { kRawBookEvents, kTrades };
+
+microseconds
+from_mts(const json& mts) {
+ return std::stoll(mts.data()) * 1000;
+}
+
+class channel {
+public:
+ virtual ~channel() = default;
+ virtual void data(microseconds lts, const json& message, insertions& out) = 0;
+ virtual void close(insertions&){};
+};
+
+// Raw book events are saved in episodes: an episode is completed by the
+// first deletion (price = 0) after additions or changes
+class book_channel : public channel {
+public:
+ book_channel(std::int16_t pair_id, std::int32_t channel_id)
+     : pair_id_{pair_id}, channel_id_{channel_id} {};
+
+ void data(microseconds lts, const json& message, insertions& out) override {
+  const json& payload = element(message, 1);
+  microseconds rts = from_mts(element(message, 2));
+  bool is_episode_completed = false;
+  std::vector<event> episode;
+  if (is_array(payload) && is_array(payload.front().second)) {
+   // A snapshot
+   for (const auto& e : payload) episode.push_back(event{e.second, rts, lts});
+   is_episode_completed = true;
+   episode_rts_ = rts;
+   log(severity::info) << "Bitfinex book snapshot, channel " << channel_id_
+                       << " pair_id " << pair_id_;
+   out.push_back(insertion{
+       rts,
+       -1,
+       lts,
+       -1,
+       "insert into bitfinex.transient_raw_book_channels (episode_timestamp, "
+       "pair_id, channel_id) values ('epoch'::timestamptz + $1::bigint * "
+       "interval '1 microsecond', $2, $3)",
+       {std::to_string(rts), std::to_string(pair_id_),
+        std::to_string(channel_id_)}});
+  } else {
+   if (payload.data() == "hb") return;
+   if (!std::stod(element(payload, 1).data())) {
+    if (is_episode_started_) {
+     episode.swap(accumulated_);
+     is_episode_completed = true;
+     is_episode_started_ = false;
+    }
+   } else {
+    is_episode_started_ = true;
+   }
+   accumulated_.push_back(event{payload, rts, lts});
+  }
+  if (is_episode_completed)
+   for (const event& e : episode) {
+    copy_buffer tuple;
+    tuple.tuple(8)
+        .timestamptz(e.rts)
+        .int8(std::stoll(element(e.data, 0).data()))
+        .numeric(element(e.data, 1).data())
+        .numeric(element(e.data, 2).data())
+        .int2(pair_id_)
+        .timestamptz(e.lts)
+        .int4(channel_id_)
+        .timestamptz(episode_rts_);
+    out.push_back(insertion{e.rts, 0, e.lts, kRawBookEvents, tuple.data(), {}});
+   }
+  if (rts > episode_rts_) episode_rts_ = rts;
+ };
+
+ void close(insertions&) override {
+  if (!accumulated_.empty())
+   log(severity::info) << "An incomplete episode of " << accumulated_.size()
+                       << " events, not saved";
+  log(severity::info) << "Closed handler for channel " << channel_id_;
+ };
+
+private:
+ struct event {
+  json data;
+  microseconds rts;
+  microseconds lts;
+ };
+ std::int16_t pair_id_;
+ std::int32_t channel_id_;
+ bool is_episode_started_ = false;
+ std::vector<event> accumulated_;
+ microseconds episode_rts_ = 0;
+};
+
+class trades_channel : public channel {
+public:
+ trades_channel(std::int16_t pair_id, std::int32_t channel_id)
+     : pair_id_{pair_id}, channel_id_{channel_id} {};
+
+ void data(microseconds lts, const json& message, insertions& out) override {
+  const json& payload = element(message, 1);
+  if (payload.data() == "tu") {
+   trade(lts, element(message, 2), out);
+  } else if (payload.data() == "te" || payload.data() == "hb") {
+   return;
+  } else {  // the initial snapshot of trades
+   for (const auto& t : payload) trade(lts, t.second, out);
+  }
+ };
+
+private:
+ void trade(microseconds lts, const json& t, insertions& out) {
+  microseconds ts = from_mts(element(t, 1));
+  copy_buffer tuple;
+  tuple.tuple(7)
+      .int8(std::stoll(element(t, 0).data()))
+      .numeric(element(t, 2).data())
+      .numeric(element(t, 3).data())
+      .timestamptz(lts)
+      .timestamptz(ts)
+      .int2(pair_id_)
+      .int4(channel_id_);
+  out.push_back(insertion{ts, 0, lts, kTrades, tuple.data(), {}});
+ }
+ std::int16_t pair_id_;
+ std::int32_t channel_id_;
+};
+
+class bitfinex_handler : public message_handler {
+public:
+ explicit bitfinex_handler(std::int16_t pair_id) : pair_id_{pair_id} {};
+
+ std::vector<std::string> copy_statements() const override {
+  return {
+      "copy bitfinex.transient_raw_book_events (exchange_timestamp, order_id, "
+      "price, amount, pair_id, local_timestamp, channel_id, "
+      "episode_timestamp) from stdin (format binary)",
+      "copy bitfinex.transient_trades (id, qty, price, local_timestamp, "
+      "exchange_timestamp, pair_id, channel_id) from stdin (format binary)"};
+ };
+
+ void process(microseconds lts, const json& message,
+              insertions& out) override {
+  if (is_array(message)) {
+   auto c = channels_.find(std::stol(message.front().second.data()));
+   if (c != channels_.end())
+    c->second->data(lts, message, out);
+   else
+    log(severity::warning) << "Bitfinex message from an unknown channel "
+                           << message.front().second.data();
+   return;
+  }
+  std::string event = message.get<std::string>("event", "");
+  if (event == "subscribed") {
+   std::int32_t channel_id = std::stol(message.get<std::string>("chanId"));
+   std::string name = message.get<std::string>("channel");
+   log(severity::info) << "Bitfinex subscribed to " << name << ", channel "
+                       << channel_id << " pair_id " << pair_id_;
+   if (name == "book")
+    channels_[channel_id].reset(new book_channel(pair_id_, channel_id));
+   else if (name == "trades")
+    channels_[channel_id].reset(new trades_channel(pair_id_, channel_id));
+  } else {
+   log(severity::info) << "Bitfinex " << event << " "
+                       << message.get<std::string>("code", "")
+                       << message.get<std::string>("msg", "");
+  }
+ };
+
+ void close(insertions& out) override {
+  for (auto& c : channels_) c.second->close(out);
+ };
+
+private:
+ std::int16_t pair_id_;
+ std::map<std::int32_t, std::unique_ptr<channel>> channels_;
+};
+
+}  // namespace
+
+std::unique_ptr<message_handler>
+new_bitfinex_handler(std::int16_t pair_id) {
+ return std::unique_ptr<message_handler>(new bitfinex_handler(pair_id));
+}
+
+}  // namespace obad
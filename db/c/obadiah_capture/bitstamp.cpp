@@ -0,0 +1,121 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// The same as BitstampMessageHandler of python/obadiah/bitstamp.py
+
+#include <cmath>
+#include <string>
+#include "capture.h"
+#include "copy_buffer.h"
+
+namespace obad {
+namespace {
+
+enum table { kLiveOrders, kLiveTrades };
+
+class bitstamp_handler : public message_handler {
+public:
+ explicit bitstamp_handler(std::int16_t pair_id) : pair_id_{pair_id} {};
+
+ std::vector<std::string> copy_statements() const override {
+  return {
+      "copy bitstamp.transient_live_orders (microtimestamp, datetime, amount, "
+      "price, order_id, order_type, event, era, pair_id, local_timestamp) "
+      "from stdin (format binary)",
+      "copy bitstamp.transient_live_trades (trade_timestamp, amount, "
+      "buy_order_id, sell_order_id, price, bitstamp_trade_id, trade_type, "
+      "pair_id, local_timestamp) from stdin (format binary)"};
+ };
+
+ void process(microseconds lts, const json& message,
+              insertions& out) override {
+  if (is_array(message)) return;
+  std::string event = message.get<std::string>("event", "");
+  if (event == "trade")
+   trade(lts, message.get_child("data"), out);
+  else if (event == "order_created" || event == "order_changed" ||
+           event == "order_deleted")
+   live_order_event(lts, event, message.get_child("data"), out);
+  else
+   log(severity::info) << "Bitstamp " << event << ": "
+                       << message.get<std::string>("channel", "");
+ };
+
+private:
+ static const char* direction(const json& data, const char* type) {
+  return std::stoi(data.get<std::string>(type)) ? "sell" : "buy";
+ }
+
+ void trade(microseconds lts, const json& data, insertions& out) {
+  microseconds ts = std::stoll(data.get<std::string>("microtimestamp"));
+  copy_buffer tuple;
+  tuple.tuple(9)
+      .timestamptz(ts)
+      .numeric(data.get<std::string>("amount_str"))
+      .int8(std::stoll(data.get<std::string>("buy_order_id")))
+      .int8(std::stoll(data.get<std::string>("sell_order_id")))
+      .numeric(data.get<std::string>("price_str"))
+      .int8(std::stoll(data.get<std::string>("id")))
+      .text(direction(data, "type"))
+      .int2(pair_id_)
+      .timestamptz(lts);
+  out.push_back(insertion{ts, 0, lts, kLiveTrades, tuple.data(), {}});
+ }
+
+ void live_order_event(microseconds lts, const std::string& event,
+                       const json& data, insertions& out) {
+  microseconds ts = std::stoll(data.get<std::string>("microtimestamp"));
+  if (era_ < 0) {
+   era_ = ts;
+   // Precedes the event since its priority is lower
+   out.push_back(insertion{
+       ts,
+       -1,
+       lts,
+       -1,
+       "insert into bitstamp.live_orders_eras (era, pair_id) "
+       "values ('epoch'::timestamptz + $1::bigint * interval '1 microsecond', "
+       "$2)",
+       {std::to_string(era_), std::to_string(pair_id_)}});
+   log(severity::info) << "Bitstamp pair_id " << pair_id_ << " new era "
+                       << era_;
+  }
+  copy_buffer tuple;
+  tuple.tuple(10)
+      .timestamptz(ts)
+      .timestamptz(std::llround(std::stod(data.get<std::string>("datetime")) * 1e6))
+      .numeric(data.get<std::string>("amount_str"))
+      .numeric(data.get<std::string>("price_str"))
+      .int8(std::stoll(data.get<std::string>("id")))
+      .text(direction(data, "order_type"))
+      .text(event)
+      .timestamptz(era_)
+      .int2(pair_id_)
+      .timestamptz(lts);
+  out.push_back(insertion{ts, 0, lts, kLiveOrders, tuple.data(), {}});
+ }
+
+ std::int16_t pair_id_;
+ microseconds era_ = -1;
+};
+
+}  // namespace
+
+std::unique_ptr<message_handler>
+new_bitstamp_handler(std::int16_t pair_id) {
+ return std::unique_ptr<message_handler>(new bitstamp_handler(pair_id));
+}
+
+}  // namespace obad
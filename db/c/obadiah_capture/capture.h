@@ -0,0 +1,114 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace obad {
+
+using json = boost::property_tree::ptree;
+
+// Microseconds since the Unix epoch
+using microseconds = std::int64_t;
+
+inline microseconds
+now() {
+ return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+     .count();
+}
+
+// Something to be saved to the database. Insertions are saved in the order
+// of (exchange_timestamp, priority, local_timestamp), see reorder_buffer
+struct insertion {
+ microseconds exchange_timestamp;
+ int priority;
+ microseconds local_timestamp;
+ // The index of a table in message_handler::copy_statements() or -1 if
+ // the insertion is a statement
+ int table;
+ // A tuple of binary COPY (see copy_buffer) or an SQL statement
+ std::string data;
+ std::vector<std::string> params;  // of the statement
+};
+
+using insertions = std::vector<insertion>;
+
+// Converts messages received from an exchange into insertions
+class message_handler {
+public:
+ virtual ~message_handler() = default;
+ // COPY ... FROM STDIN (FORMAT binary) statements of the tables which
+ // insertions with table >= 0 go to
+ virtual std::vector<std::string> copy_statements() const = 0;
+ virtual void process(microseconds local_timestamp, const json& message,
+                      insertions& out) = 0;
+ // Called once there will be no more messages
+ virtual void close(insertions&){};
+};
+
+std::unique_ptr<message_handler>
+new_bitstamp_handler(std::int16_t pair_id);
+
+std::unique_ptr<message_handler>
+new_bitfinex_handler(std::int16_t pair_id);
+
+enum class severity { debug, info, warning, error };
+
+// Writes a line to std::clog in the format of Python's obadiah logs
+class log {
+public:
+ static severity level;
+ explicit log(severity s) : severity_{s} {};
+ ~log() {
+  if (severity_ >= level) std::clog << timestamp() << stream_.str() << std::endl;
+ }
+ template <typename T>
+ log& operator<<(const T& value) {
+  if (severity_ >= level) stream_ << value;
+  return *this;
+ }
+
+private:
+ std::string timestamp() const;
+ severity severity_;
+ std::ostringstream stream_;
+};
+
+// Helpers for the property tree made by boost::property_tree::read_json()
+// where arrays are nodes with unnamed children and all values are strings
+inline bool
+is_array(const json& node) {
+ return !node.empty() && node.front().first.empty();
+}
+
+inline const json&
+element(const json& array, std::size_t i) {
+ auto it = array.begin();
+ std::advance(it, i);
+ return it->second;
+}
+
+}  // namespace obad
+#endif
@@ -0,0 +1,175 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "copy_buffer.h"
+#include <cctype>
+#include <stdexcept>
+#include <vector>
+
+namespace obad {
+
+namespace {
+// Microseconds between the Unix and PostgreSQL epochs
+const std::int64_t kPostgresEpoch = 946684800000000LL;
+const std::int16_t kNumericPositive = 0x0000;
+const std::int16_t kNumericNegative = 0x4000;
+}  // namespace
+
+template <typename T>
+void
+copy_buffer::put(T value) {
+ for (int i = sizeof(T) - 1; i >= 0; --i)
+  data_.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+copy_buffer&
+copy_buffer::header() {
+ static const char signature[] = "PGCOPY\n\377\r\n\0";
+ data_.append(signature, sizeof(signature) - 1);
+ put<std::int32_t>(0);  // flags
+ put<std::int32_t>(0);  // header extension length
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::tuple(std::int16_t fields) {
+ put(fields);
+ ++rows_;
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::null() {
+ put<std::int32_t>(-1);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::int2(std::int16_t value) {
+ put<std::int32_t>(sizeof(value));
+ put(value);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::int4(std::int32_t value) {
+ put<std::int32_t>(sizeof(value));
+ put(value);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::int8(std::int64_t value) {
+ put<std::int32_t>(sizeof(value));
+ put(value);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::timestamptz(std::int64_t value) {
+ return int8(value - kPostgresEpoch);
+}
+
+copy_buffer&
+copy_buffer::numeric(const std::string& value) {
+ std::size_t i = 0;
+ bool is_negative = false;
+ if (i < value.size() && (value[i] == '-' || value[i] == '+'))
+  is_negative = value[i++] == '-';
+ std::string digits;
+ long point = -1;
+ for (; i < value.size(); ++i) {
+  if (std::isdigit(static_cast<unsigned char>(value[i])))
+   digits.push_back(value[i]);
+  else if (value[i] == '.' && point < 0)
+   point = digits.size();
+  else
+   break;
+ }
+ if (digits.empty()) throw std::invalid_argument("not a number: " + value);
+ if (point < 0) point = digits.size();
+ if (i < value.size() && (value[i] == 'e' || value[i] == 'E')) {
+  std::size_t end;
+  point += std::stol(value.substr(i + 1), &end);
+  i += end + 1;
+ }
+ if (i != value.size()) throw std::invalid_argument("not a number: " + value);
+
+ // Now the value is 0.digits * 10^point
+ std::string integer, fraction;
+ if (point <= 0) {
+  fraction = std::string(-point, '0') + digits;
+ } else if (static_cast<std::size_t>(point) >= digits.size()) {
+  integer = digits + std::string(point - digits.size(), '0');
+ } else {
+  integer = digits.substr(0, point);
+  fraction = digits.substr(point);
+ }
+ std::int16_t dscale = fraction.size();
+ // Base 10000 digits, aligned at the decimal point
+ integer.insert(0, (4 - integer.size() % 4) % 4, '0');
+ fraction.append((4 - fraction.size() % 4) % 4, '0');
+ std::vector<std::int16_t> groups;
+ for (const std::string* part : {&integer, &fraction})
+  for (std::size_t j = 0; j < part->size(); j += 4)
+   groups.push_back(std::stoi(part->substr(j, 4)));
+ std::int16_t weight = integer.size() / 4 - 1;
+ std::size_t first = 0, last = groups.size();
+ while (first < last && !groups[first]) {
+  ++first;
+  --weight;
+ }
+ while (last > first && !groups[last - 1]) --last;
+ if (first == last) {
+  weight = 0;
+  is_negative = false;
+ }
+
+ put<std::int32_t>(8 + 2 * (last - first));
+ put<std::int16_t>(last - first);
+ put(weight);
+ put(is_negative ? kNumericNegative : kNumericPositive);
+ put(dscale);
+ for (std::size_t j = first; j < last; ++j) put(groups[j]);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::text(const std::string& value) {
+ put<std::int32_t>(value.size());
+ data_.append(value);
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::append(const std::string& tuple) {
+ data_.append(tuple);
+ ++rows_;
+ return *this;
+}
+
+copy_buffer&
+copy_buffer::trailer() {
+ put<std::int16_t>(-1);
+ return *this;
+}
+
+void
+copy_buffer::clear() {
+ data_.clear();
+ rows_ = 0;
+}
+
+}  // namespace obad
@@ -0,0 +1,58 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef COPY_BUFFER_H
+#define COPY_BUFFER_H
+
+#include <cstdint>
+#include <string>
+
+namespace obad {
+
+// Rows in the binary format of COPY. The same as obad::binary_copy of
+// obadiah_db, but outside of a backend
+class copy_buffer {
+public:
+ copy_buffer& header();
+ copy_buffer& tuple(std::int16_t fields);
+ copy_buffer& null();
+ copy_buffer& int2(std::int16_t value);
+ copy_buffer& int4(std::int32_t value);
+ copy_buffer& int8(std::int64_t value);
+ // Microseconds since the Unix epoch
+ copy_buffer& timestamptz(std::int64_t value);
+ // A decimal number, e.g. "-0.00123" or "1e-8", with its scale preserved as
+ // numeric_in() does. Throws std::invalid_argument on anything else
+ copy_buffer& numeric(const std::string& value);
+ // text, varchar and enum labels
+ copy_buffer& text(const std::string& value);
+ // A tuple encoded by tuple() and the field functions of another buffer
+ copy_buffer& append(const std::string& tuple);
+ copy_buffer& trailer();
+
+ const std::string& data() const { return data_; };
+ std::size_t rows() const { return rows_; };
+ bool empty() const { return !rows_; };
+ void clear();
+
+private:
+ template <typename T>
+ void put(T value);
+ std::string data_;
+ std::size_t rows_ = 0;
+};
+
+}  // namespace obad
+#endif
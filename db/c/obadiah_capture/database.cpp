@@ -0,0 +1,87 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "database.h"
+#include <stdexcept>
+
+namespace obad {
+
+database::database(const std::string& conninfo)
+    : connection_{PQconnectdb(conninfo.c_str())} {
+ if (PQstatus(connection_) != CONNECTION_OK) {
+  std::string message = PQerrorMessage(connection_);
+  PQfinish(connection_);
+  throw std::runtime_error(message);
+ }
+}
+
+database::~database() { PQfinish(connection_); }
+
+PGresult*
+database::exec(const std::string& statement,
+               const std::vector<std::string>& params,
+               ExecStatusType expected) {
+ std::vector<const char*> values;
+ for (const std::string& p : params) values.push_back(p.c_str());
+ PGresult* result =
+     PQexecParams(connection_, statement.c_str(), values.size(), nullptr,
+                  values.data(), nullptr, nullptr, 0);
+ if (PQresultStatus(result) != expected) {
+  std::string message = PQresultErrorMessage(result);
+  PQclear(result);
+  throw std::runtime_error(message + statement);
+ }
+ return result;
+}
+
+std::string
+database::query_value(const std::string& query,
+                      const std::vector<std::string>& params) {
+ PGresult* result = exec(query, params, PGRES_TUPLES_OK);
+ if (PQntuples(result) < 1 || PQgetisnull(result, 0, 0)) {
+  PQclear(result);
+  throw std::runtime_error("no value returned by " + query);
+ }
+ std::string value = PQgetvalue(result, 0, 0);
+ PQclear(result);
+ return value;
+}
+
+void
+database::execute(const std::string& statement,
+                  const std::vector<std::string>& params) {
+ PQclear(exec(statement, params, PGRES_COMMAND_OK));
+}
+
+void
+database::copy(const std::string& statement, const copy_buffer& rows) {
+ PQclear(exec(statement, {}, PGRES_COPY_IN));
+ copy_buffer header, trailer;
+ header.header();
+ trailer.trailer();
+ for (const std::string* part : {&header.data(), &rows.data(), &trailer.data()})
+  if (PQputCopyData(connection_, part->data(), part->size()) != 1)
+   throw std::runtime_error(PQerrorMessage(connection_));
+ if (PQputCopyEnd(connection_, nullptr) != 1)
+  throw std::runtime_error(PQerrorMessage(connection_));
+ PGresult* result = PQgetResult(connection_);
+ bool is_ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+ std::string message = PQresultErrorMessage(result);
+ PQclear(result);
+ while ((result = PQgetResult(connection_))) PQclear(result);
+ if (!is_ok) throw std::runtime_error(message + statement);
+}
+
+}  // namespace obad
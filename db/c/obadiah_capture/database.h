@@ -0,0 +1,52 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include <libpq-fe.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "copy_buffer.h"
+
+namespace obad {
+
+// A connection to obadiah database. Throws std::runtime_error on errors
+class database {
+public:
+ explicit database(const std::string& conninfo);
+ ~database();
+ database(const database&) = delete;
+ database& operator=(const database&) = delete;
+
+ // The value of the first column of the first row or throws if none
+ std::string query_value(const std::string& query,
+                         const std::vector<std::string>& params);
+ void execute(const std::string& statement,
+              const std::vector<std::string>& params);
+ // Runs a COPY ... FROM STDIN (FORMAT binary) statement with rows, which
+ // must have neither header nor trailer
+ void copy(const std::string& statement, const copy_buffer& rows);
+
+private:
+ PGresult* exec(const std::string& statement,
+                const std::vector<std::string>& params,
+                ExecStatusType expected);
+ PGconn* connection_;
+};
+
+}  // namespace obad
+#endif
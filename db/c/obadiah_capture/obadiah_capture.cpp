@@ -0,0 +1,362 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// obadiah_capture - saves messages of an exchange's websocket API into the
+// transient tables of obadiah database, the same as `obadiah -s` does.
+//
+// The messages are read, one JSON message per line, from a file, stdin, a
+// TCP port or a Unix socket, so it can be fed by a websocket client (e.g.
+// websocat) or by a replay of a recorded session. A line may start with
+// the local timestamp of the message (microseconds since the Unix epoch)
+// followed by a tab, otherwise the time of reading is used.
+//
+// The reading thread passes lines to the processing thread through a
+// lock-free queue. The processing thread parses them into insertions, holds
+// them in reorder_buffer for --delay seconds and saves them in batches by
+// binary COPY.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "capture.h"
+#include "copy_buffer.h"
+#include "database.h"
+#include "reorder_buffer.h"
+
+namespace obad {
+
+severity log::level = severity::info;
+
+std::string
+log::timestamp() const {
+ static const char* const names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+ std::time_t t = std::time(nullptr);
+ std::ostringstream s;
+ s << std::put_time(std::localtime(&t), "%F %T ") << std::setw(6) << getpid()
+   << " obadiah_capture " << std::left << std::setw(8)
+   << names[static_cast<int>(severity_)] << ' ';
+ return s.str();
+}
+
+namespace {
+
+std::atomic<bool> is_stopping{false};
+
+void
+stop(int) {
+ is_stopping = true;
+}
+
+struct message {
+ microseconds local_timestamp;
+ std::string text;
+};
+
+// Single producer (the reading thread), single consumer (the processing
+// thread). nullptr marks the end of input
+using ingest_queue =
+    boost::lockfree::spsc_queue<message*, boost::lockfree::capacity<1 << 16>>;
+
+// Reads lines from a descriptor until EOF or stop
+class line_reader {
+public:
+ line_reader(int fd, ingest_queue& queue) : fd_{fd}, queue_(queue){};
+
+ // Returns false on EOF
+ bool read() {
+  pollfd p{fd_, POLLIN, 0};
+  while (!is_stopping) {
+   if (poll(&p, 1, 100) <= 0) continue;
+   char buffer[1 << 16];
+   ssize_t n = ::read(fd_, buffer, sizeof(buffer));
+   if (n <= 0) {
+    if (!pending_.empty()) push(pending_);
+    pending_.clear();
+    return false;
+   }
+   microseconds lts = now();
+   std::size_t start = 0;
+   for (ssize_t i = 0; i < n; ++i)
+    if (buffer[i] == '\n') {
+     pending_.append(buffer + start, i - start);
+     push(pending_, lts);
+     pending_.clear();
+     start = i + 1;
+    }
+   pending_.append(buffer + start, n - start);
+  }
+  return false;
+ }
+
+private:
+ void push(const std::string& line, microseconds lts = now()) {
+  if (line.empty()) return;
+  message* m = new message{lts, line};
+  std::size_t tab = line.find('\t');
+  if (tab != std::string::npos && tab > 0 &&
+      line.find_first_not_of("0123456789") == tab) {
+   m->local_timestamp = std::stoll(line.substr(0, tab));
+   m->text.erase(0, tab + 1);
+  }
+  while (!queue_.push(m)) std::this_thread::yield();
+ }
+ int fd_;
+ ingest_queue& queue_;
+ std::string pending_;
+};
+
+int
+listen_on(const std::string& input) {
+ int s;
+ if (input.compare(0, 4, "tcp:") == 0) {
+  s = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(std::stoi(input.substr(4)));
+  if (bind(s, reinterpret_cast<sockaddr*>(&a), sizeof(a)) < 0)
+   throw std::runtime_error("can't bind to " + input);
+ } else {
+  s = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un a{};
+  a.sun_family = AF_UNIX;
+  std::string path = input.substr(5);
+  unlink(path.c_str());
+  std::strncpy(a.sun_path, path.c_str(), sizeof(a.sun_path) - 1);
+  if (bind(s, reinterpret_cast<sockaddr*>(&a), sizeof(a)) < 0)
+   throw std::runtime_error("can't bind to " + input);
+ }
+ listen(s, 1);
+ return s;
+}
+
+// Reads from input until EOF (a file) or stop (a socket: one connection at a
+// time, the next one may follow after the previous is closed)
+void
+read_input(const std::string& input, ingest_queue& queue) {
+ try {
+  if (input.compare(0, 4, "tcp:") == 0 || input.compare(0, 5, "unix:") == 0) {
+   int s = listen_on(input);
+   pollfd p{s, POLLIN, 0};
+   while (!is_stopping) {
+    if (poll(&p, 1, 100) <= 0) continue;
+    int c = accept(s, nullptr, nullptr);
+    if (c < 0) continue;
+    log(severity::info) << "Accepted a connection on " << input;
+    line_reader(c, queue).read();
+    close(c);
+   }
+   close(s);
+  } else {
+   int fd = input == "-" ? 0 : open(input.c_str(), O_RDONLY);
+   if (fd < 0) throw std::runtime_error("can't open " + input);
+   line_reader(fd, queue).read();
+   if (fd) close(fd);
+  }
+ } catch (std::exception& e) {
+  log(severity::error) << e.what();
+ }
+ while (!queue.push(nullptr)) std::this_thread::yield();
+}
+
+// Accumulates released insertions and saves them
+class saver {
+public:
+ saver(database& db, std::vector<std::string> copy_statements,
+       std::size_t batch_size, microseconds flush_interval)
+     : db_(db),
+       statements_{std::move(copy_statements)},
+       tables_(statements_.size()),
+       batch_size_{batch_size},
+       flush_interval_{flush_interval},
+       last_flush_{now()} {};
+
+ void operator()(insertion&& i) {
+  if (i.table < 0) {
+   flush();  // the statement may depend on the rows released before it
+   db_.execute(i.data, i.params);
+  } else {
+   tables_[i.table].append(i.data);
+   if (tables_[i.table].rows() >= batch_size_) flush(i.table);
+  }
+ }
+
+ void flush_if_due(microseconds t) {
+  if (t - last_flush_ >= flush_interval_) {
+   flush();
+   last_flush_ = t;
+  }
+ }
+
+ void flush() {
+  for (std::size_t t = 0; t < tables_.size(); ++t) flush(t);
+ }
+
+ std::size_t saved() const { return saved_; };
+
+private:
+ void flush(std::size_t t) {
+  if (tables_[t].empty()) return;
+  db_.copy(statements_[t], tables_[t]);
+  log(severity::debug) << "Saved " << tables_[t].rows() << " rows by "
+                       << statements_[t];
+  saved_ += tables_[t].rows();
+  tables_[t].clear();
+ }
+ database& db_;
+ std::vector<std::string> statements_;
+ std::vector<copy_buffer> tables_;
+ std::size_t batch_size_;
+ microseconds flush_interval_;
+ microseconds last_flush_;
+ std::size_t saved_ = 0;
+};
+
+void
+usage() {
+ std::cerr
+     << "Usage: obadiah_capture -s PAIR:EXCHANGE [-d DBNAME] [-U USER] [-p PORT]\n"
+        "                       [-i INPUT] [-D DELAY] [-b BATCH] [-f FLUSH] [-v]\n"
+        "  -s  the stream, e.g. BTCUSD:BITSTAMP or BTCUSD:BITFINEX\n"
+        "  -d  the database (default: ob-analytics)\n"
+        "  -U  the database role (default: ob-analytics)\n"
+        "  -p  the port of PostgreSQL server (default: 5432)\n"
+        "  -i  a file, - for stdin (default), tcp:PORT or unix:PATH\n"
+        "  -D  the reordering delay, seconds (default: 1)\n"
+        "  -B  max number of messages held for reordering (default: 1000000)\n"
+        "  -b  max number of rows saved by one COPY (default: 1000)\n"
+        "  -f  max interval between saves, seconds (default: 1)\n"
+        "  -v  log debug messages\n";
+}
+
+}  // namespace
+}  // namespace obad
+
+int
+main(int argc, char* argv[]) {
+ using namespace obad;
+ std::string stream, dbname = "ob-analytics", user = "ob-analytics",
+                     port = "5432", input = "-";
+ double delay = 1, flush_interval = 1;
+ std::size_t batch_size = 1000, max_held = 1000000;
+ int opt;
+ while ((opt = getopt(argc, argv, "s:d:U:p:i:D:B:b:f:vh")) != -1) {
+  switch (opt) {
+   case 's': stream = optarg; break;
+   case 'd': dbname = optarg; break;
+   case 'U': user = optarg; break;
+   case 'p': port = optarg; break;
+   case 'i': input = optarg; break;
+   case 'D': delay = std::stod(optarg); break;
+   case 'B': max_held = std::stoul(optarg); break;
+   case 'b': batch_size = std::stoul(optarg); break;
+   case 'f': flush_interval = std::stod(optarg); break;
+   case 'v': log::level = severity::debug; break;
+   default: usage(); return 1;
+  }
+ }
+ std::size_t colon = stream.find(':');
+ if (colon == std::string::npos) {
+  usage();
+  return 1;
+ }
+ std::string pair = stream.substr(0, colon), exchange = stream.substr(colon + 1);
+ for (char& c : exchange) c = std::tolower(c);
+ if (exchange != "bitstamp" && exchange != "bitfinex") {
+  std::cerr << "Exchange " << exchange << " is not supported (yet)\n";
+  return 1;
+ }
+
+ std::signal(SIGINT, stop);
+ std::signal(SIGTERM, stop);
+ std::signal(SIGPIPE, SIG_IGN);
+
+ try {
+  database db("dbname='" + dbname + "' user='" + user + "' port='" + port +
+              "' application_name='" + exchange + ":" + pair + "'");
+  std::int16_t pair_id = std::stoi(db.query_value(
+      "select pair_id from obanalytics.pairs where pair = $1", {pair}));
+  std::unique_ptr<message_handler> handler =
+      exchange == "bitstamp" ? new_bitstamp_handler(pair_id)
+                             : new_bitfinex_handler(pair_id);
+  log(severity::info) << "Started " << exchange << ", " << pair << ", "
+                      << user << ", " << dbname << ", " << port;
+
+  ingest_queue queue;
+  std::thread reader(read_input, input, std::ref(queue));
+  reorder_buffer buffer(static_cast<microseconds>(delay * 1e6), max_held);
+  saver save(db, handler->copy_statements(), batch_size,
+             static_cast<microseconds>(flush_interval * 1e6));
+  insertions parsed;
+  microseconds idle_since = 0;
+  std::size_t received = 0;
+  for (;;) {
+   message* m;
+   if (queue.pop(m)) {
+    if (!m) break;
+    idle_since = 0;
+    ++received;
+    try {
+     json j;
+     std::istringstream s(m->text);
+     boost::property_tree::read_json(s, j);
+     handler->process(m->local_timestamp, j, parsed);
+    } catch (std::exception& e) {
+     log(severity::error) << e.what() << ": " << m->text;
+    }
+    delete m;
+    for (insertion& i : parsed) buffer.push(std::move(i));
+    parsed.clear();
+   } else {
+    // Nothing has been received for the remaining delay, so what is held
+    // may be released as if something arrived now
+    microseconds t = now();
+    if (!idle_since)
+     idle_since = t;
+    else if (t - idle_since >= buffer.remaining_delay())
+     buffer.idle(t);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   buffer.release(save);
+   save.flush_if_due(now());
+  }
+  reader.join();
+  handler->close(parsed);
+  for (insertion& i : parsed) buffer.push(std::move(i));
+  buffer.drain(save);
+  save.flush();
+  log(severity::info) << "Received " << received << " messages, saved "
+                      << save.saved() << " rows. Exiting ...";
+ } catch (std::exception& e) {
+  log(severity::error) << e.what();
+  return 1;
+ }
+ return 0;
+}
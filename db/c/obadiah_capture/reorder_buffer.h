@@ -0,0 +1,107 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <cstdint>
+#include <queue>
+#include <vector>
+#include "capture.h"
+
+namespace obad {
+
+// Holds insertions until the local timestamps of the arrived ones are delay
+// ahead of the local timestamp of the earliest held one, so the insertions
+// which arrive out of order within delay are released in the order of
+// (exchange_timestamp, priority, local_timestamp). No more than max_size
+// insertions are held: the earliest ones are released regardless of delay.
+class reorder_buffer {
+public:
+ reorder_buffer(microseconds delay, std::size_t max_size)
+     : delay_{delay}, max_size_{max_size} {};
+
+ void push(insertion&& i) {
+  // Nothing is held, so the delay is counted from i. Also after idle(t),
+  // since the local timestamps of a replay may be far behind t
+  if (buffer_.empty())
+   latest_departed_ = latest_arrived_ = i.local_timestamp;
+  else if (i.local_timestamp > latest_arrived_)
+   latest_arrived_ = i.local_timestamp;
+  buffer_.push(item{std::move(i), sequence_++});
+ }
+
+ // Nothing has arrived for the remaining delay till t
+ void idle(microseconds t) {
+  if (t > latest_arrived_) latest_arrived_ = t;
+ };
+
+ microseconds remaining_delay() const {
+  return delay_ - (latest_arrived_ - latest_departed_);
+ };
+
+ // Passes the insertions which are due to sink in order
+ template <typename Sink>
+ void release(Sink&& sink) {
+  while (!buffer_.empty()) {
+   const insertion& top = buffer_.top().i;
+   if (top.local_timestamp > latest_departed_)
+    latest_departed_ = top.local_timestamp;
+   if (latest_arrived_ - latest_departed_ >= delay_ ||
+       buffer_.size() > max_size_) {
+    sink(std::move(const_cast<insertion&>(top)));
+    buffer_.pop();
+   } else {
+    return;
+   }
+  }
+  // Not now(): the local timestamps of a replay may be far behind it
+  latest_departed_ = latest_arrived_;
+ }
+
+ // Passes all insertions to sink in order
+ template <typename Sink>
+ void drain(Sink&& sink) {
+  for (; !buffer_.empty(); buffer_.pop())
+   sink(std::move(const_cast<insertion&>(buffer_.top().i)));
+ }
+
+ std::size_t size() const { return buffer_.size(); };
+
+private:
+ struct item {
+  insertion i;
+  std::uint64_t sequence;  // makes the order total
+ };
+ struct later {
+  bool operator()(const item& a, const item& b) const {
+   if (a.i.exchange_timestamp != b.i.exchange_timestamp)
+    return a.i.exchange_timestamp > b.i.exchange_timestamp;
+   if (a.i.priority != b.i.priority) return a.i.priority > b.i.priority;
+   if (a.i.local_timestamp != b.i.local_timestamp)
+    return a.i.local_timestamp > b.i.local_timestamp;
+   return a.sequence > b.sequence;
+  }
+ };
+ microseconds delay_;
+ std::size_t max_size_;
+ microseconds latest_arrived_ = 0;
+ microseconds latest_departed_ = 0;
+ std::uint64_t sequence_ = 0;
+ std::priority_queue<item, std::vector<item>, later> buffer_;
+};
+
+}  // namespace obad
+#endif
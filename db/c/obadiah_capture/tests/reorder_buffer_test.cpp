@@ -0,0 +1,211 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Replays a recorded Bitstamp session (tests/bitstamp_session.txt, in the
+// input format of obadiah_capture) through the Bitstamp handler into
+// reorder_buffer, as the processing thread of obadiah_capture does, and
+// checks the order of the released insertions, the max_size overflow and a
+// replay after the buffer has been idle. 'make check' builds and runs it.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <boost/property_tree/json_parser.hpp>
+#include "../capture.h"
+#include "../reorder_buffer.h"
+
+namespace obad {
+
+severity log::level = severity::warning;
+
+std::string
+log::timestamp() const {
+ return "";
+}
+
+}  // namespace obad
+
+namespace {
+
+using obad::insertion;
+using obad::microseconds;
+
+struct message {
+ microseconds local_timestamp;
+ std::string text;
+};
+
+std::vector<message>
+read_session(const char* file_name) {
+ std::vector<message> session;
+ std::ifstream file(file_name);
+ std::string line;
+ while (std::getline(file, line)) {
+  std::size_t tab = line.find('\t');
+  session.push_back(
+      message{std::stoll(line.substr(0, tab)), line.substr(tab + 1)});
+ }
+ return session;
+}
+
+// The insertions of each message, in the order of arrival
+std::vector<obad::insertions>
+parse(const std::vector<message>& session) {
+ std::unique_ptr<obad::message_handler> handler = obad::new_bitstamp_handler(1);
+ std::vector<obad::insertions> parsed;
+ for (const message& m : session) {
+  obad::json j;
+  std::istringstream s(m.text);
+  boost::property_tree::read_json(s, j);
+  parsed.emplace_back();
+  handler->process(m.local_timestamp, j, parsed.back());
+ }
+ return parsed;
+}
+
+bool
+earlier(const insertion& a, const insertion& b) {
+ if (a.exchange_timestamp != b.exchange_timestamp)
+  return a.exchange_timestamp < b.exchange_timestamp;
+ if (a.priority != b.priority) return a.priority < b.priority;
+ return a.local_timestamp < b.local_timestamp;
+}
+
+int failures = 0;
+
+void
+expect(bool condition, const char* test, const char* what) {
+ if (!condition) {
+  std::fprintf(stderr, "%s: %s\n", test, what);
+  ++failures;
+ }
+}
+
+// Pushes the insertions of each message and releases the due ones after
+// each, as obadiah_capture does. shift is added to the local timestamps.
+// Returns the number of insertions pushed
+std::size_t
+replay(const std::vector<obad::insertions>& parsed, microseconds shift,
+       obad::reorder_buffer& buffer, microseconds delay, const char* test,
+       std::vector<insertion>& released) {
+ std::size_t pushed = 0;
+ microseconds arrived = 0;
+ for (const obad::insertions& message : parsed) {
+  for (insertion i : message) {
+   i.local_timestamp += shift;
+   arrived = i.local_timestamp;
+   buffer.push(std::move(i));
+   ++pushed;
+  }
+  buffer.release([&](insertion&& i) {
+   expect(arrived - i.local_timestamp >= delay, test,
+          "an insertion is released before delay");
+   released.push_back(std::move(i));
+  });
+ }
+ return pushed;
+}
+
+// With delay longer than the skew of the recorded exchange timestamps, the
+// insertions are released in the order of the exchange timestamps, though
+// the session has trades arriving after later order events
+void
+test_out_of_order(const std::vector<obad::insertions>& parsed) {
+ const char* test = "out of order";
+ const microseconds delay = 100000;
+ obad::reorder_buffer buffer(delay, 1000);
+ std::vector<insertion> released;
+ std::size_t pushed = replay(parsed, 0, buffer, delay, test, released);
+ expect(!released.empty(), test, "nothing is released before drain()");
+ expect(buffer.size() < pushed, test, "everything is held");
+ buffer.drain([&](insertion&& i) { released.push_back(std::move(i)); });
+ expect(released.size() == pushed, test, "insertions are lost");
+ expect(std::is_sorted(released.begin(), released.end(), earlier), test,
+        "insertions are released out of order");
+ // The era of live_orders precedes the first order event
+ expect(released.front().table == -1, test,
+        "the era is not released first");
+}
+
+// No more than max_size insertions are held, whatever the delay
+void
+test_max_size(const std::vector<obad::insertions>& parsed) {
+ const char* test = "max_size";
+ const std::size_t max_size = 2;
+ obad::reorder_buffer buffer(1000000000, max_size);
+ std::size_t pushed = 0, released = 0;
+ for (const obad::insertions& message : parsed) {
+  for (insertion i : message) {
+   buffer.push(std::move(i));
+   ++pushed;
+  }
+  buffer.release([&](insertion&&) { ++released; });
+  expect(buffer.size() <= max_size, test, "more than max_size are held");
+ }
+ expect(released == pushed - max_size, test,
+        "not only the overflow is released");
+}
+
+// The main loop of obadiah_capture calls idle() with the current time once
+// nothing has arrived for the remaining delay. A replay of a recorded
+// session started after that has local timestamps far behind the current
+// time, yet it is to be held and released in the same way
+void
+test_idle_then_replay(const std::vector<obad::insertions>& parsed) {
+ const char* test = "idle then replay";
+ const microseconds delay = 100000;
+ obad::reorder_buffer buffer(delay, 1000);
+ std::vector<insertion> released;
+ std::size_t pushed =
+     replay(parsed, -3600000000LL, buffer, delay, test, released);
+ std::size_t due = released.size();
+ buffer.idle(obad::now());
+ buffer.release([&](insertion&& i) { released.push_back(std::move(i)); });
+ expect(!buffer.size(), test, "idle() does not release everything");
+ expect(buffer.remaining_delay() == delay, test,
+        "the remaining delay is not the full one after idle()");
+ expect(released.size() == pushed, test, "insertions are lost");
+
+ std::vector<insertion> replayed;
+ pushed = replay(parsed, 0, buffer, delay, test, replayed);
+ expect(replayed.size() == due, test,
+        "the replay is held longer than the first run");
+ buffer.drain([&](insertion&& i) { replayed.push_back(std::move(i)); });
+ expect(replayed.size() == pushed, test, "replayed insertions are lost");
+ expect(std::is_sorted(replayed.begin(), replayed.end(), earlier), test,
+        "replayed insertions are released out of order");
+}
+
+}  // namespace
+
+int
+main(int argc, char* argv[]) {
+ std::vector<message> session =
+     read_session(argc > 1 ? argv[1] : "tests/bitstamp_session.txt");
+ if (session.empty()) {
+  std::fprintf(stderr, "the recorded session is empty or missing\n");
+  return 1;
+ }
+ std::vector<obad::insertions> parsed = parse(session);
+ test_out_of_order(parsed);
+ test_max_size(parsed);
+ test_idle_then_replay(parsed);
+ if (failures) {
+  std::fprintf(stderr, "reorder_buffer: %d failures\n", failures);
+  return 1;
+ }
+ std::printf("reorder_buffer: OK\n");
+ return 0;
+}
@@ -0,0 +1,110 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "binary_copy.h"
+#include <cstring>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "catalog/pg_type_d.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+namespace obad {
+
+binary_copy::binary_copy() { initStringInfo(&buffer); };
+
+binary_copy::~binary_copy() { pfree(buffer.data); };
+
+void
+binary_copy::header() {
+ static const char signature[] = "PGCOPY\n\377\r\n";
+ appendBinaryStringInfo(&buffer, signature, sizeof(signature));  // with '\0'
+ int32_be(0);  // flags
+ int32_be(0);  // header extension length
+};
+
+void
+binary_copy::tuple(int16 fields) {
+ int16_be(fields);
+};
+
+void
+binary_copy::timestamptz(TimestampTz value) {
+ int32_be(sizeof(int64));
+ int64_be(value);
+};
+
+void
+binary_copy::float8(double value) {
+ int64 bits;
+ std::memcpy(&bits, &value, sizeof bits);
+ int32_be(sizeof(int64));
+ int64_be(bits);
+};
+
+void
+binary_copy::float8_array(const double *values, std::size_t n) {
+ // See array_send(): the header is ndim, has-nulls flag, element type and
+ // (dimension, lower bound) per dimension; each element has its length.
+ // An empty array has no dimensions.
+ if (!n) {
+  int32_be(3 * sizeof(int32));
+  int32_be(0);
+  int32_be(0);
+  int32_be(FLOAT8OID);
+  return;
+ }
+ int32_be(5 * sizeof(int32) + n * (sizeof(int32) + sizeof(int64)));
+ int32_be(1);
+ int32_be(0);
+ int32_be(FLOAT8OID);
+ int32_be(n);
+ int32_be(1);
+ for (std::size_t i = 0; i < n; ++i) float8(values[i]);
+};
+
+void
+binary_copy::trailer() {
+ int16_be(-1);
+};
+
+void
+binary_copy::int16_be(int16 value) {
+ uint16 v = static_cast<uint16>(value);
+ char bytes[2] = {static_cast<char>(v >> 8), static_cast<char>(v)};
+ appendBinaryStringInfo(&buffer, bytes, sizeof bytes);
+};
+
+void
+binary_copy::int32_be(int32 value) {
+ uint32 v = static_cast<uint32>(value);
+ char bytes[4];
+ for (int i = 3; i >= 0; --i, v >>= 8) bytes[i] = static_cast<char>(v);
+ appendBinaryStringInfo(&buffer, bytes, sizeof bytes);
+};
+
+void
+binary_copy::int64_be(int64 value) {
+ uint64 v = static_cast<uint64>(value);
+ char bytes[8];
+ for (int i = 7; i >= 0; --i, v >>= 8) bytes[i] = static_cast<char>(v);
+ appendBinaryStringInfo(&buffer, bytes, sizeof bytes);
+};
+}  // namespace obad
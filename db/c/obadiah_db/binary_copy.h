@@ -0,0 +1,73 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BINARY_COPY_H
+#define BINARY_COPY_H
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "postgres.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "lib/stringinfo.h"
+#include "utils/timestamp.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#include <cstddef>
+
+namespace obad {
+
+// Encodes tuples in the binary format of COPY, so the output can be loaded
+// with COPY ... FROM ... (FORMAT binary). The buffer is palloc'ed in the
+// memory context which is current when the object is constructed.
+class binary_copy {
+public:
+ binary_copy();
+ ~binary_copy();
+
+ void header();
+ void tuple(int16 fields);
+ void timestamptz(TimestampTz value);
+ void float8(double value);
+ // One-dimensional float8[] without NULLs
+ void float8_array(const double *values, std::size_t n);
+ void trailer();
+
+ // Encoded data not yet taken by the caller
+ const char *data() const { return buffer.data; };
+ int size() const { return buffer.len; };
+ void clear() { resetStringInfo(&buffer); };
+
+private:
+ void int16_be(int16 value);
+ void int32_be(int32 value);
+ void int64_be(int64 value);
+
+ StringInfoData buffer;
+};
+}  // namespace obad
+#endif
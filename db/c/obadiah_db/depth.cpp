@@ -23,35 +23,37 @@ depth::spread() {
  amount best_bid_qty{-1}, best_ask_qty{-1};
 
  if (!bid.empty()) {
-  level2 &best_level = bid.rbegin()->second;
-  best_bid_price = best_level.get_price();
-  best_bid_qty = best_level.get_volume();
+  best_bid_price = bid.best_price();
+  best_bid_qty = bid.best_volume();
  }
 
  if (!ask.empty()) {
-  level2 &best_level = ask.begin()->second;
-  best_ask_price = best_level.get_price();
-  best_ask_qty = best_level.get_volume();
+  best_ask_price = ask.best_price();
+  best_ask_qty = ask.best_volume();
  }
 
  return level1{best_bid_price, best_bid_qty, best_ask_price, best_ask_qty,
                episode};
 }
 
+void
+depth::update(const level2 &l) {
+ if (l.get_volume() > 0)
+  if (l.get_side() == 'b')
+   bid.set(l.get_price(), l.get_volume());
+  else
+   ask.set(l.get_price(), l.get_volume());
+ else if (l.get_side() == 'b')
+  bid.erase(l.get_price());
+ else
+  ask.erase(l.get_price());
+}
+
 level1
 depth::update(obad::deque<obad::level2> *v) {
  if (!v->empty()) episode = v->front().get_microtimestamp();
  while(!v->empty()) {
-  level2 &l {v->front()};
-  if (l.get_volume() > 0)
-   if (l.get_side() == 'b')
-    bid[l.get_price()] = std::move(l);
-   else
-    ask[l.get_price()] = std::move(l);
-  else if (l.get_side() == 'b')
-   bid.erase(l.get_price());
-  else
-   ask.erase(l.get_price());
+  update(v->front());
   v->pop_front();
  }
  return spread();
@@ -60,17 +62,7 @@ depth::update(obad::deque<obad::level2> *v) {
 level1
 depth::update(std::vector<level2> v) {
  if (!v.empty()) episode = v[0].get_microtimestamp();
- for (level2 &l : v) {
-  if (l.get_volume() > 0)
-   if (l.get_side() == 'b')
-    bid[l.get_price()] = std::move(l);
-   else
-    ask[l.get_price()] = std::move(l);
-  else if (l.get_side() == 'b')
-   bid.erase(l.get_price());
-  else
-   ask.erase(l.get_price());
- }
+ for (level2 &l : v) update(l);
  return spread();
 };
 
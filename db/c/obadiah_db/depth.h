@@ -38,6 +38,8 @@ extern "C" {
 }
 #endif  // __cplusplus
 
+#include <algorithm>
+#include <functional>
 #include <map>
 #include "level1.h"
 #include "level2.h"
@@ -46,6 +48,82 @@ extern "C" {
 
 namespace obad {
 
+// One side of depth: up to top_levels best levels are kept in a flat array
+// ordered from the best, the rest are in an overflow tree. All prices in
+// the array are better than any price in the tree. Most updates happen near
+// the touch, so they touch a few adjacent array elements only, and the best
+// level is always the array's front.
+template <class Better>
+class depth_side {
+public:
+ static constexpr std::size_t top_levels = 64;
+
+ depth_side() { top.reserve(top_levels + 1); };
+ bool empty() const { return top.empty(); };
+ price best_price() const { return top.front().p; };
+ amount best_volume() const { return top.front().v; };
+ void set(price, amount);
+ void erase(price);
+
+private:
+ struct level {
+  price p;
+  amount v;
+ };
+ bool is_top(price p) const {
+  return overflow.empty() || better(p, overflow.begin()->first);
+ };
+ typename obad::vector<level>::iterator find_top(price p) {
+  return std::lower_bound(
+      top.begin(), top.end(), p,
+      [this](const level &l, price p) { return better(l.p, p); });
+ };
+
+ Better better;
+ obad::vector<level> top;
+ obad::map<price, amount, Better> overflow;
+};
+
+template <class Better>
+void
+depth_side<Better>::set(price p, amount v) {
+ if (!is_top(p)) {
+  overflow[p] = v;
+  return;
+ }
+ auto it = find_top(p);
+ if (it != top.end() && it->p == p) {
+  it->v = v;
+  return;
+ }
+ top.insert(it, level{p, v});
+ if (top.size() > top_levels) {
+  // the worst level of the array is better than any level in the tree
+  overflow.emplace_hint(overflow.begin(), top.back().p, top.back().v);
+  top.pop_back();
+ }
+}
+
+template <class Better>
+void
+depth_side<Better>::erase(price p) {
+ if (!is_top(p)) {
+  overflow.erase(p);
+  return;
+ }
+ auto it = find_top(p);
+ if (it == top.end() || it->p != p) return;
+ top.erase(it);
+ if (top.empty() && !overflow.empty()) {
+  // refill a half of the array, so the next levels can be inserted in place
+  auto last = overflow.begin();
+  for (std::size_t i = 0; i < top_levels / 2 && last != overflow.end();
+       ++i, ++last)
+   top.push_back(level{last->first, last->second});
+  overflow.erase(overflow.begin(), last);
+ }
+}
+
 class depth : public postgres_heap {
 public:
  ~depth();
@@ -54,10 +132,10 @@ public:
  level1 update(std::vector<level2>);
 
 private:
- void update_spread(level2&);
+ void update(const level2 &);
  TimestampTz episode;
- obad::map<price, level2> bid;
- obad::map<price, level2> ask;
+ depth_side<std::greater<price>> bid;
+ depth_side<std::less<price>> ask;
 };
 
 }  // namespace obad
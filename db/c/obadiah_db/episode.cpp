@@ -15,7 +15,9 @@
 
 #include "episode.h"
 #include <vector>
+#include "frequency.h"
 #include "obadiah_db.h"
+#include "spi_plan.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,16 +30,33 @@ extern "C" {
 #endif  // __cplusplus
 
 namespace obad {
-const char *const episode::CURSOR = "level3";
+const char *const episode::CURSORS[] = {"level3", "level3_b", "level3_s"};
 const int episode::SPI_CURSOR_FETCH_COUNT = 1000;
+bool episode::merge_sides = true;
+
+namespace {
+// side_condition restricts the query to one list partition of level3
+std::string
+level3_query(const char *side_condition) {
+ return std::string{R"QUERY(
+        select microtimestamp, order_id, event_no, side, price, amount,
+               next_microtimestamp, price_microtimestamp
+        from obanalytics.level3
+        where microtimestamp between $1 and $2
+          and pair_id = $3
+          and exchange_id = $4)QUERY"} +
+        side_condition + R"QUERY(
+        order by microtimestamp, order_id, event_no)QUERY";
+}
+}  // namespace
+
+episode::episode() : n_sources{0}, frequency_in_seconds{0} {};
 
 episode::~episode() {
- SPI_connect();
- SPI_cursor_close(SPI_cursor_find(CURSOR));
- SPI_finish();
- if (events_deque) {
-  events_deque->~deque();
-  pfree(events_deque);
+ done();
+ for (int i = 0; i < n_sources; ++i) {
+  sources[i].events->~deque();
+  pfree(sources[i].events);
  }
 };
 
@@ -45,7 +64,6 @@ std::vector<level3>
 episode::initial(Datum start_time, Datum end_time, Datum pair_id,
                         Datum exchange_id, Datum frequency) {
  SPI_connect();
- events_deque = new (SPI_palloc(sizeof(level3_deque))) level3_deque;
  Oid types[5];
  types[0] = TIMESTAMPTZOID;
  types[1] = INT4OID;
@@ -56,11 +74,14 @@ episode::initial(Datum start_time, Datum end_time, Datum pair_id,
  values[1] = pair_id;
  values[2] = exchange_id;
 
- SPI_execute_with_args(
-     "select ts, ob.* from obanalytics.order_book($1, $2, $3, false, "
-     "true, "
-     "false) join unnest(ob) ob on true order by price",
-     3, types, values, NULL, true, 0);
+ static cached_plan order_book_plan;
+ SPI_execute_plan(
+     kept_plan(order_book_plan,
+               "select ts, ob.* from obanalytics.order_book($1, $2, $3, false, "
+               "true, "
+               "false) join unnest(ob) ob on true order by price",
+               3, types),
+     values, NULL, true, 0);
 
  std::vector<level3> result{};
 #if DEBUG_DEPTH
@@ -83,86 +104,112 @@ episode::initial(Datum start_time, Datum end_time, Datum pair_id,
  values[1] = end_time;
  values[2] = pair_id;
  values[3] = exchange_id;
- values[4] = frequency;
-
- char nulls[5] = {' ', ' ', ' ', ' ', ' '};
- if (frequency == obad::NULL_FREQ) nulls[4] = 'n';
 
- SPI_cursor_open_with_args(CURSOR, R"QUERY(
-        select get._date_ceiling(microtimestamp, $5) as microtimestamp,
-               order_id, event_no, side, price, amount,
-								     	 get._date_ceiling(next_microtimestamp, $5) as next_microtimestamp,
-								       get._date_ceiling(price_microtimestamp, $5) as price_microtimestamp
-        from obanalytics.level3
-        where microtimestamp between $1 and $2
-          and pair_id = $3
-          and exchange_id = $4
-        order by level3.microtimestamp, order_id, event_no)QUERY",
-                           5, types, values, nulls, true, 0);
+ // The timestamps are aligned to the frequency in fill(), so the cursors
+ // are plain ordered scans of the partitions
+ frequency_in_seconds = frequency == obad::NULL_FREQ
+                            ? 0
+                            : frequency_seconds(DatumGetIntervalP(frequency));
+
+ // The side is a literal so that the planner prunes the other partition and
+ // each cursor reads its month partitions in order without a global sort
+ const char *const side_conditions[] = {"", "\n          and side = 'b'",
+                                        "\n          and side = 's'"};
+ static cached_plan level3_plans[3];
+ int first = merge_sides ? 1 : 0, last = merge_sides ? 2 : 0;
+ for (int i = first; i <= last; ++i) {
+  source &s = sources[n_sources++];
+  s.cursor = CURSORS[i];
+  s.events = new (SPI_palloc(sizeof(level3_deque))) level3_deque;
+  s.exhausted = false;
+  SPI_cursor_open(s.cursor,
+                  kept_plan(level3_plans[i],
+                            level3_query(side_conditions[i]).c_str(), 4, types),
+                  values, NULL, true);
+ }
  SPI_finish();
  return result;
 };
 
-std::vector<level3>
-episode::next() {
- std::vector<level3> result{};
- TimestampTz current_episode = 0;
-
- while (true) {
-  if (events_deque->empty()) {
-   SPI_connect();
-   SPI_cursor_fetch(SPI_cursor_find(CURSOR), true, SPI_CURSOR_FETCH_COUNT);
+bool
+episode::fill(source &s) {
+ if (s.events->empty() && !s.exhausted) {
+  SPI_connect();
+  Portal portal = SPI_cursor_find(s.cursor);
+  s.exhausted = true;
+  if (portal) {
+   SPI_cursor_fetch(portal, true, SPI_CURSOR_FETCH_COUNT);
 #if DEBUG_DEPTH
-   elog(DEBUG2, "%s SPI_processed: %lu", __PRETTY_FUNCTION__, SPI_processed);
+   elog(DEBUG2, "%s %s SPI_processed: %lu", __PRETTY_FUNCTION__, s.cursor,
+        SPI_processed);
 #endif
    if (SPI_processed > 0 && SPI_tuptable != NULL) {
     for (uint64 j = 0; j < SPI_processed; j++) {
      level3 a{SPI_tuptable->vals[j], SPI_tuptable->tupdesc};
-     events_deque->push_back(std::move(a));
+     a.align_up(frequency_in_seconds);
+     s.events->push_back(std::move(a));
     }
+    s.exhausted = false;
    }
-   SPI_finish();
+  }
+  SPI_finish();
+ }
+ return !s.events->empty();
+}
+
+bool
+episode::next(std::vector<level3> &result) {
+ result.clear();
+ TimestampTz current_episode = 0;
+
+ while (true) {
+  // The source with the earliest level3. Ties go to the first source, so the
+  // order of each side's level3s within an episode is preserved
+  source *earliest = nullptr;
+  for (int i = 0; i < n_sources; ++i) {
+   if (fill(sources[i]) &&
+       (!earliest || sources[i].events->front().get_microtimestamp() <
+                         earliest->events->front().get_microtimestamp()))
+    earliest = &sources[i];
   }
 
-  if (events_deque->empty()) {
+  if (!earliest) {
    if (result.empty()) {
 #if DEBUG_DEPTH
     elog(DEBUG2, "%s ends - no more data available", __PRETTY_FUNCTION__);
 #endif
-    throw 0;  // No more data available
+    return false;  // No more data available
    } else {
 #if DEBUG_DEPTH
     elog(DEBUG2, "%s returns episode %s with %lu last level3 records",
          __PRETTY_FUNCTION__, timestamptz_to_str(current_episode),
          result.size());
 #endif
-    return result;
+    return true;
    }
-  } else {
-   if (!current_episode) {
-    current_episode = events_deque->front().get_microtimestamp();
-   }
-   while (!events_deque->empty()) {
-    if (current_episode != events_deque->front().get_microtimestamp()) {
+  }
+  TimestampTz microtimestamp = earliest->events->front().get_microtimestamp();
+  if (!current_episode) current_episode = microtimestamp;
+  if (current_episode != microtimestamp) {
 #if DEBUG_DEPTH
-     elog(DEBUG2, "%s returns episode %s with %lu level3 records",
-          __PRETTY_FUNCTION__, timestamptz_to_str(current_episode),
-          result.size());
+   elog(DEBUG2, "%s returns episode %s with %lu level3 records",
+        __PRETTY_FUNCTION__, timestamptz_to_str(current_episode),
+        result.size());
 #endif
-     return result;
-    }
-    result.push_back(std::move(events_deque->front()));
-    events_deque->pop_front();
-   }
+   return true;
   }
+  result.push_back(std::move(earliest->events->front()));
+  earliest->events->pop_front();
  }
 };
 
 void
 episode::done() {
  SPI_connect();
- Portal portal = SPI_cursor_find(CURSOR);
- if (portal) SPI_cursor_close(portal);
+ for (int i = 0; i < n_sources; ++i) {
+  Portal portal = SPI_cursor_find(sources[i].cursor);
+  if (portal) SPI_cursor_close(portal);
+ }
  SPI_finish();
 };
 }  // namespace obad
@@ -32,20 +32,41 @@ namespace obad {
 
 class episode : public postgres_heap {
 public:
- episode() : events_deque{nullptr} {};
+ episode();
  ~episode();
  std::vector<level3> initial(Datum start_time, Datum end_time, Datum pair_id,
                              Datum exchange_id, Datum frequency);
- std::vector<level3> next();
+ // Replaces the content of the vector with the next episode's level3s.
+ // Returns false (and leaves the vector empty) if there are no more episodes
+ bool next(std::vector<level3> &);
  void done();
 
+ // When true (obadiah_db.merge_sides), level3 is read through one ordered
+ // cursor per side, i.e. per list partition, and the cursors are merged
+ // here. Otherwise one cursor sorts all level3 events of the pair.
+ static bool merge_sides;
+
 private:
- static const char *const CURSOR;
+ static const char *const CURSORS[];
  static const int SPI_CURSOR_FETCH_COUNT;
+ static const int MAX_SOURCES = 2;
 
  using level3_deque = std::deque<level3, spi_allocator<level3>>;
 
- level3_deque *events_deque;
+ // An ordered cursor and the level3s fetched from it but not consumed yet
+ struct source {
+  const char *cursor;
+  level3_deque *events;
+  bool exhausted;
+ };
+ // Fetches the next portion of level3s if all the fetched ones have been
+ // consumed. Returns false if the cursor is exhausted
+ bool fill(source &);
+
+ source sources[MAX_SOURCES];
+ int n_sources;
+ // The frequency in seconds the fetched level3s are aligned to, 0 if none
+ int64 frequency_in_seconds;
 };
 }  // namespace obad
 #endif
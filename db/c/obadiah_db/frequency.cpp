@@ -0,0 +1,70 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// C versions of get._date_ceiling() and get._date_floor() (see
+// get_schema.sql)
+
+#include "frequency.h"
+#include <cmath>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "fmgr.h"
+
+PG_FUNCTION_INFO_V1(date_ceiling);
+PG_FUNCTION_INFO_V1(date_floor);
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+namespace obad {
+
+int64
+frequency_seconds(const Interval *frequency) {
+ // The same as interval_part() does for 'epoch'
+ double epoch = frequency->time / 1000000.0;
+ epoch += (DAYS_PER_YEAR * SECS_PER_DAY) * (frequency->month / MONTHS_PER_YEAR);
+ epoch += (static_cast<double>(DAYS_PER_MONTH) * SECS_PER_DAY) *
+          (frequency->month % MONTHS_PER_YEAR);
+ epoch += static_cast<double>(SECS_PER_DAY) * frequency->day;
+ int64 seconds = static_cast<int64>(std::trunc(epoch));
+ if (!seconds)
+  ereport(ERROR, (errcode(ERRCODE_DIVISION_BY_ZERO),
+                  errmsg("division by zero")));
+ return seconds;
+}
+
+}  // namespace obad
+
+Datum
+date_ceiling(PG_FUNCTION_ARGS) {
+ if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+ TimestampTz base_date = PG_GETARG_TIMESTAMPTZ(0);
+ if (PG_ARGISNULL(1) || TIMESTAMP_NOT_FINITE(base_date))
+  PG_RETURN_TIMESTAMPTZ(base_date);
+ PG_RETURN_TIMESTAMPTZ(obad::date_ceiling(
+     base_date, obad::frequency_seconds(PG_GETARG_INTERVAL_P(1))));
+}
+
+Datum
+date_floor(PG_FUNCTION_ARGS) {
+ if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+ TimestampTz base_date = PG_GETARG_TIMESTAMPTZ(0);
+ if (PG_ARGISNULL(1) || TIMESTAMP_NOT_FINITE(base_date))
+  PG_RETURN_TIMESTAMPTZ(base_date);
+ PG_RETURN_TIMESTAMPTZ(obad::date_floor(
+     base_date, obad::frequency_seconds(PG_GETARG_INTERVAL_P(1))));
+}
@@ -0,0 +1,74 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "postgres.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "utils/timestamp.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+// The alignment of timestamps to the boundaries of periods of the given
+// frequency, as get._date_ceiling() and get._date_floor() do it: the
+// frequency is the whole number of seconds in the interval and the periods
+// are counted from the Unix epoch.
+namespace obad {
+
+// Seconds since the Unix epoch of POSTGRES_EPOCH_JDATE (2000-01-01)
+static constexpr int64 UNIX_TO_POSTGRES_EPOCH =
+    static_cast<int64>(POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+
+// The frequency in seconds, as trunc(extract(epoch from frequency)) computes
+// it. Raises an error if it is zero, as the SQL versions do on division.
+int64
+frequency_seconds(const Interval *frequency);
+
+// The end of the period which contains t. A t at a boundary remains as it is.
+// Infinite timestamps remain as they are too.
+inline TimestampTz
+date_ceiling(TimestampTz t, int64 seconds) {
+ if (!seconds || TIMESTAMP_NOT_FINITE(t)) return t;
+ int64 epoch = (t + UNIX_TO_POSTGRES_EPOCH * USECS_PER_SEC - 1) / USECS_PER_SEC;
+ return (epoch / seconds + 1) * seconds * USECS_PER_SEC -
+        UNIX_TO_POSTGRES_EPOCH * USECS_PER_SEC;
+}
+
+// The start of the period which contains t
+inline TimestampTz
+date_floor(TimestampTz t, int64 seconds) {
+ if (!seconds || TIMESTAMP_NOT_FINITE(t)) return t;
+ int64 epoch = (t + UNIX_TO_POSTGRES_EPOCH * USECS_PER_SEC) / USECS_PER_SEC;
+ return epoch / seconds * seconds * USECS_PER_SEC -
+        UNIX_TO_POSTGRES_EPOCH * USECS_PER_SEC;
+}
+
+}  // namespace obad
+#endif
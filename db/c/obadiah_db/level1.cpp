@@ -14,52 +14,31 @@
 // 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
 
 #include "level1.h"
+#include "level2.h"
 
 namespace obad {
 
 HeapTuple
-level1::to_heap_tuple(AttInMetadata *attinmeta, int32 pair_id,
-                      int32 exchange_id) {
- char **values = (char **)palloc(7 * sizeof(char *));
- static const int BUFFER_SIZE = 128;
+level1::to_heap_tuple(TupleDesc tupdesc, int32 pair_id, int32 exchange_id) {
+ Datum values[7];
+ bool nulls[7] = {false, false, false, false, false, false, false};
  if (best_bid_price > 0) {
-  values[0] = (char *)palloc(BUFFER_SIZE * sizeof(char));
-  values[1] = (char *)palloc(BUFFER_SIZE * sizeof(char));
-  snprintf(values[0], BUFFER_SIZE, "%.5Lf", best_bid_price);
-  snprintf(values[1], BUFFER_SIZE, "%.8Lf", best_bid_qty);
+  values[0] = numeric_datum(best_bid_price, 5);
+  values[1] = numeric_datum(best_bid_qty, 8);
  } else {
-  values[0] = nullptr;
-  values[1] = nullptr;
+  nulls[0] = nulls[1] = true;
+  values[0] = values[1] = static_cast<Datum>(0);
  }
  if (best_ask_price > 0) {
-  values[2] = (char *)palloc(BUFFER_SIZE * sizeof(char));
-  values[3] = (char *)palloc(BUFFER_SIZE * sizeof(char));
-  snprintf(values[2], BUFFER_SIZE, "%.5Lf", best_ask_price);
-  snprintf(values[3], BUFFER_SIZE, "%.8Lf", best_ask_qty);
+  values[2] = numeric_datum(best_ask_price, 5);
+  values[3] = numeric_datum(best_ask_qty, 8);
  } else {
-  values[2] = nullptr;
-  values[3] = nullptr;
+  nulls[2] = nulls[3] = true;
+  values[2] = values[3] = static_cast<Datum>(0);
  }
- values[4] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[5] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[6] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- snprintf(values[4], BUFFER_SIZE, "%s", timestamptz_to_str(microtimestamp));
- snprintf(values[5], BUFFER_SIZE, "%i", pair_id);
- snprintf(values[6], BUFFER_SIZE, "%i", exchange_id);
- HeapTuple tuple = BuildTupleFromCStrings(attinmeta, values);
-
- if (best_bid_price > 0) {
-  pfree(values[0]);
-  pfree(values[1]);
- }
- if (best_ask_price > 0) {
-  pfree(values[2]);
-  pfree(values[3]);
- }
- pfree(values[4]);
- pfree(values[5]);
- pfree(values[6]);
- pfree(values);
- return tuple;
+ values[4] = TimestampTzGetDatum(microtimestamp);
+ values[5] = Int16GetDatum(pair_id);
+ values[6] = Int16GetDatum(exchange_id);
+ return heap_form_tuple(tupdesc, values, nulls);
 };
 }  // namespace obad
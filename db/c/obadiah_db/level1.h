@@ -60,7 +60,7 @@ struct level1 {
        best_ask_price(bap),
        best_ask_qty(baq),
        microtimestamp(m){};
- HeapTuple to_heap_tuple(AttInMetadata *, int32, int32);
+ HeapTuple to_heap_tuple(TupleDesc, int32, int32);
 
  bool operator==(const level1 &c) {
   return prices_are_equal(best_bid_price, c.best_bid_price) &&
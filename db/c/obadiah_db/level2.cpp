@@ -13,6 +13,7 @@
 // with this program; if not, write to the Free Software Foundation, Inc.,
 // 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 #include "level2.h"
+#include <cmath>
 #include <limits>
 #include <map>
 #include <sstream>
@@ -24,6 +25,9 @@ extern "C" {
 #endif  // __cplusplus
 
 #include "catalog/pg_type_d.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
 
 #ifdef __cplusplus
 }
@@ -193,37 +197,73 @@ level2_impl::operator<(const level2_impl &o) const {
 }
 
 HeapTuple
-level2::to_heap_tuple(AttInMetadata *attinmeta, int32 pair_id,
-                      int32 exchange_id) {
- char **values = (char **)palloc(8 * sizeof(char *));
- static const int BUFFER_SIZE = 128;
- values[0] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[1] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[2] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[3] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[4] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[5] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[6] = (char *)palloc(BUFFER_SIZE * sizeof(char));
- values[7] = nullptr;
- snprintf(values[0], BUFFER_SIZE, "%s",
-          timestamptz_to_str(p_impl->m));
- snprintf(values[1], BUFFER_SIZE, "%i", pair_id);
- snprintf(values[2], BUFFER_SIZE, "%i", exchange_id);
- snprintf(values[3], BUFFER_SIZE, "%s", "r0");
- snprintf(values[4], BUFFER_SIZE, "%.5Lf", p_impl->p);
- snprintf(values[5], BUFFER_SIZE, "%.8Lf", p_impl->v);
- snprintf(values[6], BUFFER_SIZE, "%c", p_impl->s);
-
- HeapTuple tuple = BuildTupleFromCStrings(attinmeta, values);
- pfree(values[0]);
- pfree(values[1]);
- pfree(values[2]);
- pfree(values[3]);
- pfree(values[4]);
- pfree(values[5]);
- pfree(values[6]);
- pfree(values);
- return tuple;
+level2::to_heap_tuple(TupleDesc tupdesc, int32 pair_id, int32 exchange_id) {
+ Datum values[8];
+ bool nulls[8] = {false, false, false, false, false, false, false, true};
+ values[0] = TimestampTzGetDatum(p_impl->m);
+ values[1] = Int16GetDatum(pair_id);
+ values[2] = Int16GetDatum(exchange_id);
+ values[3] = PointerGetDatum(cstring_to_text_with_len("r0", 2));
+ values[4] = numeric_datum(p_impl->p, 5);
+ values[5] = numeric_datum(p_impl->v, 8);
+ values[6] = PointerGetDatum(cstring_to_text_with_len(&p_impl->s, 1));
+ values[7] = static_cast<Datum>(0);
+ return heap_form_tuple(tupdesc, values, nulls);
 };
 
+namespace {
+
+const int MAX_BINARY_SCALE = 18;
+
+#if PG_VERSION_NUM < 140000
+// 10^-scale as a numeric with dscale == scale. Built once per backend in
+// TopMemoryContext, so that the product below has exactly scale digits
+Datum
+negative_power_of_10(int scale) {
+ static Datum powers[MAX_BINARY_SCALE + 1];
+ if (!powers[scale]) {
+  char buffer[MAX_BINARY_SCALE + 3] = "1";
+  if (scale) {
+   snprintf(buffer, sizeof(buffer), "0.%0*d", scale, 1);
+  }
+  MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+  powers[scale] =
+      DirectFunctionCall3(numeric_in, CStringGetDatum(buffer),
+                          ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+  MemoryContextSwitchTo(oldcontext);
+ }
+ return powers[scale];
+}
+#endif
+
+}  // namespace
+
+Datum
+numeric_datum(long double value, int scale) {
+ static const long double kPowersOf10[] = {
+     1e0L, 1e1L, 1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,  1e8L, 1e9L,
+     1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L};
+ if (scale >= 0 && scale <= MAX_BINARY_SCALE) {
+  long double scaled = value * kPowersOf10[scale];
+  if (std::fabs(scaled) < 9.0e18L) {  // fits int64 (and is not NaN)
+#if PG_VERSION_NUM >= 140000
+   return NumericGetDatum(
+       int64_div_fast_to_numeric(std::llroundl(scaled), scale));
+#else
+   Datum unscaled = DirectFunctionCall1(
+       int8_numeric, Int64GetDatum(std::llroundl(scaled)));
+   if (!scale) return unscaled;
+   return DirectFunctionCall2(numeric_mul, unscaled,
+                              negative_power_of_10(scale));
+#endif
+  }
+ }
+ // Values which do not fit int64 once scaled go through text
+ static const int BUFFER_SIZE = 128;
+ char buffer[BUFFER_SIZE];
+ snprintf(buffer, BUFFER_SIZE, "%.*Lf", scale, value);
+ return DirectFunctionCall3(numeric_in, CStringGetDatum(buffer),
+                            ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+}
+
 }  // namespace obad
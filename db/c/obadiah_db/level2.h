@@ -68,8 +68,7 @@ public:
  char get_side() const;
 
  bool operator<(const level2 &) const;
- HeapTuple to_heap_tuple(AttInMetadata *attinmeta, int32 pair_id,
-                         int32 exchange_id);
+ HeapTuple to_heap_tuple(TupleDesc tupdesc, int32 pair_id, int32 exchange_id);
 
 private:
  friend std::ostream &operator<<(std::ostream &, const level2 &);
@@ -79,5 +78,10 @@ private:
 std::ostream &
 operator<<(std::ostream &, const level2 &);
 
+// A numeric Datum with the given number of decimal digits after the point,
+// built without a round trip through text
+Datum
+numeric_datum(long double value, int scale);
+
 }  // namespace obad
 #endif
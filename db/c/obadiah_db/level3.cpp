@@ -27,6 +27,7 @@ extern "C" {
 }
 #endif  // __cplusplus
 
+#include "frequency.h"
 #include "level2.h"
 #include "level3.h"
 #include "spi_allocator.h"
@@ -219,4 +220,15 @@ level3::is_deleted() const {
   ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
                   errmsg("get from an empty level3")));
 };
+
+void
+level3::align_up(int64 frequency) {
+ if (p_impl && frequency) {
+  p_impl->microtimestamp = date_ceiling(p_impl->microtimestamp, frequency);
+  p_impl->next_microtimestamp =
+      date_ceiling(p_impl->next_microtimestamp, frequency);
+  p_impl->price_microtimestamp =
+      date_ceiling(p_impl->price_microtimestamp, frequency);
+ }
+}
 }  // namespace obad
@@ -58,6 +58,9 @@ public:
  amount get_volume() const;
  char get_side() const;
  bool is_deleted() const;
+ // Moves all timestamps to the ends of their periods of the frequency (in
+ // seconds), as get._date_ceiling() does. Zero frequency changes nothing
+ void align_up(int64 frequency);
 
 private:
  friend std::ostream &operator<<(std::ostream &, const level3 &);
@@ -0,0 +1,864 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// C versions of the trigger functions of obanalytics.level3. Each one
+// follows its plpgsql counterpart (see obanalytics_schema.sql) statement by
+// statement; the queries are prepared once per backend and kept.
+//
+// level3_insert_events() is a set-based alternative to the row-by-row
+// chaining done by level3_incorporate_new_event(): it chains a whole batch
+// of events in memory and inserts it with one statement.
+
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "postgres.h"
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_type_d.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/numeric.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+PG_FUNCTION_INFO_V1(level3_incorporate_new_event);
+PG_FUNCTION_INFO_V1(level3_update_level3_eras);
+PG_FUNCTION_INFO_V1(check_microtimestamp_change);
+PG_FUNCTION_INFO_V1(propagate_microtimestamp_change);
+PG_FUNCTION_INFO_V1(save_exchange_microtimestamp);
+PG_FUNCTION_INFO_V1(level3_insert_events);
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <utility>
+#include "spi_allocator.h"
+#include "spi_plan.h"
+
+namespace obad {
+namespace {
+
+TriggerData *
+get_trigger_data(FunctionCallInfo fcinfo, const char *function) {
+ if (!CALLED_AS_TRIGGER(fcinfo))
+  ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                  errmsg("%s: not called by trigger manager", function)));
+ return reinterpret_cast<TriggerData *>(fcinfo->context);
+}
+
+// A column of the tuple which fired the trigger
+struct column {
+ column(HeapTuple tuple, TupleDesc tupdesc, const char *name)
+     : attnum{SPI_fnumber(tupdesc, name)} {
+  if (attnum <= 0)
+   ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+                   errmsg("column \"%s\" does not exist", name)));
+  value = SPI_getbinval(tuple, tupdesc, attnum, &is_null);
+ };
+ int attnum;
+ Datum value;
+ bool is_null;
+};
+
+// Formats a value as plpgsql's RAISE does, i.e. NULL as <NULL>
+const char *
+raise_str(const column &c, Oid type) {
+ if (c.is_null) return "<NULL>";
+ switch (type) {
+  case TIMESTAMPTZOID:
+   return timestamptz_to_str(DatumGetTimestampTz(c.value));
+  case INT8OID:
+   return psprintf(INT64_FORMAT, DatumGetInt64(c.value));
+  case INT4OID:
+   return psprintf("%d", DatumGetInt32(c.value));
+  default:
+   return psprintf("%d", static_cast<int>(DatumGetInt16(c.value)));
+ }
+}
+
+// numeric = numeric and numeric > numeric where NULL is never equal/greater
+bool
+numeric_equal(Datum a, bool a_null, Datum b, bool b_null) {
+ return !a_null && !b_null &&
+        DatumGetInt32(DirectFunctionCall2(numeric_cmp, a, b)) == 0;
+}
+
+int32
+numeric_sign_of(Datum a) {
+ Datum zero = DirectFunctionCall1(int4_numeric, Int32GetDatum(0));
+ return DatumGetInt32(DirectFunctionCall2(numeric_cmp, a, zero));
+}
+
+// parameters.max_microtimestamp_change(pair_id, exchange_id) is looked up
+// once per transaction
+using max_change_key = std::pair<int32, int32>;
+std::map<max_change_key, std::pair<bool, int32>> max_change_cache;
+bool is_xact_callback_registered = false;
+
+void
+clear_caches(XactEvent event, void *) {
+ max_change_cache.clear();
+}
+
+void
+register_xact_callback() {
+ if (!is_xact_callback_registered) {
+  RegisterXactCallback(clear_caches, nullptr);
+  is_xact_callback_registered = true;
+ }
+}
+
+}  // namespace
+}  // namespace obad
+
+// BEFORE INSERT FOR EACH ROW on level3 leaf partitions. Chains the new event
+// to the previous event of the order, if any, in one prepared UPDATE
+Datum
+level3_incorporate_new_event(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ TriggerData *trigdata = get_trigger_data(fcinfo, __func__);
+ HeapTuple tuple = trigdata->tg_trigtuple;
+ TupleDesc tupdesc = RelationGetDescr(trigdata->tg_relation);
+
+ column price_microtimestamp{tuple, tupdesc, "price_microtimestamp"};
+ column event_no{tuple, tupdesc, "event_no"};
+ if (!(price_microtimestamp.is_null || event_no.is_null))
+  return PointerGetDatum(tuple);
+
+ column microtimestamp{tuple, tupdesc, "microtimestamp"};
+ column order_id{tuple, tupdesc, "order_id"};
+ column side{tuple, tupdesc, "side"};
+ column price{tuple, tupdesc, "price"};
+ column amount{tuple, tupdesc, "amount"};
+ column fill{tuple, tupdesc, "fill"};
+ column pair_id{tuple, tupdesc, "pair_id"};
+ column exchange_id{tuple, tupdesc, "exchange_id"};
+ column price_event_no{tuple, tupdesc, "price_event_no"};
+
+ elog(DEBUG1, "Will process  %s, %s", raise_str(microtimestamp, TIMESTAMPTZOID),
+      raise_str(order_id, INT8OID));
+
+ static SPIPlanPtr plan = nullptr;
+ static const char *const query = R"QUERY(
+  update obanalytics.level3
+     set next_microtimestamp = $1,
+         next_event_no = event_no + 1
+   where exchange_id = $2
+     and pair_id = $3
+     and microtimestamp between (select max(era)
+                                 from obanalytics.level3_eras
+                                 where pair_id = $3
+                                   and exchange_id = $2
+                                   and era <= $1) and $1
+     and order_id = $4
+     and side = $5
+     and next_microtimestamp > $1
+  returning price, amount, next_event_no, price_microtimestamp, price_event_no)QUERY";
+
+ MemoryContext upper = CurrentMemoryContext;
+ SPI_connect();
+ Oid types[5] = {TIMESTAMPTZOID, INT2OID, INT2OID, INT8OID, BPCHAROID};
+ Datum values[5] = {microtimestamp.value, exchange_id.value, pair_id.value,
+                    order_id.value, side.value};
+ char nulls[5];
+ const column *args[5] = {&microtimestamp, &exchange_id, &pair_id, &order_id,
+                          &side};
+ for (int i = 0; i < 5; ++i) nulls[i] = args[i]->is_null ? 'n' : ' ';
+ SPI_execute_plan(kept_plan(plan, query, 5, types), values, nulls, false, 0);
+
+ if (SPI_processed > 1)
+  ereport(ERROR, (errcode(ERRCODE_RAISE_EXCEPTION),
+                  errmsg("too many rows for %s, %s, %s",
+                         raise_str(microtimestamp, TIMESTAMPTZOID),
+                         raise_str(order_id, INT8OID),
+                         raise_str(event_no, INT4OID))));
+
+ // The columns to be replaced in the new tuple
+ int attnums[6];
+ Datum replacements[6];
+ bool replacement_nulls[6];
+ int n = 0;
+ auto replace = [&](const column &c, Datum value, bool is_null) {
+  attnums[n] = c.attnum;
+  replacements[n] = value;
+  replacement_nulls[n] = is_null;
+  ++n;
+ };
+
+ if (SPI_processed == 1) {
+  HeapTuple previous = SPI_tuptable->vals[0];
+  TupleDesc previous_desc = SPI_tuptable->tupdesc;
+  bool previous_price_null, previous_amount_null, next_event_no_null,
+      previous_price_microtimestamp_null, previous_price_event_no_null;
+  Datum previous_price =
+      SPI_getbinval(previous, previous_desc, 1, &previous_price_null);
+  Datum previous_amount =
+      SPI_getbinval(previous, previous_desc, 2, &previous_amount_null);
+  Datum next_event_no =
+      SPI_getbinval(previous, previous_desc, 3, &next_event_no_null);
+  Datum previous_price_microtimestamp = SPI_getbinval(
+      previous, previous_desc, 4, &previous_price_microtimestamp_null);
+  Datum previous_price_event_no =
+      SPI_getbinval(previous, previous_desc, 5, &previous_price_event_no_null);
+
+  Datum new_price = price.value;
+  bool new_price_null = price.is_null;
+  if (!price.is_null && numeric_sign_of(price.value) == 0) {
+   new_price = previous_price;
+   new_price_null = previous_price_null;
+   replace(price, previous_price, previous_price_null);
+   replace(amount, previous_amount, previous_amount_null);
+   replace(fill, 0, true);
+  } else {
+   if (previous_amount_null || amount.is_null)
+    replace(fill, 0, true);
+   else
+    replace(fill,
+            DirectFunctionCall2(numeric_sub, previous_amount, amount.value),
+            false);
+  }
+
+  replace(event_no, next_event_no, next_event_no_null);
+
+  if (numeric_equal(previous_price, previous_price_null, new_price,
+                    new_price_null)) {
+   replace(price_microtimestamp, previous_price_microtimestamp,
+           previous_price_microtimestamp_null);
+   replace(price_event_no, previous_price_event_no,
+           previous_price_event_no_null);
+  } else {
+   replace(price_microtimestamp, microtimestamp.value, microtimestamp.is_null);
+   replace(price_event_no, next_event_no, next_event_no_null);
+  }
+ } else {
+  // It is the first event for order_id (or the first after the latest
+  // deletion). fill remains NULL
+  if (!price.is_null && numeric_sign_of(price.value) > 0) {
+   replace(price_microtimestamp, microtimestamp.value, microtimestamp.is_null);
+   replace(price_event_no, Int32GetDatum(1), false);
+   replace(event_no, Int32GetDatum(1), false);
+  } else {
+   column local_timestamp{tuple, tupdesc, "local_timestamp"};
+   ereport(NOTICE, (errmsg("Skipped insertion of %s, %s, %s, %s",
+                           raise_str(microtimestamp, TIMESTAMPTZOID),
+                           raise_str(order_id, INT8OID),
+                           raise_str(event_no, INT4OID),
+                           raise_str(local_timestamp, TIMESTAMPTZOID))));
+   SPI_finish();
+   return PointerGetDatum(NULL);  // skip insertion
+  }
+ }
+ // The new tuple must outlive SPI_finish(), so it is built in the caller's
+ // memory context. The datums taken from SPI_tuptable are copied into it
+ MemoryContext spi = MemoryContextSwitchTo(upper);
+ HeapTuple result = heap_modify_tuple_by_cols(tuple, tupdesc, n, attnums,
+                                              replacements, replacement_nulls);
+ MemoryContextSwitchTo(spi);
+ SPI_finish();
+ return PointerGetDatum(result);
+}
+
+// AFTER INSERT FOR EACH STATEMENT on level3 with the transition table
+// 'inserted'. The query refers to the transition table, so it is planned
+// once per statement rather than kept
+Datum
+level3_update_level3_eras(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ TriggerData *trigdata = get_trigger_data(fcinfo, __func__);
+ SPI_connect();
+ SPI_register_trigger_data(trigdata);
+ SPI_execute(R"QUERY(
+	with latest_events as (
+		select exchange_id, pair_id, max(microtimestamp) as latest
+		from inserted
+		group by exchange_id, pair_id
+	),
+	eras as (
+		select exchange_id, pair_id, latest, max(era) as era
+		from obanalytics.level3_eras join latest_events using (exchange_id, pair_id)
+		where era <= latest
+		group by exchange_id, pair_id, latest
+	)
+	update obanalytics.level3_eras
+	   set level3 = latest
+	from eras
+	where level3_eras.era = eras.era
+	  and level3_eras.exchange_id = eras.exchange_id
+	  and level3_eras.pair_id = eras.pair_id
+	  and (level3 is null or level3 < latest))QUERY",
+             false, 0);
+ SPI_finish();
+ return PointerGetDatum(NULL);
+}
+
+// AFTER UPDATE OF microtimestamp FOR EACH ROW (deferred constraint trigger)
+Datum
+check_microtimestamp_change(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ TriggerData *trigdata = get_trigger_data(fcinfo, __func__);
+ TupleDesc tupdesc = RelationGetDescr(trigdata->tg_relation);
+ HeapTuple old_tuple = trigdata->tg_trigtuple;
+ HeapTuple new_tuple = trigdata->tg_newtuple;
+
+ column old_microtimestamp{old_tuple, tupdesc, "microtimestamp"};
+ column new_microtimestamp{new_tuple, tupdesc, "microtimestamp"};
+ column pair_id{old_tuple, tupdesc, "pair_id"};
+ column exchange_id{old_tuple, tupdesc, "exchange_id"};
+
+ if (old_microtimestamp.is_null || new_microtimestamp.is_null)
+  return PointerGetDatum(NULL);
+
+ register_xact_callback();
+ max_change_key key{DatumGetInt16(pair_id.value),
+                    DatumGetInt16(exchange_id.value)};
+ auto cached = max_change_cache.find(key);
+ if (cached == max_change_cache.end()) {
+  static SPIPlanPtr plan = nullptr;
+  Oid types[2] = {INT4OID, INT4OID};
+  Datum values[2] = {Int32GetDatum(key.first), Int32GetDatum(key.second)};
+  char nulls[2] = {pair_id.is_null ? 'n' : ' ', exchange_id.is_null ? 'n' : ' '};
+  SPI_connect();
+  SPI_execute_plan(kept_plan(plan,
+                             "select parameters.max_microtimestamp_change($1, "
+                             "$2)",
+                             2, types),
+                   values, nulls, true, 1);
+  bool is_null = true;
+  int32 max_change = 0;
+  if (SPI_processed == 1)
+   max_change = DatumGetInt32(
+       SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &is_null));
+  SPI_finish();
+  cached = max_change_cache.emplace(key, std::make_pair(is_null, max_change))
+               .first;
+ }
+
+ TimestampTz o = DatumGetTimestampTz(old_microtimestamp.value);
+ TimestampTz n = DatumGetTimestampTz(new_microtimestamp.value);
+ // A NULL max_microtimestamp_change() makes the first condition NULL
+ if ((!cached->second.first && n > o + cached->second.second * USECS_PER_SEC) ||
+     n < o) {
+  column order_id{old_tuple, tupdesc, "order_id"};
+  column event_no{old_tuple, tupdesc, "event_no"};
+  ereport(ERROR, (errcode(ERRCODE_RAISE_EXCEPTION),
+                  errmsg("An attempt to move %s %s %s %s %s to %s is blocked",
+                         raise_str(old_microtimestamp, TIMESTAMPTZOID),
+                         raise_str(order_id, INT8OID),
+                         raise_str(event_no, INT4OID),
+                         raise_str(pair_id, INT2OID),
+                         raise_str(exchange_id, INT2OID),
+                         raise_str(new_microtimestamp, TIMESTAMPTZOID))));
+ }
+ return PointerGetDatum(NULL);
+}
+
+// AFTER UPDATE OF microtimestamp FOR EACH ROW WHEN (old.exchange_id = 2)
+Datum
+propagate_microtimestamp_change(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ TriggerData *trigdata = get_trigger_data(fcinfo, __func__);
+ TupleDesc tupdesc = RelationGetDescr(trigdata->tg_relation);
+ HeapTuple old_tuple = trigdata->tg_trigtuple;
+ HeapTuple new_tuple = trigdata->tg_newtuple;
+
+ column new_microtimestamp{new_tuple, tupdesc, "microtimestamp"};
+ column new_side{new_tuple, tupdesc, "side"};
+ column old_microtimestamp{old_tuple, tupdesc, "microtimestamp"};
+ column old_order_id{old_tuple, tupdesc, "order_id"};
+ column old_event_no{old_tuple, tupdesc, "event_no"};
+
+ static SPIPlanPtr plan = nullptr;
+ static const char *const query = R"QUERY(
+	update bitstamp.live_orders
+	set microtimestamp = $1
+	where order_type = case $2 when 's' then 'sell'::bitstamp.direction
+								when 'b' then 'buy'::bitstamp.direction
+				  end
+	  and microtimestamp = $3
+	  and order_id = $4
+	  and event_no = $5)QUERY";
+ Oid types[5] = {TIMESTAMPTZOID, BPCHAROID, TIMESTAMPTZOID, INT8OID, INT4OID};
+ const column *args[5] = {&new_microtimestamp, &new_side, &old_microtimestamp,
+                          &old_order_id, &old_event_no};
+ Datum values[5];
+ char nulls[5];
+ for (int i = 0; i < 5; ++i) {
+  values[i] = args[i]->value;
+  nulls[i] = args[i]->is_null ? 'n' : ' ';
+ }
+ SPI_connect();
+ SPI_execute_plan(kept_plan(plan, query, 5, types), values, nulls, false, 0);
+ SPI_finish();
+ return PointerGetDatum(NULL);
+}
+
+// BEFORE UPDATE OF microtimestamp FOR EACH ROW. It is assumed that the
+// first-ever value of microtimestamp is set by an exchange. If it is changed
+// for the first time, then it is saved to exchange_microtimestamp
+Datum
+save_exchange_microtimestamp(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ TriggerData *trigdata = get_trigger_data(fcinfo, __func__);
+ TupleDesc tupdesc = RelationGetDescr(trigdata->tg_relation);
+ HeapTuple old_tuple = trigdata->tg_trigtuple;
+ HeapTuple new_tuple = trigdata->tg_newtuple;
+
+ column old_exchange_microtimestamp{old_tuple, tupdesc,
+                                    "exchange_microtimestamp"};
+ if (old_exchange_microtimestamp.is_null) {
+  column old_microtimestamp{old_tuple, tupdesc, "microtimestamp"};
+  column new_microtimestamp{new_tuple, tupdesc, "microtimestamp"};
+  bool is_distinct =
+      old_microtimestamp.is_null != new_microtimestamp.is_null ||
+      (!old_microtimestamp.is_null &&
+       DatumGetTimestampTz(old_microtimestamp.value) !=
+           DatumGetTimestampTz(new_microtimestamp.value));
+  if (is_distinct) {
+   int attnum = old_exchange_microtimestamp.attnum;
+   return PointerGetDatum(heap_modify_tuple_by_cols(
+       new_tuple, tupdesc, 1, &attnum, &old_microtimestamp.value,
+       &old_microtimestamp.is_null));
+  }
+ }
+ return PointerGetDatum(new_tuple);
+}
+
+namespace obad {
+namespace {
+
+// An event of the batch, in the order of insertion (microtimestamp, then the
+// position in the input arrays)
+struct batch_event {
+ TimestampTz microtimestamp;
+ int64 order_id;
+ Datum side;  // character(1)
+ Datum price;
+ Datum amount;
+ Datum fill;
+ bool fill_null = true;
+ bool local_timestamp_null;
+ TimestampTz local_timestamp;
+ int32 event_no = 0;
+ TimestampTz next_microtimestamp;
+ int32 next_event_no = 0;  // 0 is NULL
+ TimestampTz price_microtimestamp;
+ int32 price_event_no;
+ bool price_event_no_null = false;
+ bool is_skipped = false;
+};
+
+// The latest event of an order's chain: either an event of the batch or a
+// row of level3 inserted before
+struct chain_end {
+ TimestampTz microtimestamp;
+ int32 event_no;
+ Datum price;
+ Datum amount;
+ TimestampTz price_microtimestamp;
+ int32 price_event_no;
+ bool price_event_no_null;
+ bool is_open;
+ int event = -1;  // in the batch or -1 if in level3
+};
+
+struct chain_key {
+ int64 order_id;
+ char side;
+ bool operator==(const chain_key &other) const {
+  return order_id == other.order_id && side == other.side;
+ }
+};
+
+struct chain_key_hash {
+ std::size_t operator()(const chain_key &key) const {
+  return std::hash<int64>()(key.order_id) * 31 + key.side;
+ }
+};
+
+char
+side_of(Datum side) {
+ text *t = DatumGetTextPP(side);
+ return VARSIZE_ANY_EXHDR(t) ? *VARDATA_ANY(t) : ' ';
+}
+
+// Elements of a one-dimensional array argument
+struct array_arg {
+ array_arg(FunctionCallInfo fcinfo, int arg, Oid type, const char *name) {
+  if (PG_ARGISNULL(arg))
+   ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                   errmsg("%s must not be NULL", name)));
+  int16 typlen;
+  bool typbyval;
+  char typalign;
+  get_typlenbyvalalign(type, &typlen, &typbyval, &typalign);
+  deconstruct_array(PG_GETARG_ARRAYTYPE_P(arg), type, typlen, typbyval,
+                    typalign, &values, &nulls, &n);
+ }
+ Datum *values;
+ bool *nulls;
+ int n;
+};
+
+}  // namespace
+}  // namespace obad
+
+// Inserts a batch of events of one pair into obanalytics.level3. The events
+// are raw, i.e. as they would be inserted for level3_incorporate_new_event():
+// price = 0 deletes the order. The chains are linked in memory: only the
+// first event of each order in the batch is looked up in level3, the
+// predecessors found there are updated with one statement and the batch is
+// inserted with another one. Returns the number of inserted events
+Datum
+level3_insert_events(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ // obanalytics.level3_insert_events(p_exchange_id, p_pair_id,
+ // p_microtimestamp, p_order_id, p_side, p_price, p_amount,
+ // p_local_timestamp)
+ int16 exchange_id = static_cast<int16>(PG_GETARG_INT32(0));
+ int16 pair_id = static_cast<int16>(PG_GETARG_INT32(1));
+
+ SPI_connect();
+ // The arguments are deconstructed in SPI's context, so everything below is
+ // freed by SPI_finish()
+ array_arg microtimestamps{fcinfo, 2, TIMESTAMPTZOID, "p_microtimestamp"};
+ array_arg order_ids{fcinfo, 3, INT8OID, "p_order_id"};
+ array_arg sides{fcinfo, 4, BPCHAROID, "p_side"};
+ array_arg prices{fcinfo, 5, NUMERICOID, "p_price"};
+ array_arg amounts{fcinfo, 6, NUMERICOID, "p_amount"};
+ array_arg local_timestamps{fcinfo, 7, TIMESTAMPTZOID, "p_local_timestamp"};
+ int n = microtimestamps.n;
+ for (const array_arg *a :
+      {&order_ids, &sides, &prices, &amounts, &local_timestamps})
+  if (a->n != n)
+   ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                   errmsg("all arrays must be of the same length")));
+ for (int i = 0; i < n; ++i)
+  for (const array_arg *a :
+       {&microtimestamps, &order_ids, &sides, &prices, &amounts})
+   if (a->nulls[i])
+    ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                    errmsg("only p_local_timestamp may contain NULLs")));
+
+ Datum zero = DirectFunctionCall1(int4_numeric, Int32GetDatum(0));
+ auto compare = [](Datum a, Datum b) {
+  return DatumGetInt32(DirectFunctionCall2(numeric_cmp, a, b));
+ };
+
+ obad::vector<batch_event> events;
+ events.reserve(n);
+ for (int i = 0; i < n; ++i) {
+  batch_event e;
+  e.microtimestamp = DatumGetTimestampTz(microtimestamps.values[i]);
+  e.order_id = DatumGetInt64(order_ids.values[i]);
+  e.side = sides.values[i];
+  e.price = prices.values[i];
+  e.amount = amounts.values[i];
+  e.local_timestamp_null = local_timestamps.nulls[i];
+  e.local_timestamp = DatumGetTimestampTz(local_timestamps.values[i]);
+  e.next_microtimestamp = compare(e.price, zero) == 0 ? DT_NOBEGIN : DT_NOEND;
+  events.push_back(e);
+ }
+ std::stable_sort(events.begin(), events.end(),
+                  [](const batch_event &a, const batch_event &b) {
+                   return a.microtimestamp < b.microtimestamp;
+                  });
+ if (!n) {
+  SPI_finish();
+  PG_RETURN_INT32(0);
+ }
+
+ // The eras which the batch may belong to, see level3_eras
+ obad::vector<TimestampTz> eras;
+ {
+  static SPIPlanPtr plan = nullptr;
+  static const char *const query = R"QUERY(
+	select era
+	from obanalytics.level3_eras
+	where exchange_id = $1
+	  and pair_id = $2
+	  and era between coalesce((select max(era)
+								from obanalytics.level3_eras
+								where exchange_id = $1
+								  and pair_id = $2
+								  and era <= $3), '-infinity') and $4
+	order by era)QUERY";
+  Oid types[4] = {INT2OID, INT2OID, TIMESTAMPTZOID, TIMESTAMPTZOID};
+  Datum values[4] = {Int16GetDatum(exchange_id), Int16GetDatum(pair_id),
+                     TimestampTzGetDatum(events.front().microtimestamp),
+                     TimestampTzGetDatum(events.back().microtimestamp)};
+  SPI_execute_plan(kept_plan(plan, query, 4, types), values, nullptr, true,
+                   0);
+  for (uint64 i = 0; i < SPI_processed; ++i) {
+   bool is_null;
+   eras.push_back(DatumGetTimestampTz(
+       SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &is_null)));
+  }
+ }
+ // The latest era which is not after t. Returns false if there is none
+ auto era_of = [&eras](TimestampTz t, TimestampTz &era) {
+  auto next = std::upper_bound(eras.begin(), eras.end(), t);
+  if (next == eras.begin()) return false;
+  era = *(next - 1);
+  return true;
+ };
+
+ // The first event of each order in the batch may continue a chain in level3
+ obad::unordered_map<chain_key, chain_end, chain_key_hash> chains;
+ {
+  obad::vector<Datum> o, s, t, e;
+  obad::vector<int> first;
+  for (int i = 0; i < n; ++i) {
+   TimestampTz era;
+   chain_key key{events[i].order_id, side_of(events[i].side)};
+   if (chains.emplace(key, chain_end{}).second &&
+       era_of(events[i].microtimestamp, era)) {
+    o.push_back(Int64GetDatum(events[i].order_id));
+    s.push_back(events[i].side);
+    t.push_back(TimestampTzGetDatum(events[i].microtimestamp));
+    e.push_back(TimestampTzGetDatum(era));
+    first.push_back(i);
+   }
+  }
+  chains.clear();
+  if (!first.empty()) {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	select f.i, l.microtimestamp, l.event_no, l.price, l.amount,
+		   l.price_microtimestamp, l.price_event_no
+	from unnest($3::bigint[], $4::character[], $5::timestamptz[],
+				$6::timestamptz[]) with ordinality f(order_id, side, microtimestamp, era, i)
+		 join obanalytics.level3 l on l.order_id = f.order_id
+								  and l.side = f.side
+								  and l.microtimestamp between f.era and f.microtimestamp
+	where l.exchange_id = $1
+	  and l.pair_id = $2
+	  and l.next_microtimestamp > f.microtimestamp)QUERY";
+   Oid types[6] = {INT2OID,
+                   INT2OID,
+                   get_array_type(INT8OID),
+                   get_array_type(BPCHAROID),
+                   get_array_type(TIMESTAMPTZOID),
+                   get_array_type(TIMESTAMPTZOID)};
+   int m = first.size();
+   Datum values[6] = {Int16GetDatum(exchange_id), Int16GetDatum(pair_id),
+                      make_array(o.data(), nullptr, m, INT8OID),
+                      make_array(s.data(), nullptr, m, BPCHAROID),
+                      make_array(t.data(), nullptr, m, TIMESTAMPTZOID),
+                      make_array(e.data(), nullptr, m, TIMESTAMPTZOID)};
+   SPI_execute_plan(kept_plan(plan, query, 6, types), values, nullptr, true,
+                    0);
+   for (uint64 j = 0; j < SPI_processed; ++j) {
+    HeapTuple tuple = SPI_tuptable->vals[j];
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    bool is_null;
+    int i = first[DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &is_null)) - 1];
+    chain_end end;
+    end.microtimestamp =
+        DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 2, &is_null));
+    end.event_no = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &is_null));
+    end.price = SPI_getbinval(tuple, tupdesc, 4, &is_null);
+    end.amount = SPI_getbinval(tuple, tupdesc, 5, &is_null);
+    end.price_microtimestamp =
+        DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 6, &is_null));
+    end.price_event_no =
+        DatumGetInt32(SPI_getbinval(tuple, tupdesc, 7, &end.price_event_no_null));
+    end.is_open = true;
+    if (!chains.emplace(chain_key{events[i].order_id, side_of(events[i].side)},
+                        end)
+             .second)
+     ereport(ERROR,
+             (errcode(ERRCODE_TOO_MANY_ROWS),
+              errmsg("too many rows for %s, " INT64_FORMAT,
+                     timestamptz_to_str(events[i].microtimestamp),
+                     events[i].order_id)));
+   }
+  }
+ }
+
+ // Links the chains as level3_incorporate_new_event() would do event by
+ // event. The predecessors found in level3 are collected for the update
+ obad::vector<Datum> u_order_id, u_side, u_microtimestamp, u_event_no,
+     u_next_microtimestamp;
+ int inserted = 0;
+ for (int i = 0; i < n; ++i) {
+  batch_event &event = events[i];
+  auto found =
+      chains.find(chain_key{event.order_id, side_of(event.side)});
+  TimestampTz era;
+  bool is_continued = found != chains.end() && found->second.is_open &&
+                      era_of(event.microtimestamp, era) &&
+                      found->second.microtimestamp >= era;
+  if (is_continued) {
+   chain_end &previous = found->second;
+   if (compare(event.price, zero) == 0) {
+    event.price = previous.price;
+    event.amount = previous.amount;
+   } else {
+    event.fill = DirectFunctionCall2(numeric_sub, previous.amount, event.amount);
+    event.fill_null = false;
+   }
+   event.event_no = previous.event_no + 1;
+   if (compare(previous.price, event.price) == 0) {
+    event.price_microtimestamp = previous.price_microtimestamp;
+    event.price_event_no = previous.price_event_no;
+    event.price_event_no_null = previous.price_event_no_null;
+   } else {
+    event.price_microtimestamp = event.microtimestamp;
+    event.price_event_no = event.event_no;
+   }
+   if (previous.event >= 0) {
+    events[previous.event].next_microtimestamp = event.microtimestamp;
+    events[previous.event].next_event_no = event.event_no;
+   } else {
+    u_order_id.push_back(Int64GetDatum(event.order_id));
+    u_side.push_back(event.side);
+    u_microtimestamp.push_back(TimestampTzGetDatum(previous.microtimestamp));
+    u_event_no.push_back(Int32GetDatum(previous.event_no));
+    u_next_microtimestamp.push_back(TimestampTzGetDatum(event.microtimestamp));
+   }
+  } else if (compare(event.price, zero) > 0) {
+   event.price_microtimestamp = event.microtimestamp;
+   event.price_event_no = 1;
+   event.event_no = 1;
+  } else {
+   elog(DEBUG1, "Skipped insertion of %s, " INT64_FORMAT,
+        timestamptz_to_str(event.microtimestamp), event.order_id);
+   event.is_skipped = true;
+   continue;
+  }
+  chain_end end;
+  end.microtimestamp = event.microtimestamp;
+  end.event_no = event.event_no;
+  end.price = event.price;
+  end.amount = event.amount;
+  end.price_microtimestamp = event.price_microtimestamp;
+  end.price_event_no = event.price_event_no;
+  end.price_event_no_null = event.price_event_no_null;
+  end.is_open = event.next_microtimestamp == DT_NOEND;
+  end.event = i;
+  chains[chain_key{event.order_id, side_of(event.side)}] = end;
+  ++inserted;
+ }
+ if (inserted < n)
+  ereport(NOTICE, (errmsg("Skipped insertion of %d event(s) without a "
+                          "preceding event",
+                          n - inserted)));
+
+ if (!u_order_id.empty()) {
+  static SPIPlanPtr plan = nullptr;
+  static const char *const query = R"QUERY(
+	update obanalytics.level3
+	   set next_microtimestamp = u.next_microtimestamp,
+		   next_event_no = level3.event_no + 1
+	from unnest($3::bigint[], $4::character[], $5::timestamptz[], $6::integer[],
+				$7::timestamptz[]) u(order_id, side, microtimestamp, event_no, next_microtimestamp)
+	where level3.exchange_id = $1
+	  and level3.pair_id = $2
+	  and level3.microtimestamp = u.microtimestamp
+	  and level3.order_id = u.order_id
+	  and level3.side = u.side
+	  and level3.event_no = u.event_no)QUERY";
+  Oid types[7] = {INT2OID,
+                  INT2OID,
+                  get_array_type(INT8OID),
+                  get_array_type(BPCHAROID),
+                  get_array_type(TIMESTAMPTZOID),
+                  get_array_type(INT4OID),
+                  get_array_type(TIMESTAMPTZOID)};
+  int m = u_order_id.size();
+  Datum values[7] = {
+      Int16GetDatum(exchange_id),
+      Int16GetDatum(pair_id),
+      make_array(u_order_id.data(), nullptr, m, INT8OID),
+      make_array(u_side.data(), nullptr, m, BPCHAROID),
+      make_array(u_microtimestamp.data(), nullptr, m, TIMESTAMPTZOID),
+      make_array(u_event_no.data(), nullptr, m, INT4OID),
+      make_array(u_next_microtimestamp.data(), nullptr, m, TIMESTAMPTZOID)};
+  SPI_execute_plan(kept_plan(plan, query, 7, types), values, nullptr, false,
+                   0);
+ }
+
+ if (inserted) {
+  static const int columns = 12;
+  obad::vector<Datum> values[columns];
+  obad::vector<char> nulls[columns];  // std::vector<bool> can't give bool*
+  for (int c = 0; c < columns; ++c) {
+   values[c].reserve(inserted);
+   nulls[c].reserve(inserted);
+  }
+  auto add = [&](int c, Datum value, bool is_null) {
+   values[c].push_back(value);
+   nulls[c].push_back(is_null);
+  };
+  for (const batch_event &event : events) {
+   if (event.is_skipped) continue;
+   add(0, TimestampTzGetDatum(event.microtimestamp), false);
+   add(1, Int64GetDatum(event.order_id), false);
+   add(2, Int32GetDatum(event.event_no), false);
+   add(3, event.side, false);
+   add(4, event.price, false);
+   add(5, event.amount, false);
+   add(6, event.fill, event.fill_null);
+   add(7, TimestampTzGetDatum(event.next_microtimestamp), false);
+   add(8, Int32GetDatum(event.next_event_no), event.next_event_no == 0);
+   add(9, TimestampTzGetDatum(event.local_timestamp),
+       event.local_timestamp_null);
+   add(10, TimestampTzGetDatum(event.price_microtimestamp), false);
+   add(11, Int32GetDatum(event.price_event_no), event.price_event_no_null);
+  }
+  static const Oid element_types[columns] = {
+      TIMESTAMPTZOID, INT8OID,        INT4OID,        BPCHAROID,
+      NUMERICOID,     NUMERICOID,     NUMERICOID,     TIMESTAMPTZOID,
+      INT4OID,        TIMESTAMPTZOID, TIMESTAMPTZOID, INT4OID};
+  Oid types[columns + 2] = {INT2OID, INT2OID};
+  Datum arrays[columns + 2] = {Int16GetDatum(exchange_id),
+                               Int16GetDatum(pair_id)};
+  for (int c = 0; c < columns; ++c) {
+   types[c + 2] = get_array_type(element_types[c]);
+   arrays[c + 2] = make_array(values[c].data(),
+                              reinterpret_cast<bool *>(nulls[c].data()),
+                              inserted, element_types[c]);
+  }
+  static SPIPlanPtr plan = nullptr;
+  // event_no and price_microtimestamp are set, so the BEFORE INSERT trigger
+  // level3_incorporate_new_event() passes the rows through
+  static const char *const query = R"QUERY(
+	insert into obanalytics.level3 (exchange_id, pair_id, microtimestamp, order_id, event_no, side, price, amount, fill,
+									next_microtimestamp, next_event_no, local_timestamp, price_microtimestamp, price_event_no)
+	select $1, $2, *
+	from unnest($3::timestamptz[], $4::bigint[], $5::integer[], $6::character[], $7::numeric[], $8::numeric[],
+				$9::numeric[], $10::timestamptz[], $11::integer[], $12::timestamptz[], $13::timestamptz[], $14::integer[]))QUERY";
+  SPI_execute_plan(kept_plan(plan, query, columns + 2, types), arrays, nullptr,
+                   false, 0);
+ }
+ SPI_finish();
+ PG_RETURN_INT32(inserted);
+}
@@ -0,0 +1,144 @@
+-- Compares the insert rate into obanalytics.level3 with the plpgsql trigger
+-- functions, with their C versions (*_fast(), see level3_triggers.cpp) and
+-- with obanalytics.level3_insert_events().
+--
+-- Usage: psql -d <database> -f level3_triggers_benchmark.sql \
+--             [-v exchange=bitfinex] [-v pair=BTCUSD] [-v n=100000]
+--
+-- n orders with four events each (creation, partial fill, price change,
+-- deletion) are inserted into January 2100 partitions, first with the
+-- plpgsql triggers, then with the C ones, then as one batch. The resulting
+-- event chains are compared. Everything is rolled back at the end.
+
+\if :{?exchange}
+\else
+\set exchange bitfinex
+\endif
+\if :{?pair}
+\else
+\set pair BTCUSD
+\endif
+\if :{?n}
+\else
+\set n 100000
+\endif
+
+\set ON_ERROR_STOP on
+
+begin;
+
+select set_config('obadiah.benchmark_exchange', :'exchange', true);
+
+select obanalytics._create_level3_partition(:'exchange', side, :'pair', 2100, 1)
+from unnest(array['b', 's']) side;
+
+create temporary table benchmark_params on commit drop as
+select exchange_id, pair_id
+from obanalytics.exchanges, obanalytics.pairs
+where exchange = lower(:'exchange') and pair = upper(:'pair');
+
+insert into obanalytics.level3_eras (era, pair_id, exchange_id)
+select '2100-01-01 00:00:00+00'::timestamptz, pair_id, exchange_id
+from benchmark_params;
+
+-- Events of the orders first_order .. first_order + n - 1, starting from
+-- start_time. Events of different orders interleave as they do in a feed
+create temporary table benchmark_events on commit drop as
+with orders as (
+	select o, event_no
+	from generate_series(1, :n) o, generate_series(1, 4) event_no
+)
+select (o + (event_no - 1) * :n) * interval '1 microsecond' as offset_time,
+	   o::bigint as order_id,
+	   case when o % 2 = 0 then 's' else 'b' end::character(1) as side,
+	   case event_no when 4 then 0 when 3 then 101 + o % 50 else 100 + o % 50 end::numeric as price,
+	   case event_no when 1 then 1 when 4 then 0 else 0.5 end::numeric as amount,
+	   case event_no when 4 then '-infinity'::timestamptz else 'infinity'::timestamptz end as next_microtimestamp
+from orders;
+
+\timing on
+
+-- plpgsql triggers
+insert into obanalytics.level3 (microtimestamp, order_id, side, price, amount, next_microtimestamp, pair_id, exchange_id, local_timestamp)
+select '2100-01-01 00:00:01+00'::timestamptz + offset_time, order_id, side, price, amount, next_microtimestamp, pair_id, exchange_id, clock_timestamp()
+from benchmark_events, benchmark_params
+order by offset_time;
+
+\timing off
+
+do $$
+declare
+	v_trigger record;
+begin
+	for v_trigger in select tgrelid::regclass as table_name, tgname, pg_get_triggerdef(pg_trigger.oid) as definition, proname
+					 from pg_trigger join pg_proc on pg_proc.oid = tgfoid
+					 where proname in ('level3_incorporate_new_event', 'level3_update_level3_eras', 'save_exchange_microtimestamp',
+									   'check_microtimestamp_change', 'propagate_microtimestamp_change')
+					   and pronamespace = 'obanalytics'::regnamespace
+					   and not tgisinternal
+					   -- the triggers cloned to the partitions go with the ones they are cloned from
+					   and not exists (select from pg_depend
+									   where classid = 'pg_trigger'::regclass and objid = pg_trigger.oid
+										 and refclassid = 'pg_trigger'::regclass)
+					   and (tgrelid::regclass::text like 'data.level3\_%210001'
+							or tgrelid in ('obanalytics.level3'::regclass,
+										   to_regclass('obanalytics.level3_' || current_setting('obadiah.benchmark_exchange'))))
+	loop
+		execute format('drop trigger %I on %s', v_trigger.tgname, v_trigger.table_name);
+		execute replace(v_trigger.definition, 'obanalytics.' || v_trigger.proname || '()',
+						'obanalytics.' || v_trigger.proname || '_fast()');
+	end loop;
+end;
+$$;
+
+\timing on
+
+-- C triggers
+insert into obanalytics.level3 (microtimestamp, order_id, side, price, amount, next_microtimestamp, pair_id, exchange_id, local_timestamp)
+select '2100-01-15 00:00:01+00'::timestamptz + offset_time, :n + order_id, side, price, amount, next_microtimestamp, pair_id, exchange_id, clock_timestamp()
+from benchmark_events, benchmark_params
+order by offset_time;
+
+-- Set-based insertion, no chaining in the triggers
+select obanalytics.level3_insert_events(exchange_id, pair_id,
+										array_agg('2100-01-22 00:00:01+00'::timestamptz + offset_time order by offset_time),
+										array_agg(2 * :n + order_id order by offset_time),
+										array_agg(side order by offset_time),
+										array_agg(price order by offset_time),
+										array_agg(amount order by offset_time),
+										array_agg(clock_timestamp() order by offset_time))
+from benchmark_events, benchmark_params
+group by exchange_id, pair_id;
+
+\timing off
+
+-- All batches must produce the same chains. Expected: 0 rows
+with batches as (
+	select batch, start_time, first_order
+	from (values ('plpgsql', '2100-01-01 00:00:00+00'::timestamptz, 0),
+				 ('c', '2100-01-15 00:00:00+00'::timestamptz, :n),
+				 ('level3_insert_events', '2100-01-22 00:00:00+00'::timestamptz, 2 * :n)) b(batch, start_time, first_order)
+),
+chains as (
+	select batch, microtimestamp - start_time as microtimestamp, order_id - first_order as order_id, event_no, side, price, amount, fill,
+		   case when next_microtimestamp > '-infinity' and next_microtimestamp < 'infinity'
+				then next_microtimestamp - start_time end as next_microtimestamp, next_event_no,
+		   price_microtimestamp - start_time as price_microtimestamp, price_event_no
+	from obanalytics.level3 join benchmark_params using (exchange_id, pair_id)
+		 join batches on order_id > first_order and order_id <= first_order + :n
+	where microtimestamp >= '2100-01-01 00:00:00+00' and microtimestamp < '2100-02-01 00:00:00+00'
+)
+select batch, microtimestamp, order_id, event_no, side, price, amount, fill, next_microtimestamp, next_event_no, price_microtimestamp, price_event_no
+from (
+	select *, count(*) over (partition by microtimestamp, order_id, event_no, side, price, amount, fill, next_microtimestamp, next_event_no,
+										  price_microtimestamp, price_event_no) as batches
+	from chains
+) a
+where batches <> 3
+order by order_id, event_no, batch;
+
+select level3
+from obanalytics.level3_eras join benchmark_params using (exchange_id, pair_id)
+where era = '2100-01-01 00:00:00+00';
+
+rollback;
@@ -0,0 +1,656 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Streaming matchers of trades to level3 events. The trades and the events
+// are read once, ordered by time; the candidate events are indexed in hash
+// tables and the matches are written back with one statement.
+//
+// match_price_and_fill_exact() follows bitfinex.match_price_and_fill_exact()
+// and match_trades_to_sequential_events() replaces the loop over tolerances
+// and offsets in bitstamp.pga_match() (see bitfinex_schema.sql and
+// bitstamp_schema.sql).
+
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "postgres.h"
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "access/htup_details.h"
+#include "catalog/pg_type_d.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/numeric.h"
+#include "utils/timestamp.h"
+
+PG_FUNCTION_INFO_V1(match_price_and_fill_exact);
+PG_FUNCTION_INFO_V1(match_trades_to_sequential_events);
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#include <algorithm>
+#include <utility>
+
+#include "spi_allocator.h"
+#include "spi_plan.h"
+
+namespace obad {
+namespace {
+
+int
+compare(Datum a, Datum b) {
+ return DatumGetInt32(DirectFunctionCall2(numeric_cmp, a, b));
+}
+
+// The rows returned by the UPDATE ... RETURNING statement, converted to the
+// result type of the function in the multi-call memory context
+struct returned_rows {
+ Datum *rows;
+ uint64 n;
+ uint64 next;
+};
+
+returned_rows *
+return_updated(FunctionCallInfo fcinfo, MemoryContext multi_call_memory_ctx) {
+ MemoryContext oldcontext = MemoryContextSwitchTo(multi_call_memory_ctx);
+ TupleDesc tupdesc;
+ if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                  errmsg("function returning record called in context "
+                         "that cannot accept type record")));
+ tupdesc = BlessTupleDesc(tupdesc);
+ if (tupdesc->natts != SPI_tuptable->tupdesc->natts)
+  ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                  errmsg("the updated table does not match the result type")));
+ returned_rows *result =
+     static_cast<returned_rows *>(palloc(sizeof(returned_rows)));
+ result->n = SPI_processed;
+ result->next = 0;
+ result->rows = static_cast<Datum *>(palloc((SPI_processed + 1) * sizeof(Datum)));
+ Datum *values = static_cast<Datum *>(palloc(tupdesc->natts * sizeof(Datum)));
+ bool *nulls = static_cast<bool *>(palloc(tupdesc->natts * sizeof(bool)));
+ for (uint64 i = 0; i < SPI_processed; ++i) {
+  heap_deform_tuple(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, values,
+                    nulls);
+  result->rows[i] = HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+ }
+ MemoryContextSwitchTo(oldcontext);
+ return result;
+}
+
+Datum
+return_next(FunctionCallInfo fcinfo) {
+ FuncCallContext *funcctx = SRF_PERCALL_SETUP();
+ returned_rows *rows = static_cast<returned_rows *>(funcctx->user_fctx);
+ if (rows->next < rows->n) SRF_RETURN_NEXT(funcctx, rows->rows[rows->next++]);
+ SRF_RETURN_DONE(funcctx);
+}
+
+// Bitfinex
+
+// Trades and events are matched if they have the same price, fill and side
+// (the side of a trade is the opposite of its origination)
+struct price_fill_side {
+ Datum price;
+ Datum fill;
+ char side;
+};
+
+struct price_fill_side_hash {
+ std::size_t operator()(const price_fill_side &key) const {
+  return (static_cast<std::size_t>(DatumGetUInt32(
+              DirectFunctionCall1(hash_numeric, key.price))) *
+              31 +
+          DatumGetUInt32(DirectFunctionCall1(hash_numeric, key.fill))) *
+             31 +
+         key.side;
+ }
+};
+
+struct price_fill_side_equal {
+ bool operator()(const price_fill_side &a, const price_fill_side &b) const {
+  return a.side == b.side && compare(a.price, b.price) == 0 &&
+         compare(a.fill, b.fill) == 0;
+ }
+};
+
+struct matchable_event {
+ TimestampTz microtimestamp;
+ Datum order_id;
+ Datum event_no;
+ Datum side;
+ price_fill_side key;
+ int64 first_trade = -1;  // the earliest trade it is a candidate for
+};
+
+struct unmatched_trade {
+ Datum tableoid;
+ Datum ctid;
+ TimestampTz microtimestamp;
+ TimestampTz latest;  // microtimestamp + p_max_delay
+ price_fill_side key;
+};
+
+// The candidate events of one key within the time window, in the order of
+// microtimestamp. Events before `head` have left the window, the ones before
+// `seen` have already been seen by a trade
+struct window_bucket {
+ obad::vector<std::size_t> events;
+ std::size_t head = 0;
+ std::size_t seen = 0;
+};
+
+char
+side_of(Datum side) {
+ text *t = DatumGetTextPP(side);
+ return VARSIZE_ANY_EXHDR(t) ? *VARDATA_ANY(t) : ' ';
+}
+
+}  // namespace
+}  // namespace obad
+
+// The same as bitfinex.match_price_and_fill_exact(): a trade is matched to
+// the earliest event with the same price and fill of the opposite side
+// within p_max_delay after the trade, provided that the trade is the
+// earliest one this event could be matched to. The window of candidate
+// events slides over the events once
+Datum
+match_price_and_fill_exact(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ if (SRF_IS_FIRSTCALL()) {
+  FuncCallContext *funcctx = SRF_FIRSTCALL_INIT();
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3))
+   ereport(ERROR,
+           (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+            errmsg("p_start_time, p_end_time, p_pair_id, p_max_delay must "
+                   "not be NULL")));
+  SPI_connect();
+  Datum values[5] = {PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
+                     PG_GETARG_DATUM(2), PG_GETARG_DATUM(3),
+                     PG_ARGISNULL(4) ? 0 : PG_GETARG_DATUM(4)};
+  char nulls[5] = {' ', ' ', ' ', ' ', PG_ARGISNULL(4) ? 'n' : ' '};
+
+  obad::vector<matchable_event> events;
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	select microtimestamp, order_id, event_no, price, fill, side
+	from bitfinex._level3_matchable_events($1, $2, $3, $5)
+	where fill is not null
+	order by microtimestamp, order_id, event_no)QUERY";
+   Oid types[5] = {TIMESTAMPTZOID, TIMESTAMPTZOID, INT4OID, INTERVALOID,
+                   INT4OID};
+   SPI_execute_plan(kept_plan(plan, query, 5, types), values, nulls, true, 0);
+   SPITupleTable *tuptable = SPI_tuptable;  // kept until SPI_finish()
+   events.reserve(SPI_processed);
+   for (uint64 i = 0; i < SPI_processed; ++i) {
+    HeapTuple tuple = tuptable->vals[i];
+    bool is_null, price_null, fill_null, side_null;
+    matchable_event e;
+    e.microtimestamp = DatumGetTimestampTz(
+        SPI_getbinval(tuple, tuptable->tupdesc, 1, &is_null));
+    e.order_id = SPI_getbinval(tuple, tuptable->tupdesc, 2, &is_null);
+    e.event_no = SPI_getbinval(tuple, tuptable->tupdesc, 3, &is_null);
+    e.key.price = SPI_getbinval(tuple, tuptable->tupdesc, 4, &price_null);
+    e.key.fill = SPI_getbinval(tuple, tuptable->tupdesc, 5, &fill_null);
+    e.side = SPI_getbinval(tuple, tuptable->tupdesc, 6, &side_null);
+    // The key columns are hashed and compared as numerics
+    if (price_null || fill_null || side_null) continue;
+    e.key.side = side_of(e.side);
+    events.push_back(e);
+   }
+  }
+
+  obad::vector<unmatched_trade> trades;
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	select tableoid, ctid, microtimestamp, microtimestamp + $4,
+		   case when $5 is null then price else trunc(price, $5) end,
+		   amount,
+		   case side when 'b' then 's' when 's' then 'b' end::character(1)
+	from obanalytics.matches_bitfinex
+	where pair_id = $3
+	  and microtimestamp between $1 and $2
+	  and buy_order_id is null and sell_order_id is null
+	order by microtimestamp, exchange_trade_id)QUERY";
+   Oid types[5] = {TIMESTAMPTZOID, TIMESTAMPTZOID, INT4OID, INTERVALOID,
+                   INT4OID};
+   SPI_execute_plan(kept_plan(plan, query, 5, types), values, nulls, true, 0);
+   SPITupleTable *tuptable = SPI_tuptable;
+   trades.reserve(SPI_processed);
+   for (uint64 i = 0; i < SPI_processed; ++i) {
+    HeapTuple tuple = tuptable->vals[i];
+    bool is_null, price_null, amount_null, side_null;
+    unmatched_trade t;
+    t.tableoid = SPI_getbinval(tuple, tuptable->tupdesc, 1, &is_null);
+    t.ctid = SPI_getbinval(tuple, tuptable->tupdesc, 2, &is_null);
+    t.microtimestamp = DatumGetTimestampTz(
+        SPI_getbinval(tuple, tuptable->tupdesc, 3, &is_null));
+    t.latest = DatumGetTimestampTz(
+        SPI_getbinval(tuple, tuptable->tupdesc, 4, &is_null));
+    t.key.price = SPI_getbinval(tuple, tuptable->tupdesc, 5, &price_null);
+    t.key.fill = SPI_getbinval(tuple, tuptable->tupdesc, 6, &amount_null);
+    Datum side = SPI_getbinval(tuple, tuptable->tupdesc, 7, &side_null);
+    if (price_null || amount_null || side_null) continue;
+    t.key.side = side_of(side);
+    trades.push_back(t);
+   }
+  }
+
+  // The events within [microtimestamp, latest] of the current trade are
+  // events[first, last). The trades are processed in the order of
+  // microtimestamp, so both bounds only move forward
+  obad::unordered_map<price_fill_side, window_bucket, price_fill_side_hash,
+                      price_fill_side_equal>
+      window;
+  std::size_t first = 0, last = 0;
+  obad::vector<Datum> m_tableoid, m_ctid, m_microtimestamp, m_order_id,
+      m_event_no, m_side;
+  for (std::size_t j = 0; j < trades.size(); ++j) {
+   const unmatched_trade &trade = trades[j];
+   for (; last < events.size() && events[last].microtimestamp <= trade.latest;
+        ++last)
+    window[events[last].key].events.push_back(last);
+   for (; first < last && events[first].microtimestamp < trade.microtimestamp;
+        ++first) {
+    auto left = window.find(events[first].key);
+    window_bucket &bucket = left->second;
+    if (++bucket.head == bucket.events.size())
+     window.erase(left);
+    else
+     bucket.seen = std::max(bucket.seen, bucket.head);
+   }
+   auto found = window.find(trade.key);
+   if (found == window.end()) continue;
+   window_bucket &bucket = found->second;
+   for (std::size_t i = std::max(bucket.seen, bucket.head);
+        i < bucket.events.size(); ++i)
+    events[bucket.events[i]].first_trade = j;
+   bucket.seen = bucket.events.size();
+   matchable_event &earliest = events[bucket.events[bucket.head]];
+   if (earliest.first_trade == static_cast<int64>(j)) {
+    m_tableoid.push_back(trade.tableoid);
+    m_ctid.push_back(trade.ctid);
+    m_microtimestamp.push_back(TimestampTzGetDatum(earliest.microtimestamp));
+    m_order_id.push_back(earliest.order_id);
+    m_event_no.push_back(earliest.event_no);
+    m_side.push_back(earliest.side);
+   }
+  }
+
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	with for_update as (
+		select *
+		from unnest($2::oid[], $3::tid[], $4::timestamptz[], $5::bigint[],
+					$6::integer[], $7::character[]) f(tableoid, ctid, microtimestamp, order_id, event_no, side)
+	),
+	updated_matches as (
+		update obanalytics.matches_bitfinex
+		set buy_order_id = case when for_update.side = 'b' then order_id else buy_order_id end,
+			buy_event_no = case when for_update.side = 'b' then event_no else buy_event_no end,
+			sell_order_id = case when for_update.side = 's' then order_id else sell_order_id end,
+			sell_event_no = case when for_update.side = 's' then event_no else sell_event_no end,
+			microtimestamp = for_update.microtimestamp
+		from for_update
+		where matches_bitfinex.pair_id = $1
+		  and for_update.ctid = matches_bitfinex.ctid
+		  and for_update.tableoid = matches_bitfinex.tableoid
+		returning matches_bitfinex.*
+	),
+	updated_buys as (
+		update obanalytics.level3_bitfinex
+		set amount = level3_bitfinex.amount - updated_matches.amount,
+			fill = updated_matches.amount
+		from updated_matches
+		where updated_matches.buy_order_id is not null
+		  and level3_bitfinex.microtimestamp = updated_matches.microtimestamp
+		  and level3_bitfinex.order_id = buy_order_id
+		  and level3_bitfinex.event_no = buy_event_no
+		  and level3_bitfinex.pair_id = $1
+		  and level3_bitfinex.side = 'b'
+		  and fill is null
+	),
+	updated_sells as (
+		update obanalytics.level3_bitfinex
+		set amount = level3_bitfinex.amount - updated_matches.amount,
+			fill = updated_matches.amount
+		from updated_matches
+		where updated_matches.sell_order_id is not null
+		  and level3_bitfinex.microtimestamp = updated_matches.microtimestamp
+		  and level3_bitfinex.order_id = sell_order_id
+		  and level3_bitfinex.event_no = sell_event_no
+		  and level3_bitfinex.pair_id = $1
+		  and level3_bitfinex.side = 's'
+		  and fill is null
+	)
+	select *
+	from updated_matches)QUERY";
+   Oid types[7] = {INT4OID,
+                   get_array_type(OIDOID),
+                   get_array_type(TIDOID),
+                   get_array_type(TIMESTAMPTZOID),
+                   get_array_type(INT8OID),
+                   get_array_type(INT4OID),
+                   get_array_type(BPCHAROID)};
+   int m = m_tableoid.size();
+   Datum update[7] = {PG_GETARG_DATUM(2),
+                      make_array(m_tableoid.data(), nullptr, m, OIDOID),
+                      make_array(m_ctid.data(), nullptr, m, TIDOID),
+                      make_array(m_microtimestamp.data(), nullptr, m,
+                                 TIMESTAMPTZOID),
+                      make_array(m_order_id.data(), nullptr, m, INT8OID),
+                      make_array(m_event_no.data(), nullptr, m, INT4OID),
+                      make_array(m_side.data(), nullptr, m, BPCHAROID)};
+   SPI_execute_plan(kept_plan(plan, query, 7, types), update, nullptr, false,
+                    0);
+   funcctx->user_fctx = return_updated(fcinfo, funcctx->multi_call_memory_ctx);
+  }
+  SPI_finish();
+ }
+ return return_next(fcinfo);
+}
+
+namespace obad {
+namespace {
+
+// Bitstamp
+
+struct live_order_event {
+ TimestampTz microtimestamp;
+ int64 order_id;
+ Datum event_no;
+ Datum amount;
+ bool amount_null;
+ Datum fill;
+ bool fill_null;
+ bool is_created;
+ bool is_deleted;
+ bool is_buy;
+ TimestampTz price_microtimestamp;
+ bool is_matched;  // trade_id is not null
+};
+
+struct live_trade {
+ Datum trade_id;
+ bool is_buy;
+ Datum amount;
+ Datum price;
+ bool is_matched = false;
+};
+
+using order_ids = std::pair<int64, int64>;  // (buy_order_id, sell_order_id)
+
+struct order_ids_hash {
+ std::size_t operator()(const order_ids &key) const {
+  return std::hash<int64>()(key.first) * 31 + std::hash<int64>()(key.second);
+ }
+};
+
+// The same as bitstamp._get_match_rule(), -1 is NULL
+int
+match_rule(const live_trade &trade, const live_order_event &event,
+           Datum tolerance) {
+ auto within_tolerance = [&trade, tolerance](Datum amount) {
+  Datum difference = DirectFunctionCall1(
+      numeric_abs,
+      DirectFunctionCall2(
+          numeric_sub, DirectFunctionCall2(numeric_mul, trade.amount, trade.price),
+          DirectFunctionCall2(numeric_mul, amount, trade.price)));
+  return compare(difference, tolerance) < 0;
+ };
+ if (!event.fill_null) {
+  if (compare(trade.amount, event.fill) == 0) return 0;
+  if (within_tolerance(event.fill)) return 1;
+ } else {
+  return 2;
+ }
+ if (event.is_deleted && !event.amount_null &&
+     compare(event.fill,
+             DirectFunctionCall1(int4_numeric, Int32GetDatum(0))) == 0 &&
+     within_tolerance(event.amount))
+  return 3;
+ return -1;
+}
+
+struct sequential_match {
+ std::size_t trade;
+ std::size_t event;       // the earlier one
+ std::size_t next_event;  // p_offset events later
+ int rule;
+ int next_rule;
+};
+
+}  // namespace
+}  // namespace obad
+
+// Matches the unmatched trades in [p_start_time, p_end_time] to pairs of
+// events of the trade's buy and sell orders which are p_offset events apart,
+// for each tolerance in p_tolerance_percentages and each p_offset from 1 to
+// p_max_offset, in this order. Each pass follows
+// bitstamp.match_trades_to_sequential_events(), but the events and the trades
+// are read once and indexed by order_id: the passes see the matches of the
+// previous ones in memory and all matches are written with one statement.
+// When trades compete for an event within a pass, the SQL version matches all
+// of them to it, so the deferred foreign keys between live_trades and
+// live_orders fail at commit. Here the earliest trade is matched and the
+// others are left to the later passes. A trade proposed for several pairs of
+// events within a pass is matched to the earliest pair, while the SQL version
+// takes any of them
+Datum
+match_trades_to_sequential_events(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ if (SRF_IS_FIRSTCALL()) {
+  FuncCallContext *funcctx = SRF_FIRSTCALL_INIT();
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) ||
+      PG_ARGISNULL(3) || PG_ARGISNULL(4))
+   ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                   errmsg("p_start_time, p_end_time, p_pair, "
+                          "p_tolerance_percentages, p_max_offset must not be "
+                          "NULL")));
+  int max_offset = PG_GETARG_INT32(4);
+  SPI_connect();
+  Datum *tolerances;
+  bool *tolerance_nulls;
+  int n_tolerances;
+  deconstruct_array(PG_GETARG_ARRAYTYPE_P(3), NUMERICOID, -1, false, 'i',
+                    &tolerances, &tolerance_nulls, &n_tolerances);
+  Datum values[3] = {PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
+                     PG_GETARG_DATUM(2)};
+  Oid types[3] = {TIMESTAMPTZOID, TIMESTAMPTZOID, TEXTOID};
+
+  obad::vector<live_order_event> events;
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	select microtimestamp, order_id, event_no, amount, fill,
+		   event = 'order_created', event = 'order_deleted', order_type = 'buy',
+		   price_microtimestamp, trade_id is not null
+	from bitstamp.live_orders join bitstamp.pairs using (pair_id)
+	where microtimestamp between $1 and $2
+	  and pairs.pair = $3
+	order by microtimestamp, order_id, event_no)QUERY";
+   SPI_execute_plan(kept_plan(plan, query, 3, types), values, nullptr, true,
+                    0);
+   SPITupleTable *tuptable = SPI_tuptable;  // kept until SPI_finish()
+   TupleDesc tupdesc = tuptable->tupdesc;
+   events.reserve(SPI_processed);
+   for (uint64 i = 0; i < SPI_processed; ++i) {
+    HeapTuple tuple = tuptable->vals[i];
+    bool is_null;
+    live_order_event e;
+    e.microtimestamp =
+        DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 1, &is_null));
+    e.order_id = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &is_null));
+    e.event_no = SPI_getbinval(tuple, tupdesc, 3, &is_null);
+    e.amount = SPI_getbinval(tuple, tupdesc, 4, &e.amount_null);
+    e.fill = SPI_getbinval(tuple, tupdesc, 5, &e.fill_null);
+    e.is_created = DatumGetBool(SPI_getbinval(tuple, tupdesc, 6, &is_null));
+    e.is_deleted = DatumGetBool(SPI_getbinval(tuple, tupdesc, 7, &is_null));
+    e.is_buy = DatumGetBool(SPI_getbinval(tuple, tupdesc, 8, &is_null));
+    e.price_microtimestamp =
+        DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 9, &is_null));
+    e.is_matched = DatumGetBool(SPI_getbinval(tuple, tupdesc, 10, &is_null));
+    events.push_back(e);
+   }
+  }
+
+  obad::vector<live_trade> trades;
+  obad::unordered_map<order_ids, obad::vector<std::size_t>, order_ids_hash>
+      trades_by_orders;
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	select trade_id, trade_type = 'buy', amount, price, buy_order_id, sell_order_id
+	from bitstamp.live_trades join bitstamp.pairs using (pair_id)
+	where trade_timestamp between $1 and $2
+	  and buy_microtimestamp is null
+	  and sell_microtimestamp is null
+	  and pairs.pair = $3
+	order by trade_timestamp, trade_id)QUERY";
+   SPI_execute_plan(kept_plan(plan, query, 3, types), values, nullptr, true,
+                    0);
+   SPITupleTable *tuptable = SPI_tuptable;
+   TupleDesc tupdesc = tuptable->tupdesc;
+   trades.reserve(SPI_processed);
+   for (uint64 i = 0; i < SPI_processed; ++i) {
+    HeapTuple tuple = tuptable->vals[i];
+    bool is_null;
+    live_trade t;
+    t.trade_id = SPI_getbinval(tuple, tupdesc, 1, &is_null);
+    t.is_buy = DatumGetBool(SPI_getbinval(tuple, tupdesc, 2, &is_null));
+    t.amount = SPI_getbinval(tuple, tupdesc, 3, &is_null);
+    t.price = SPI_getbinval(tuple, tupdesc, 4, &is_null);
+    order_ids key{DatumGetInt64(SPI_getbinval(tuple, tupdesc, 5, &is_null)),
+                  DatumGetInt64(SPI_getbinval(tuple, tupdesc, 6, &is_null))};
+    trades_by_orders[key].push_back(trades.size());
+    trades.push_back(t);
+   }
+  }
+
+  obad::vector<sequential_match> matches;
+  obad::vector<Datum> trade_tolerances(trades.size());
+  for (int k = 0; k < n_tolerances; ++k) {
+   if (tolerance_nulls[k]) continue;
+   for (std::size_t j = 0; j < trades.size(); ++j)
+    trade_tolerances[j] =
+        DirectFunctionCall2(numeric_mul, tolerances[k], trades[j].price);
+   for (int offset = 1; offset <= max_offset; ++offset) {
+    obad::vector<sequential_match> proposed;
+    obad::unordered_set<std::size_t> proposed_next_events;
+    for (std::size_t i = 0; i + offset < events.size(); ++i) {
+     const live_order_event &e = events[i], &n = events[i + offset];
+     if (e.is_buy == n.is_buy || e.is_matched || n.is_matched ||
+         e.is_created || n.is_created)
+      continue;
+     for (const order_ids &key : {order_ids{e.order_id, n.order_id},
+                                  order_ids{n.order_id, e.order_id}}) {
+      auto found = trades_by_orders.find(key);
+      if (found == trades_by_orders.end()) continue;
+      for (std::size_t j : found->second) {
+       const live_trade &trade = trades[j];
+       if (trade.is_matched) continue;
+       int rule = match_rule(trade, e, trade_tolerances[j]);
+       if (rule < 0) continue;
+       int next_rule = match_rule(trade, n, trade_tolerances[j]);
+       if (next_rule < 0) continue;
+       // The event of the trade's direction (i.e. of the taker) is the
+       // later one in terms of price_microtimestamp
+       if (e.is_buy == trade.is_buy
+               ? !(e.price_microtimestamp > n.price_microtimestamp)
+               : !(e.price_microtimestamp < n.price_microtimestamp))
+        continue;
+       proposed.push_back({j, i, i + offset, rule, next_rule});
+       proposed_next_events.insert(i + offset);
+      }
+     }
+    }
+    // A single event may not participate in two trades
+    for (const sequential_match &m : proposed) {
+     if (proposed_next_events.count(m.event)) continue;
+     if (trades[m.trade].is_matched || events[m.event].is_matched ||
+         events[m.next_event].is_matched)
+      continue;
+     trades[m.trade].is_matched = true;
+     events[m.event].is_matched = true;
+     events[m.next_event].is_matched = true;
+     matches.push_back(m);
+    }
+   }
+  }
+
+  {
+   static SPIPlanPtr plan = nullptr;
+   static const char *const query = R"QUERY(
+	update bitstamp.live_trades
+	set buy_microtimestamp = m.buy_microtimestamp,
+		buy_event_no = m.buy_event_no,
+		buy_match_rule = m.buy_match_rule,
+		sell_microtimestamp = m.sell_microtimestamp,
+		sell_event_no = m.sell_event_no,
+		sell_match_rule = m.sell_match_rule
+	from unnest($1::bigint[], $2::timestamptz[], $3::smallint[], $4::smallint[],
+				$5::timestamptz[], $6::smallint[], $7::smallint[])
+		 m(trade_id, buy_microtimestamp, buy_event_no, buy_match_rule,
+		   sell_microtimestamp, sell_event_no, sell_match_rule)
+	where live_trades.trade_id = m.trade_id
+	returning live_trades.*)QUERY";
+   Oid types[7] = {get_array_type(INT8OID),        get_array_type(TIMESTAMPTZOID),
+                   get_array_type(INT2OID),        get_array_type(INT2OID),
+                   get_array_type(TIMESTAMPTZOID), get_array_type(INT2OID),
+                   get_array_type(INT2OID)};
+   obad::vector<Datum> trade_id, buy_microtimestamp, buy_event_no,
+       buy_match_rule, sell_microtimestamp, sell_event_no, sell_match_rule;
+   for (const sequential_match &m : matches) {
+    const live_order_event &e = events[m.event], &n = events[m.next_event];
+    const live_order_event &buy = e.is_buy ? e : n, &sell = e.is_buy ? n : e;
+    trade_id.push_back(trades[m.trade].trade_id);
+    buy_microtimestamp.push_back(TimestampTzGetDatum(buy.microtimestamp));
+    buy_event_no.push_back(buy.event_no);
+    buy_match_rule.push_back(Int16GetDatum(e.is_buy ? m.rule : m.next_rule));
+    sell_microtimestamp.push_back(TimestampTzGetDatum(sell.microtimestamp));
+    sell_event_no.push_back(sell.event_no);
+    sell_match_rule.push_back(Int16GetDatum(e.is_buy ? m.next_rule : m.rule));
+   }
+   int m = matches.size();
+   Datum update[7] = {
+       make_array(trade_id.data(), nullptr, m, INT8OID),
+       make_array(buy_microtimestamp.data(), nullptr, m, TIMESTAMPTZOID),
+       make_array(buy_event_no.data(), nullptr, m, INT2OID),
+       make_array(buy_match_rule.data(), nullptr, m, INT2OID),
+       make_array(sell_microtimestamp.data(), nullptr, m, TIMESTAMPTZOID),
+       make_array(sell_event_no.data(), nullptr, m, INT2OID),
+       make_array(sell_match_rule.data(), nullptr, m, INT2OID)};
+   SPI_execute_plan(kept_plan(plan, query, 7, types), update, nullptr, false,
+                    0);
+   funcctx->user_fctx = return_updated(fcinfo, funcctx->multi_call_memory_ctx);
+  }
+  SPI_finish();
+ }
+ return return_next(fcinfo);
+}
@@ -31,7 +31,11 @@ extern "C" {
 #include "executor/spi.h"
 #include "fmgr.h"
 #include "funcapi.h"
+#include "miscadmin.h"
 #include "postgres.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "storage/fd.h"
 #include "utils/lsyscache.h"
 #include "utils/numeric.h"
 #include "utils/timestamp.h"
@@ -39,40 +43,56 @@ PG_MODULE_MAGIC;
 
 PG_FUNCTION_INFO_V1(depth_change_by_episode);
 PG_FUNCTION_INFO_V1(spread_by_episode);
+PG_FUNCTION_INFO_V1(crossed_books_by_episode);
 PG_FUNCTION_INFO_V1(to_microseconds);
 PG_FUNCTION_INFO_V1(CalculateTradingPeriod);
 PG_FUNCTION_INFO_V1(SetLogLevel);
 PG_FUNCTION_INFO_V1(GetOrderBookQueues);
+PG_FUNCTION_INFO_V1(GetDepthSummary);
 PG_FUNCTION_INFO_V1(DiscoverPositions);
+PG_FUNCTION_INFO_V1(DiscoverDrawUpDowns);
+PG_FUNCTION_INFO_V1(GetStageMetrics);
+PG_FUNCTION_INFO_V1(ExportTradingPeriod);
+PG_FUNCTION_INFO_V1(ExportTradingPeriodToFile);
+PG_FUNCTION_INFO_V1(ExportOrderBookQueues);
+PG_FUNCTION_INFO_V1(ExportOrderBookQueuesToFile);
 #ifdef __cplusplus
 }
 #endif  // __cplusplus
-#include <boost/log/expressions.hpp>
-#include <boost/log/sinks/basic_sink_backend.hpp>
-#include <boost/log/sinks/frontend_requirements.hpp>
-#include <boost/log/sinks/text_file_backend.hpp>
-#include <boost/log/sources/record_ostream.hpp>
-#include <boost/log/utility/setup/common_attributes.hpp>
-#include <boost/log/utility/setup/file.hpp>
+#include <algorithm>
+#include <cstring>
 #include <map>
+#include <new>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include "depth.h"
+#include "binary_copy.h"
 #include "episode.h"
 #include "level2.h"
 #include "level3.h"
 #include "order_book.h"
 #include "spi_allocator.h"
+#include "spi_plan.h"
 // From R
 #include "../../../src/base.h"
+#include "../../../src/epsilon_drawupdowns.h"
 #include "../../../src/order_book_investigation.h"
 #include "../../../src/position_discovery.h"
 
-namespace logging = boost::log;
+#if OBADIAH_LOGGING
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/frontend_requirements.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/log/utility/setup/common_attributes.hpp>
+#include <boost/log/utility/setup/file.hpp>
+
 namespace expr = boost::log::expressions;
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", obadiah::R::SeverityLevel)
+#endif
 
 namespace obad {
 
@@ -81,7 +101,7 @@ struct multi_call_context : public obad::postgres_heap {
   l3 = new (allocation_mode::non_spi) obad::episode{};
   ob = new (allocation_mode::non_spi) obad::order_book{};
   l2 = new (palloc(sizeof(obad::deque<level2>))) obad::deque<level2>{};
-  d = new (obad::allocation_mode::non_spi) obad::depth();
+  d = nullptr;
  };
 
  ~multi_call_context() {
@@ -94,12 +114,86 @@ struct multi_call_context : public obad::postgres_heap {
   if (d) delete d;
  };
 
+ // Feeds episodes to the order book until one of them changes depth, i.e.
+ // produces level2's. Returns false when there are no more episodes.
+ bool next_episode();
+ // Feeds the next episode to the order book without producing level2's and
+ // returns the best levels after it. Returns false when there are no more
+ // episodes.
+ bool next_spread(level1 &);
+ // The depth built from level2's, created on the first call
+ obad::depth *get_depth() {
+  if (!d) d = new (allocation_mode::non_spi) obad::depth();
+  return d;
+ };
+
  obad::episode *l3;
  obad::order_book *ob;
  obad::depth *d;
  obad::deque<obad::level2> *l2;
+
+private:
+ template <class F>
+ bool report_exceptions(F f);
 };
 
+// Returns f(), but C++ exceptions thrown by f() are reported as errors
+template <class F>
+bool
+multi_call_context::report_exceptions(F f) {
+ const char *error = nullptr;
+ try {
+  return f();
+ } catch (const std::bad_alloc &) {
+  error = "out of memory";
+ } catch (const std::exception &e) {
+  error = pstrdup(e.what());
+ }
+ // ereport() longjmps, so it must not be called from inside a catch block
+ ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("%s", error)));
+ return false;
+}
+
+bool
+multi_call_context::next_episode() {
+ return report_exceptions([this]() {
+  std::vector<level3> episode;
+  // it is possible that some level3 episodes will not generate level2
+  // changes. We'll skip them
+  while (l2->empty()) {
+   if (!l3->next(episode)) return false;
+   ob->update(std::move(episode), l2);
+#if DEBUG_DEPTH
+   elog(DEBUG2, "%s got a level2 result set with %lu level2 records",
+        __PRETTY_FUNCTION__, l2->size());
+#endif
+  }
+  return true;
+ });
+}
+
+bool
+multi_call_context::next_spread(level1 &spread) {
+ return report_exceptions([this, &spread]() {
+  std::vector<level3> episode;
+  if (!l3->next(episode)) return false;
+#if DEBUG_SPREAD
+  // Cross-check against the best levels of depth built from level2's
+  ob->update(std::move(episode), l2);
+  level1 expected = get_depth()->update(l2);
+  spread = ob->spread();
+  if (spread != expected)
+   elog(WARNING, "%s: %s order book's spread differs from depth's",
+        __PRETTY_FUNCTION__, timestamptz_to_str(spread.microtimestamp));
+#else
+  ob->update(std::move(episode), nullptr);
+  spread = ob->spread();
+#endif
+  return true;
+ });
+}
+
+#if OBADIAH_LOGGING
 class elog_sink
     : public sinks::basic_formatted_sink_backend<char,
                                                  sinks::synchronized_feeding> {
@@ -148,10 +242,25 @@ elog_sink::consume(logging::record_view const &rec, string_type const &msg) {
   return;
  }
 }
+#endif
 }  // namespace obad
 
 extern "C" void
 _PG_init() {
+ DefineCustomBoolVariable(
+     "obadiah_db.merge_sides",
+     "Reads level3 through one ordered scan per side and merges them.",
+     "When off, level3 is read through a single scan sorted by "
+     "microtimestamp.",
+     &obad::episode::merge_sides, true, PGC_USERSET, 0, NULL, NULL, NULL);
+ DefineCustomEnumVariable(
+     "obadiah_db.plan_mode",
+     "Chooses between generic and custom plans of the kept cursor queries.",
+     "The same as plan_cache_mode, for the queries reading depth and level3 "
+     "which are prepared once per backend.",
+     &obad::plan_mode, 0, obad::plan_mode_options, PGC_USERSET, 0, NULL, NULL,
+     NULL);
+#if OBADIAH_LOGGING
  logging::add_common_attributes();
  /* pid_t pid = getpid();
   char buffer[100];
@@ -166,6 +275,7 @@ _PG_init() {
  logging::core::get()->add_sink(sink);
  logging::core::get()->set_filter(severity >
                                   obadiah::R::SeverityLevel::kNotice);
+#endif
 };
 
 Datum
@@ -175,7 +285,6 @@ depth_change_by_episode(PG_FUNCTION_ARGS) {
 
  FuncCallContext *funcctx;
  TupleDesc tupdesc;
- AttInMetadata *attinmeta;
 
  if (SRF_IS_FIRSTCALL()) {
   MemoryContext oldcontext;
@@ -198,8 +307,7 @@ depth_change_by_episode(PG_FUNCTION_ARGS) {
   elog(DEBUG1, "depth_change_by_episode(%s, %s, %i, %i)", p_start_time.c_str(),
        p_end_time.c_str(), PG_GETARG_INT32(2), PG_GETARG_INT32(3));
 #endif  // DEBUG_DEPTH
-  attinmeta = TupleDescGetAttInMetadata(tupdesc);
-  funcctx->attinmeta = attinmeta;
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
   multi_call_context *d = new (allocation_mode::non_spi) multi_call_context;
 
   Datum frequency = obad::NULL_FREQ;
@@ -221,42 +329,7 @@ depth_change_by_episode(PG_FUNCTION_ARGS) {
  oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
  multi_call_context *d = static_cast<multi_call_context *>(funcctx->user_fctx);
- attinmeta = funcctx->attinmeta;
- try {
-  if (d->l2->empty()) {
-   while (true) {  // it is possible that some level3 episodes will not generate
-                   // level2 changes. We'll skip them
-    d->ob->update(d->l3->next(), d->l2);
-    if (d->l2->empty()) {
-#if DEBUG_DEPTH
-     elog(DEBUG2,
-          "%s got an empty leve2 result set, proceed to the next episode ...",
-          __PRETTY_FUNCTION__);
-#endif
-    } else {
-#if DEBUG_DEPTH
-     elog(DEBUG2, "%s got a new level2 result set with %lu level2 records",
-          __PRETTY_FUNCTION__, d->l2->size());
-#endif
-     break;
-    }
-   }
-  }
-
-  level2 result{std::move(d->l2->front())};
-  d->l2->pop_front();
-
-#if DEBUG_DEPTH
-  elog(DEBUG3, "%s will return %s, remains %lu", __PRETTY_FUNCTION__,
-       to_string<level2>(result).c_str(), d->l2->size());
-#endif
-
-  MemoryContextSwitchTo(oldcontext);
-
-  HeapTuple tuple_out =
-      result.to_heap_tuple(attinmeta, PG_GETARG_INT32(2), PG_GETARG_INT32(3));
-  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple_out));
- } catch (...) {
+ if (!d->next_episode()) {
 #if DEBUG_DEPTH
   elog(DEBUG3, "%s ends", __PRETTY_FUNCTION__);
 #endif
@@ -265,6 +338,20 @@ depth_change_by_episode(PG_FUNCTION_ARGS) {
 
   SRF_RETURN_DONE(funcctx);
  }
+
+ level2 result{std::move(d->l2->front())};
+ d->l2->pop_front();
+
+#if DEBUG_DEPTH
+ elog(DEBUG3, "%s will return %s, remains %lu", __PRETTY_FUNCTION__,
+      to_string<level2>(result).c_str(), d->l2->size());
+#endif
+
+ MemoryContextSwitchTo(oldcontext);
+
+ HeapTuple tuple_out = result.to_heap_tuple(
+     funcctx->tuple_desc, PG_GETARG_INT32(2), PG_GETARG_INT32(3));
+ SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple_out));
 }
 
 Datum
@@ -274,7 +361,6 @@ spread_by_episode(PG_FUNCTION_ARGS) {
 
  FuncCallContext *funcctx;
  TupleDesc tupdesc;
- AttInMetadata *attinmeta;
 
  if (SRF_IS_FIRSTCALL()) {
   MemoryContext oldcontext;
@@ -297,8 +383,7 @@ spread_by_episode(PG_FUNCTION_ARGS) {
   elog(DEBUG1, "spread_by_episode(%s, %s, %i, %i)", p_start_time.c_str(),
        p_end_time.c_str(), PG_GETARG_INT32(2), PG_GETARG_INT32(3));
 #endif  // DEBUG_SPREAD
-  attinmeta = TupleDescGetAttInMetadata(tupdesc);
-  funcctx->attinmeta = attinmeta;
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
   multi_call_context *d = new (allocation_mode::non_spi) multi_call_context;
 
   Datum frequency = obad::NULL_FREQ;
@@ -307,8 +392,12 @@ spread_by_episode(PG_FUNCTION_ARGS) {
   d->ob->update(
       d->l3->initial(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
                      PG_GETARG_DATUM(3), frequency),
+#if DEBUG_SPREAD
       d->l2);
-  d->d->update(d->l2);
+  d->get_depth()->update(d->l2);
+#else
+      nullptr);  // the spread is taken from the order book itself
+#endif
 
   funcctx->user_fctx = d;
 
@@ -321,45 +410,139 @@ spread_by_episode(PG_FUNCTION_ARGS) {
  oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
  multi_call_context *d = static_cast<multi_call_context *>(funcctx->user_fctx);
- attinmeta = funcctx->attinmeta;
- try {
-  obad::level1 previous{d->d->spread()};
-  obad::level1 next{};
-  do {
-   while (true) {  // it is possible that some level3 episodes will not generate
-                   // level2 changes. We'll skip them
-    d->ob->update(d->l3->next(), d->l2);
-    if (d->l2->empty()) {
+ obad::level1 previous{d->ob->spread()};
+ obad::level1 next{};
+ do {
+  if (!d->next_spread(next)) {
 #if DEBUG_SPREAD
-     elog(DEBUG2,
-          "%s got an empty leve2 result set, proceed to the next episode ...",
-          __PRETTY_FUNCTION__);
+   elog(DEBUG3, "%s ends", __PRETTY_FUNCTION__);
 #endif
-    } else {
-#if DEBUG_SPREAD
-     elog(DEBUG2, "%s got a new level2 result set with %lu level2 records",
-          __PRETTY_FUNCTION__, d->l2->size());
-#endif
-     break;
-    }
-   }
-   next = d->d->update(d->l2);
-  } while (previous == next);
+   MemoryContextSwitchTo(oldcontext);
+   delete d;
+
+   SRF_RETURN_DONE(funcctx);
+  }
+ } while (previous == next);
+
+ MemoryContextSwitchTo(oldcontext);
+
+ SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(next.to_heap_tuple(
+                              funcctx->tuple_desc, PG_GETARG_INT32(2),
+                              PG_GETARG_INT32(3))));
+}
+
+namespace obad {
+
+// crossed_books_by_episode() state: the current run of changes of the best
+// prices which are all crossed or all not crossed
+struct crossed_runs_context : public multi_call_context {
+ level1 previous;
+ TimestampTz run_start = 0;
+ TimestampTz run_end = 0;
+ int is_crossed = -1;  // -1 before the first run and after the last one
+ bool is_exhausted = false;  // next_spread() has returned false
+};
+
+// 1 if bid > ask, 0 if not and -1 if both sides are empty. An empty side is
+// taken to be at the price of the other one, as obanalytics.crossed_books()
+// does
+inline int
+is_crossed(const level1 &l) {
+ bool has_bid = l.best_bid_price > 0, has_ask = l.best_ask_price > 0;
+ if (!has_bid || !has_ask) return has_bid || has_ask ? 0 : -1;
+ return l.best_bid_price > l.best_ask_price &&
+        !prices_are_equal(l.best_bid_price, l.best_ask_price);
+}
+
+}  // namespace obad
+
+// Replays the episodes in one pass like spread_by_episode() and returns the
+// runs of changes of the best prices (run_start, run_end, is_crossed) instead
+// of the changes themselves
+Datum
+crossed_books_by_episode(PG_FUNCTION_ARGS) {
+ using namespace obad;
+
+ FuncCallContext *funcctx;
+ TupleDesc tupdesc;
+
+ if (SRF_IS_FIRSTCALL()) {
+  MemoryContext oldcontext;
+
+  funcctx = SRF_FIRSTCALL_INIT();
+
+  oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+   ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                   errmsg("function returning record called in context "
+                          "that cannot accept type record")));
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3))
+   ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                   errmsg("p_start_time, p_end_time, pair_id, exchange_id must "
+                          "not be NULL")));
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+  crossed_runs_context *d = new (allocation_mode::non_spi) crossed_runs_context;
+
+  Datum frequency = obad::NULL_FREQ;
+  if (!PG_ARGISNULL(4)) frequency = PG_GETARG_DATUM(4);
+
+  d->ob->update(
+      d->l3->initial(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
+                     PG_GETARG_DATUM(3), frequency),
+      nullptr);
+  d->previous = d->ob->spread();
+
+  funcctx->user_fctx = d;
 
   MemoryContextSwitchTo(oldcontext);
+ }
 
-  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(next.to_heap_tuple(
-                               funcctx->attinmeta, PG_GETARG_INT32(2),
-                               PG_GETARG_INT32(3))));
- } catch (...) {
-#if DEBUG_SPREAD
-  elog(DEBUG3, "%s ends", __PRETTY_FUNCTION__);
-#endif
+ funcctx = SRF_PERCALL_SETUP();
+
+ MemoryContext oldcontext;
+ oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+ crossed_runs_context *d =
+     static_cast<crossed_runs_context *>(funcctx->user_fctx);
+ level1 next{};
+ bool is_next = false;
+ int crossed = -1;
+ // Extends the current run until a change of the best prices starts another
+ // one. Changes which leave both sides empty belong to the current run
+ while (!d->is_exhausted && (is_next = d->next_spread(next))) {
+  if (next == d->previous) continue;
+  d->previous = next;
+  crossed = is_crossed(next);
+  if (crossed < 0 || crossed == d->is_crossed) {
+   d->run_end = next.microtimestamp;
+   continue;
+  }
+  if (d->is_crossed >= 0) break;
+  d->is_crossed = crossed;
+  d->run_start = d->run_end = next.microtimestamp;
+ }
+
+ if (d->is_crossed < 0) {
   MemoryContextSwitchTo(oldcontext);
   delete d;
-
   SRF_RETURN_DONE(funcctx);
  }
+
+ Datum values[3] = {TimestampTzGetDatum(d->run_start),
+                    TimestampTzGetDatum(d->run_end),
+                    BoolGetDatum(d->is_crossed == 1)};
+ bool nulls[3] = {false, false, false};
+ HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+ if (is_next) {
+  d->is_crossed = crossed;
+  d->run_start = d->run_end = next.microtimestamp;
+ } else {
+  d->is_crossed = -1;
+  d->is_exhausted = true;
+ }
+ MemoryContextSwitchTo(oldcontext);
+ SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
 }
 
 Datum
@@ -390,7 +573,7 @@ private:
 DepthChangesStream::DepthChangesStream(Datum p_start_time, Datum p_end_time,
                                        Datum p_pair_id, Datum p_exchange_id,
                                        Datum p_frequency)
-    : state_{true} {
+    : ObjectStream<obadiah::R::Level2>{"DepthChangesStream"}, state_{true} {
  cache_ = new (SPI_palloc(sizeof(Cache))) Cache;
  Oid types[5];
  Datum values[5];
@@ -410,11 +593,13 @@ DepthChangesStream::DepthChangesStream(Datum p_start_time, Datum p_end_time,
  char nulls[5] = {' ', ' ', ' ', ' ', ' '};
  if (p_frequency == obad::NULL_FREQ) nulls[4] = 'n';
 
- SPI_cursor_open_with_args(kCursorName, R"QUERY(
+ static obad::cached_plan plan;
+ SPI_cursor_open(kCursorName, obad::kept_plan(plan, R"QUERY(
         select extract(epoch from timestamp) as timestamp,
                price, volume, side 
         from get.depth($1, $2, $3, $4, $5) order by 1, 2 desc;)QUERY",
-                           5, types, values, nulls, true, 0);
+                                              5, types),
+                 values, nulls, true);
 }
 
 DepthChangesStream::~DepthChangesStream() {
@@ -430,10 +615,12 @@ DepthChangesStream::operator>>(obadiah::R::Level2 &dc) {
  // R's NA value.
  // See R source code: src/main/arithmetics.c R_ValueOfNA()
  static const double kR_NaReal = std::nan("1954");
+ obadiah::R::StageTimer timer{metrics_};
  if (cache_->empty()) {
   SPI_cursor_fetch(SPI_cursor_find(kCursorName), true, kFetchCount);
 
   if (SPI_processed > 0 && SPI_tuptable != NULL) {
+   ++metrics_.refills;  // the final empty fetch is not a refill
    HeapTuple tuple;
    TupleDesc tupdesc = SPI_tuptable->tupdesc;
    obadiah::R::Level2 l2;
@@ -475,6 +662,7 @@ DepthChangesStream::operator>>(obadiah::R::Level2 &dc) {
  } else {
   dc = cache_->front();
   cache_->pop_front();
+  ++metrics_.out;
  }
  return *this;
 }
@@ -523,6 +711,7 @@ CalculateTradingPeriod(PG_FUNCTION_ARGS) {
   Datum frequency = obad::NULL_FREQ;
   if (!PG_ARGISNULL(5)) frequency = PG_GETARG_DATUM(5);
 
+  obadiah::R::PipelineMetrics::Clear();
   SPI_connect();
 
   obadiah::postgres::DepthChangesStream *depth_changes_stream =
@@ -595,6 +784,7 @@ CalculateTradingPeriod(PG_FUNCTION_ARGS) {
 
 Datum
 SetLogLevel(PG_FUNCTION_ARGS) {
+#if OBADIAH_LOGGING
  text *t = PG_GETARG_TEXT_PP(0);
  try {
   logging::core::get()->set_filter(
@@ -605,6 +795,9 @@ SetLogLevel(PG_FUNCTION_ARGS) {
   logging::core::get()->set_filter(severity >
                                    obadiah::R::SeverityLevel::kNotice);
  };
+#else
+ elog(NOTICE, "libobadiah_db was built without tracing (make TRACE=1)");
+#endif
  PG_RETURN_NULL();
 }
 
@@ -660,6 +853,7 @@ GetOrderBookQueues(PG_FUNCTION_ARGS) {
   Datum frequency = obad::NULL_FREQ;
   if (!PG_ARGISNULL(8)) frequency = PG_GETARG_DATUM(8);
 
+  obadiah::R::PipelineMetrics::Clear();
   SPI_connect();
 
   obadiah::postgres::DepthChangesStream *depth_changes_stream =
@@ -699,6 +893,17 @@ GetOrderBookQueues(PG_FUNCTION_ARGS) {
   for (auto v : output.bids) bids.push_back(Float8GetDatum(v));
   asks.reserve(output.asks.size());
   for (auto v : output.asks) asks.push_back(Float8GetDatum(v));
+  // p_sparse: the queues not changed by the episode are NULL
+  bool sparse = PG_NARGS() > 9 && !PG_ARGISNULL(9) && PG_GETARG_BOOL(9);
+  bool *bid_nulls = nullptr, *ask_nulls = nullptr;
+  if (sparse) {
+   bid_nulls = static_cast<bool *>(palloc(bids.size() * sizeof(bool)));
+   std::fill_n(bid_nulls, bids.size(), true);
+   for (auto i : output.changed_bids) bid_nulls[i] = false;
+   ask_nulls = static_cast<bool *>(palloc(asks.size() * sizeof(bool)));
+   std::fill_n(ask_nulls, asks.size(), true);
+   for (auto i : output.changed_asks) ask_nulls[i] = false;
+  }
   get_call_result_type(fcinfo, NULL, &tupdesc);
   tupdesc = BlessTupleDesc(tupdesc);
 
@@ -716,10 +921,22 @@ GetOrderBookQueues(PG_FUNCTION_ARGS) {
       TimestampTzGetDatum(std::lround((output.t.t - 946684800.0) * 1000000));
   values[j++] = Float8GetDatum(output.bid_price);
   values[j++] = Float8GetDatum(output.ask_price);
-  values[j++] = PointerGetDatum(construct_array(
-      bids.data(), bids.size(), FLOAT8OID, typlen, typbyval, typalign));
-  values[j++] = PointerGetDatum(construct_array(
-      asks.data(), asks.size(), FLOAT8OID, typlen, typbyval, typalign));
+  if (sparse) {
+   int dims[1], lbs[1] = {1};
+   dims[0] = bids.size();
+   values[j++] = PointerGetDatum(construct_md_array(
+       bids.data(), bid_nulls, 1, dims, lbs, FLOAT8OID, typlen,
+       typbyval, typalign));
+   dims[0] = asks.size();
+   values[j++] = PointerGetDatum(construct_md_array(
+       asks.data(), ask_nulls, 1, dims, lbs, FLOAT8OID, typlen,
+       typbyval, typalign));
+  } else {
+   values[j++] = PointerGetDatum(construct_array(
+       bids.data(), bids.size(), FLOAT8OID, typlen, typbyval, typalign));
+   values[j++] = PointerGetDatum(construct_array(
+       asks.data(), asks.size(), FLOAT8OID, typlen, typbyval, typalign));
+  }
   HeapTuple tuple = heap_form_tuple(tupdesc, values, nulls);
   SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
  } else {
@@ -733,6 +950,376 @@ GetOrderBookQueues(PG_FUNCTION_ARGS) {
 namespace obadiah {
 namespace postgres {
 
+inline TimestampTz
+ToTimestampTz(obadiah::R::Timestamp t) {
+ return std::lround((t.t - 946684800.0) * 1000000);
+}
+
+// Keeps the summary of the latest episode between the calls of
+// GetDepthSummary(), which returns it one bucket per call
+class DepthToSummary
+    : public obadiah::R::DepthToSummary<obad::spi_allocator>,
+      public obad::postgres_heap {
+public:
+ DepthToSummary(ObjectStream<obadiah::R::Level2> *depth_changes, int bps_step,
+                int max_bps_level, int decimal_places)
+     : obadiah::R::DepthToSummary<obad::spi_allocator>(
+           depth_changes, bps_step, max_bps_level, decimal_places){};
+ ~DepthToSummary() { delete depth_changes_; }
+ // Advances to the next bucket, processing episodes as needed. Returns false
+ // when there are no more episodes
+ bool next() {
+  if (next_level_ < summary_.levels.size()) ++next_level_;
+  while (next_level_ == summary_.levels.size() && *this >> summary_)
+   next_level_ = 0;
+  return next_level_ < summary_.levels.size();
+ }
+ inline const obadiah::R::DepthSummaryLevel &level() const {
+  return summary_.levels[next_level_];
+ }
+ inline obadiah::R::Timestamp timestamp() const { return summary_.t; }
+ inline int decimal_places() const { return decimal_places_; }
+
+private:
+ obadiah::R::DepthSummary<obad::spi_allocator> summary_;
+ std::size_t next_level_ = 0;
+};
+
+}  // namespace postgres
+}  // namespace obadiah
+
+Datum
+GetDepthSummary(PG_FUNCTION_ARGS) {
+ FuncCallContext *funcctx;
+ TupleDesc tupdesc;
+
+ if (SRF_IS_FIRSTCALL()) {
+  MemoryContext oldcontext;
+
+  funcctx = SRF_FIRSTCALL_INIT();
+
+  oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+   ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                   errmsg("function returning record called in context "
+                          "that cannot accept type record")));
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) ||
+      PG_ARGISNULL(3) || PG_ARGISNULL(5) || PG_ARGISNULL(6))
+   ereport(ERROR,
+           (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+            errmsg("p_start_time, p_end_time, pair_id, exchange_id, "
+                   "bps_step, max_bps_level must not be NULL")));
+  if (PG_GETARG_INT32(5) <= 0)
+   ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                   errmsg("p_bps_step must be positive")));
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+  Datum frequency = obad::NULL_FREQ;
+  if (!PG_ARGISNULL(4)) frequency = PG_GETARG_DATUM(4);
+
+  obadiah::R::PipelineMetrics::Clear();
+  SPI_connect();
+
+  // The prices are rounded as in obanalytics._depth_summary()
+  Oid types[1] = {INT4OID};
+  Datum values[1] = {PG_GETARG_DATUM(2)};
+  static SPIPlanPtr plan = nullptr;
+  SPI_execute_plan(
+      obad::kept_plan(
+          plan,
+          R"QUERY(select "R0" from obanalytics.pairs where pair_id = $1)QUERY",
+          1, types),
+      values, NULL, true, 1);
+  int decimal_places = 0;
+  bool is_null = true;
+  if (SPI_processed > 0 && SPI_tuptable != NULL) {
+   Datum r0 = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+                            &is_null);
+   if (!is_null) decimal_places = DatumGetInt16(r0);
+  }
+  if (is_null)
+   ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                   errmsg("pair_id %d has no \"R0\"", PG_GETARG_INT32(2))));
+
+  obadiah::postgres::DepthChangesStream *depth_changes_stream =
+      new (obad::allocation_mode::spi) obadiah::postgres::DepthChangesStream{
+          PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
+          PG_GETARG_DATUM(3), frequency};
+
+  funcctx->user_fctx =
+      new (obad::allocation_mode::spi) obadiah::postgres::DepthToSummary{
+          depth_changes_stream, PG_GETARG_INT32(5), PG_GETARG_INT32(6),
+          decimal_places};
+  SPI_finish();
+
+  MemoryContextSwitchTo(oldcontext);
+ }
+
+ funcctx = SRF_PERCALL_SETUP();
+
+ MemoryContext oldcontext;
+ oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+ obadiah::postgres::DepthToSummary *depth_to_summary =
+     static_cast<obadiah::postgres::DepthToSummary *>(funcctx->user_fctx);
+ SPI_connect();
+
+ if (depth_to_summary->next()) {
+  SPI_finish();
+  MemoryContextSwitchTo(oldcontext);
+  const obadiah::R::DepthSummaryLevel &level = depth_to_summary->level();
+
+  Datum values[5];
+  bool nulls[5];
+  std::memset(nulls, 0, sizeof nulls);
+  values[0] = TimestampTzGetDatum(
+      obadiah::postgres::ToTimestampTz(depth_to_summary->timestamp()));
+  values[1] = obad::numeric_datum(level.p, depth_to_summary->decimal_places());
+  values[2] = obad::numeric_datum(level.v, 8);
+  values[3] = PointerGetDatum(
+      cstring_to_text(level.s == obadiah::R::Side::kAsk ? "ask" : "bid"));
+  values[4] = Int32GetDatum(level.bps_level);
+  HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+ } else {
+  delete depth_to_summary;
+  SPI_finish();
+  MemoryContextSwitchTo(oldcontext);
+  SRF_RETURN_DONE(funcctx);
+ }
+}
+
+namespace obadiah {
+namespace postgres {
+
+// The same columns as get.trading_period()
+inline void
+Encode(obad::binary_copy &copy, const obadiah::R::BidAskSpread &output) {
+ copy.tuple(3);
+ copy.timestamptz(ToTimestampTz(output.t));
+ copy.float8(output.p_bid);
+ copy.float8(output.p_ask);
+}
+
+// The same columns as get.queues() with p_sparse := false
+inline void
+Encode(obad::binary_copy &copy,
+       const obadiah::R::OrderBookQueues<obad::spi_allocator> &output) {
+ copy.tuple(5);
+ copy.timestamptz(ToTimestampTz(output.t));
+ copy.float8(output.bid_price);
+ copy.float8(output.ask_price);
+ copy.float8_array(output.bids.data(), output.bids.size());
+ copy.float8_array(output.asks.data(), output.asks.size());
+}
+
+// Runs a pipeline stage to the end and encodes its outputs in the binary
+// COPY format, so neither a tuple per output nor the whole result is ever
+// materialized
+template <class Stage, class Output>
+class BinaryCopyExport : public obad::postgres_heap {
+public:
+ static constexpr int kChunkSize = 1 << 20;
+
+ explicit BinaryCopyExport(Stage *stage) : stage_{stage}, rows_{0}, done_{false} {
+  copy_.header();
+ };
+ ~BinaryCopyExport() {
+  SPI_connect();
+  delete stage_;
+  SPI_finish();
+ };
+
+ // Encodes outputs until at least size bytes are buffered or the stage is
+ // exhausted. Returns false when there is nothing left to take
+ bool Fill(int size) {
+  if (!done_ && copy_.size() < size) {
+   SPI_connect();
+   {
+    Output output;
+    while (copy_.size() < size) {
+     if (!(*stage_ >> output)) {
+      copy_.trailer();
+      done_ = true;
+      break;
+     }
+     Encode(copy_, output);
+     ++rows_;
+    }
+   }
+   SPI_finish();
+  }
+  return copy_.size() > 0;
+ };
+ obad::binary_copy &Buffer() { return copy_; };
+ int64 Rows() const { return rows_; };
+
+ // Writes everything to a server-side file. Returns the number of rows
+ int64 WriteTo(const char *file_name) {
+  FILE *file = AllocateFile(file_name, PG_BINARY_W);
+  if (!file)
+   ereport(ERROR, (errcode_for_file_access(),
+                   errmsg("could not open file \"%s\" for writing: %m",
+                          file_name)));
+  while (Fill(kChunkSize)) {
+   if (fwrite(copy_.data(), 1, copy_.size(), file) !=
+       static_cast<size_t>(copy_.size()))
+    ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("could not write to file \"%s\": %m", file_name)));
+   copy_.clear();
+  }
+  if (FreeFile(file))
+   ereport(ERROR, (errcode_for_file_access(),
+                   errmsg("could not close file \"%s\": %m", file_name)));
+  return rows_;
+ };
+
+private:
+ Stage *stage_;
+ obad::binary_copy copy_;
+ int64 rows_;
+ bool done_;
+};
+
+using TradingPeriodExport =
+    BinaryCopyExport<TradingPeriod, obadiah::R::BidAskSpread>;
+using QueuesExport =
+    BinaryCopyExport<DepthToQueues,
+                     obadiah::R::OrderBookQueues<obad::spi_allocator>>;
+
+// Arguments shared by get.trading_period() and the export functions
+TradingPeriodExport *
+NewTradingPeriodExport(FunctionCallInfo fcinfo, int frequency_arg) {
+ for (int i = 0; i < 5; ++i)
+  if (PG_ARGISNULL(i))
+   ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                   errmsg("p_start_time, p_end_time, pair_id, exchange_id, "
+                          "p_volume must not be NULL")));
+ Datum frequency = obad::NULL_FREQ;
+ if (!PG_ARGISNULL(frequency_arg)) frequency = PG_GETARG_DATUM(frequency_arg);
+
+ obadiah::R::PipelineMetrics::Clear();
+ SPI_connect();
+ DepthChangesStream *depth_changes_stream =
+     new (obad::allocation_mode::spi) DepthChangesStream{
+         PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
+         PG_GETARG_DATUM(3), frequency};
+ TradingPeriod *trading_period = new (obad::allocation_mode::spi)
+     TradingPeriod{depth_changes_stream, PG_GETARG_FLOAT8(4)};
+ SPI_finish();
+ return new (obad::allocation_mode::non_spi)
+     TradingPeriodExport{trading_period};
+}
+
+// Arguments shared by get.queues() and the export functions
+QueuesExport *
+NewQueuesExport(FunctionCallInfo fcinfo, int frequency_arg) {
+ for (int i = 0; i < 8; ++i)
+  if (PG_ARGISNULL(i))
+   ereport(ERROR,
+           (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+            errmsg("p_start_time, p_end_time, pair_id, exchange_id, tick_size, "
+                   "first_tick, last_tick, tick_type must not be NULL")));
+ Datum frequency = obad::NULL_FREQ;
+ if (!PG_ARGISNULL(frequency_arg)) frequency = PG_GETARG_DATUM(frequency_arg);
+
+ obadiah::R::PipelineMetrics::Clear();
+ SPI_connect();
+ DepthChangesStream *depth_changes_stream =
+     new (obad::allocation_mode::spi) DepthChangesStream{
+         PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
+         PG_GETARG_DATUM(3), frequency};
+ DepthToQueues *depth_to_queues = new (obad::allocation_mode::spi)
+     DepthToQueues{depth_changes_stream, PG_GETARG_FLOAT8(4),
+                   PG_GETARG_INT32(5), PG_GETARG_INT32(6),
+                   std::string{VARDATA_ANY(PG_GETARG_TEXT_PP(7)),
+                               VARSIZE_ANY_EXHDR(PG_GETARG_TEXT_PP(7))}};
+ SPI_finish();
+ return new (obad::allocation_mode::non_spi) QueuesExport{depth_to_queues};
+}
+
+// Returns the binary COPY data in chunks of about kChunkSize bytes
+template <class Export>
+Datum
+ExportChunks(FunctionCallInfo fcinfo,
+             Export *(*new_export)(FunctionCallInfo, int), int frequency_arg) {
+ FuncCallContext *funcctx;
+ if (SRF_IS_FIRSTCALL()) {
+  funcctx = SRF_FIRSTCALL_INIT();
+  MemoryContext oldcontext =
+      MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+  funcctx->user_fctx = new_export(fcinfo, frequency_arg);
+  MemoryContextSwitchTo(oldcontext);
+ }
+ funcctx = SRF_PERCALL_SETUP();
+ MemoryContext oldcontext =
+     MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+ Export *e = static_cast<Export *>(funcctx->user_fctx);
+ if (e->Fill(Export::kChunkSize)) {
+  MemoryContextSwitchTo(oldcontext);
+  obad::binary_copy &copy = e->Buffer();
+  bytea *chunk = static_cast<bytea *>(palloc(VARHDRSZ + copy.size()));
+  SET_VARSIZE(chunk, VARHDRSZ + copy.size());
+  std::memcpy(VARDATA(chunk), copy.data(), copy.size());
+  copy.clear();
+  SRF_RETURN_NEXT(funcctx, PointerGetDatum(chunk));
+ } else {
+  delete e;
+  MemoryContextSwitchTo(oldcontext);
+  SRF_RETURN_DONE(funcctx);
+ }
+}
+
+// Writes the binary COPY data to the file given by the argument file_arg
+template <class Export>
+Datum
+ExportToFile(FunctionCallInfo fcinfo,
+             Export *(*new_export)(FunctionCallInfo, int), int file_arg,
+             int frequency_arg) {
+ if (!superuser())
+  ereport(ERROR,
+          (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+           errmsg("must be superuser to export to a server-side file")));
+ if (PG_ARGISNULL(file_arg))
+  ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                  errmsg("p_file must not be NULL")));
+ char *file_name = text_to_cstring(PG_GETARG_TEXT_PP(file_arg));
+ Export *e = new_export(fcinfo, frequency_arg);
+ int64 rows = e->WriteTo(file_name);
+ delete e;
+ PG_RETURN_INT64(rows);
+}
+
+}  // namespace postgres
+}  // namespace obadiah
+
+Datum
+ExportTradingPeriod(PG_FUNCTION_ARGS) {
+ return obadiah::postgres::ExportChunks(
+     fcinfo, obadiah::postgres::NewTradingPeriodExport, 5);
+}
+
+Datum
+ExportTradingPeriodToFile(PG_FUNCTION_ARGS) {
+ return obadiah::postgres::ExportToFile(
+     fcinfo, obadiah::postgres::NewTradingPeriodExport, 5, 6);
+}
+
+Datum
+ExportOrderBookQueues(PG_FUNCTION_ARGS) {
+ return obadiah::postgres::ExportChunks(
+     fcinfo, obadiah::postgres::NewQueuesExport, 8);
+}
+
+Datum
+ExportOrderBookQueuesToFile(PG_FUNCTION_ARGS) {
+ return obadiah::postgres::ExportToFile(
+     fcinfo, obadiah::postgres::NewQueuesExport, 8, 9);
+}
+
+namespace obadiah {
+namespace postgres {
+
 class TradingStrategy : public obadiah::R::TradingStrategy,
                         public obad::postgres_heap {
 public:
@@ -744,6 +1331,49 @@ public:
  ~TradingStrategy() { delete trading_period_; }
 };
 
+class MidPrices : public obadiah::R::MidPrices, public obad::postgres_heap {
+public:
+ explicit MidPrices(
+     obadiah::R::ObjectStream<obadiah::R::BidAskSpread> *trading_period)
+     : obadiah::R::MidPrices{trading_period} {};
+
+ ~MidPrices() { delete spreads_; }
+};
+
+class EpsilonDrawUpDowns : public obadiah::R::EpsilonDrawUpDowns,
+                           public obad::postgres_heap {
+public:
+ EpsilonDrawUpDowns(obadiah::R::ObjectStream<obadiah::R::InstantPrice> *prices,
+                    double epsilon)
+     : obadiah::R::EpsilonDrawUpDowns{prices, epsilon} {};
+
+ ~EpsilonDrawUpDowns() { delete trading_period_; }
+};
+
+// The same columns as get.trading_strategy()
+HeapTuple
+ToHeapTuple(TupleDesc tupdesc, obadiah::R::Position &output) {
+ Datum values[7];
+ bool nulls[7];
+ int j = 0;
+ std::memset(nulls, 0, sizeof nulls);
+ values[j++] = TimestampTzGetDatum(ToTimestampTz(output.s.t));
+ values[j++] = Float8GetDatum(output.s.p);
+ values[j++] = TimestampTzGetDatum(ToTimestampTz(output.e.t));
+ values[j++] = Float8GetDatum(output.e.p);
+ values[j++] = Float8GetDatum(
+     output.s.p > output.e.p ? (output.s.p - output.e.p) / output.s.p * 10000
+                             : (output.e.p - output.s.p) / output.s.p * 10000);
+ double log_return = output.s.p > output.e.p
+                         ? std::log(output.s.p) - std::log(output.e.p)
+                         : std::log(output.e.p) - std::log(output.s.p);
+ values[j++] =
+     Float8GetDatum(std::exp(log_return / (output.e.t - output.s.t)) - 1);
+ values[j++] = Float8GetDatum(log_return);
+
+ return heap_form_tuple(tupdesc, values, nulls);
+}
+
 }  // namespace postgres
 }  // namespace obadiah
 
@@ -775,6 +1405,7 @@ DiscoverPositions(PG_FUNCTION_ARGS) {
   Datum frequency = obad::NULL_FREQ;
   if (!PG_ARGISNULL(7)) frequency = PG_GETARG_DATUM(7);
 
+  obadiah::R::PipelineMetrics::Clear();
   SPI_connect();
 
   obadiah::postgres::DepthChangesStream *depth_changes_stream =
@@ -811,27 +1442,7 @@ DiscoverPositions(PG_FUNCTION_ARGS) {
   get_call_result_type(fcinfo, NULL, &tupdesc);
   tupdesc = BlessTupleDesc(tupdesc);
 
-  Datum values[7];
-  bool nulls[7];
-  int j = 0;
-  std::memset(nulls, 0, sizeof nulls);
-  values[j++] =
-      TimestampTzGetDatum(std::lround((output.s.t.t - 946684800.0) * 1000000));
-  values[j++] = Float8GetDatum(output.s.p);
-  values[j++] =
-      TimestampTzGetDatum(std::lround((output.e.t.t - 946684800.0) * 1000000));
-  values[j++] = Float8GetDatum(output.e.p);
-  values[j++] = Float8GetDatum(
-      output.s.p > output.e.p ? (output.s.p - output.e.p) / output.s.p * 10000
-                              : (output.e.p - output.s.p) / output.s.p * 10000);
-  double log_return = output.s.p > output.e.p
-                          ? std::log(output.s.p) - std::log(output.e.p)
-                          : std::log(output.e.p) - std::log(output.s.p);
-  values[j++] =
-      Float8GetDatum(std::exp(log_return / (output.e.t - output.s.t)) - 1);
-  values[j++] = Float8GetDatum(log_return);
-
-  HeapTuple tuple = heap_form_tuple(tupdesc, values, nulls);
+  HeapTuple tuple = obadiah::postgres::ToHeapTuple(tupdesc, output);
   SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
  } else {
   delete trading_strategy;
@@ -841,3 +1452,120 @@ DiscoverPositions(PG_FUNCTION_ARGS) {
  }
 }
 
+// DepthChangesStream -> TradingPeriod -> MidPrices -> EpsilonDrawUpDowns, so
+// that only the draw-ups and draw-downs leave the server
+Datum
+DiscoverDrawUpDowns(PG_FUNCTION_ARGS) {
+ FuncCallContext *funcctx;
+ TupleDesc tupdesc;
+
+ if (SRF_IS_FIRSTCALL()) {
+  MemoryContext oldcontext;
+
+  funcctx = SRF_FIRSTCALL_INIT();
+
+  oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+   ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                   errmsg("function returning record called in context "
+                          "that cannot accept type record")));
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) ||
+      PG_ARGISNULL(3) || PG_ARGISNULL(4) || PG_ARGISNULL(5))
+   ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                   errmsg("p_start_time, p_end_time, pair_id, exchange_id, "
+                          "volume, epsilon must not be NULL")));
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+  Datum frequency = obad::NULL_FREQ;
+  if (!PG_ARGISNULL(6)) frequency = PG_GETARG_DATUM(6);
+
+  obadiah::R::PipelineMetrics::Clear();
+  SPI_connect();
+
+  obadiah::postgres::DepthChangesStream *depth_changes_stream =
+      new (obad::allocation_mode::spi) obadiah::postgres::DepthChangesStream{
+          PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), PG_GETARG_DATUM(2),
+          PG_GETARG_DATUM(3), frequency};
+
+  obadiah::postgres::TradingPeriod *trading_period =
+      new (obad::allocation_mode::spi) obadiah::postgres::TradingPeriod{
+          depth_changes_stream, PG_GETARG_FLOAT8(4)};
+
+  obadiah::postgres::MidPrices *mid_prices =
+      new (obad::allocation_mode::spi)
+          obadiah::postgres::MidPrices{trading_period};
+
+  obadiah::postgres::EpsilonDrawUpDowns *drawupdowns =
+      new (obad::allocation_mode::spi) obadiah::postgres::EpsilonDrawUpDowns{
+          mid_prices, PG_GETARG_FLOAT8(5)};
+  funcctx->user_fctx = drawupdowns;
+  SPI_finish();
+
+  MemoryContextSwitchTo(oldcontext);
+ }
+
+ funcctx = SRF_PERCALL_SETUP();
+
+ MemoryContext oldcontext;
+ oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+ obadiah::postgres::EpsilonDrawUpDowns *drawupdowns =
+     static_cast<obadiah::postgres::EpsilonDrawUpDowns *>(funcctx->user_fctx);
+ obadiah::R::Position output;
+ SPI_connect();
+
+ if (*drawupdowns >> output) {
+  SPI_finish();
+  MemoryContextSwitchTo(oldcontext);
+  HeapTuple tuple =
+      obadiah::postgres::ToHeapTuple(funcctx->tuple_desc, output);
+  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+ } else {
+  delete drawupdowns;
+  SPI_finish();
+  MemoryContextSwitchTo(oldcontext);
+  SRF_RETURN_DONE(funcctx);
+ }
+}
+
+Datum
+GetStageMetrics(PG_FUNCTION_ARGS) {
+ FuncCallContext *funcctx;
+ TupleDesc tupdesc;
+
+ if (SRF_IS_FIRSTCALL()) {
+  funcctx = SRF_FIRSTCALL_INIT();
+  MemoryContext oldcontext =
+      MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+   ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                   errmsg("function returning record called in context "
+                          "that cannot accept type record")));
+  funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+  funcctx->max_calls = obadiah::R::PipelineMetrics::Get().size();
+  MemoryContextSwitchTo(oldcontext);
+ }
+
+ funcctx = SRF_PERCALL_SETUP();
+ // Metrics are reported by the stages of the latest C++ pipeline run in this
+ // backend, i.e. the latest call of a function which clears PipelineMetrics
+ const auto &stages = obadiah::R::PipelineMetrics::Get();
+ if (funcctx->call_cntr < funcctx->max_calls &&
+     funcctx->call_cntr < stages.size()) {
+  const obadiah::R::StageMetrics &m = stages[funcctx->call_cntr];
+  Datum values[7];
+  bool nulls[7];
+  int j = 0;
+  std::memset(nulls, 0, sizeof nulls);
+  values[j++] = CStringGetTextDatum(m.stage);
+  values[j++] = Int64GetDatum(m.in);
+  values[j++] = Int64GetDatum(m.out);
+  values[j++] = Int64GetDatum(m.episodes);
+  values[j++] = Int64GetDatum(m.max_book_size);
+  values[j++] = Int64GetDatum(m.refills);
+  values[j++] = Float8GetDatum(m.Seconds());
+  HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+ } else
+  SRF_RETURN_DONE(funcctx);
+}
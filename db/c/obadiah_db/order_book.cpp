@@ -25,8 +25,12 @@ public:
  void update(level3 &&);
  // returns all level2s changed since the latest clean_touched()
  void clean_touched(obad::deque<level2> *);
+ // -1 if there is no level with a positive volume
+ price best_price{-1};
+ amount best_volume{-1};
 
 private:
+ void update_best();
  inline amount get_price_level_volume(const price p) const {
   amount volume = 0;
   try {
@@ -39,14 +43,16 @@ private:
   return volume;
  };
 
- obad::map<price, level2> touched;
+ // the volume of each touched price level before the episode
+ obad::map<price, amount> touched;
+ TimestampTz touched_episode;
 
  char side;
  obad::map<uint64, level3> by_order_id;
  obad::map<price, obad::unordered_set<level3 *>> by_price;
 };
 
-order_book::order_book() {
+order_book::order_book() : episode{0} {
  bids = new (allocation_mode::non_spi) order_book::order_book_side{'b'};
  asks = new (allocation_mode::non_spi) order_book::order_book_side{'s'};
 };
@@ -61,19 +67,18 @@ order_book::order_book_side::clean_touched(obad::deque<level2> *output) {
 #if DEBUG_DEPTH
  elog(DEBUG3, "%s starts side %c", __PRETTY_FUNCTION__, side);
 #endif
+ update_best();
  if (output) {
   for (auto &pl : touched) {
-   level2 &l2 = pl.second;
-   price p = l2.get_price();
+   price p = pl.first;
    amount current = get_price_level_volume(p);
 #if DEBUG_DEPTH
    elog(DEBUG4, "%s processing price: %.5Lf. volume before: %.8Lf after: %.8Lf",
-        __PRETTY_FUNCTION__, p, l2.get_volume(), current);
+        __PRETTY_FUNCTION__, p, pl.second, current);
 #endif
-   if (std::fabs(current - l2.get_volume()) >
+   if (std::fabs(current - pl.second) >
        10*std::numeric_limits<amount>::epsilon()) {
-    l2.set_volume(current);
-    output->push_back(std::move(l2));
+    output->push_back(level2{touched_episode, side, p, current});
    }
 #if DEBUG_DEPTH
    elog(DEBUG3, "%s side %c output size %lu after processing price %.5Lf",
@@ -87,6 +92,36 @@ order_book::order_book_side::clean_touched(obad::deque<level2> *output) {
 #endif
 };
 
+void
+order_book::order_book_side::update_best() {
+ if (touched.empty()) return;
+ // touched is ordered by price, so its best price is at one of its ends
+ if (best_price >= 0 && (side == 'b' ? touched.rbegin()->first < best_price
+                                      : touched.begin()->first > best_price))
+  return;
+ best_price = -1;
+ best_volume = -1;
+ auto set_best = [this](price p) {
+  amount volume = get_price_level_volume(p);
+  if (volume > 0) {
+   best_price = p;
+   best_volume = volume;
+  }
+  return volume > 0;
+ };
+ if (side == 'b') {
+  for (auto it = by_price.crbegin(); it != by_price.crend(); ++it)
+   if (set_best(it->first)) break;
+ } else {
+  for (auto it = by_price.cbegin(); it != by_price.cend(); ++it)
+   if (set_best(it->first)) break;
+ }
+#if DEBUG_DEPTH
+ elog(DEBUG3, "%s side %c best price %.5Lf volume %.8Lf", __PRETTY_FUNCTION__,
+      side, best_price, best_volume);
+#endif
+}
+
 void
 order_book::order_book_side::update(level3 &&l3) {
 #if DEBUG_DEPTH
@@ -109,16 +144,15 @@ order_book::order_book_side::update(level3 &&l3) {
 
  for (int i = 0; i < num_of_changed; i++) {
   price p = changed_prices[i];
-  try {
-   touched.at(p);
+  if (touched.count(p)) {
 #if DEBUG_DEPTH
    elog(DEBUG3, "%s side %c price %.5Lf is already saved", __PRETTY_FUNCTION__,
         side, p);
 #endif
-  } catch (const std::out_of_range &oor) {
+  } else {
    amount volume = get_price_level_volume(p);
-   level2 l2{l3.get_episode(), side, p, volume};
-   touched[p] = std::move(l2);
+   touched.emplace(p, volume);
+   touched_episode = l3.get_episode();
 #if DEBUG_DEPTH
    elog(DEBUG3, "%s side %c price %.5Lf is saved with volume %.8Lf",
         __PRETTY_FUNCTION__, side, p, volume);
@@ -166,9 +200,16 @@ order_book::update(std::vector<level3> &&v, obad::deque<level2> *result) {
 #if DEBUG_DEPTH
  elog(DEBUG2, "%s with %lu level3 records", __PRETTY_FUNCTION__, v.size());
 #endif
+ if (!v.empty()) episode = v.front().get_episode();
  for (level3 &l3 : v) by_side(l3.get_side())->update(std::move(l3));
 
  bids->clean_touched(result);
  asks->clean_touched(result);
 };
+
+level1
+order_book::spread() const {
+ return level1{bids->best_price, bids->best_volume, asks->best_price,
+               asks->best_volume, episode};
+}
 }  // namespace obad
@@ -20,6 +20,7 @@
 #include <map>
 #include <set>
 #include <vector>
+#include "level1.h"
 #include "level2.h"
 #include "level3.h"
 #include "spi_allocator.h"
@@ -31,6 +32,10 @@ public:
  order_book();
  ~order_book();
  void update(std::vector<level3> &&, obad::deque<level2> *);
+ // The best levels after the latest update(). They are recomputed only when
+ // the episode touched a price at or better than the best one, so this is
+ // cheap enough to be called after every episode.
+ level1 spread() const;
 
 private:
  class order_book_side;
@@ -40,6 +45,7 @@ private:
 
  order_book_side *bids;
  order_book_side *asks;
+ TimestampTz episode;
 };
 }  // namespace obad
 #endif
@@ -0,0 +1,400 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// C versions of bitfinex._diff_order_books() and bitfinex._update_order_book()
+// (see bitfinex_schema.sql). The order books are arrays of
+// bitfinex.transient_raw_book_events; here they are joined by order_id via a
+// hash table instead of the full joins of the SQL versions.
+
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "postgres.h"
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "access/htup_details.h"
+#include "catalog/pg_type_d.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/numeric.h"
+#include "utils/typcache.h"
+
+PG_FUNCTION_INFO_V1(diff_order_books);
+PG_FUNCTION_INFO_V1(update_order_book);
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#include <algorithm>
+
+#include "spi_allocator.h"
+
+namespace obad {
+namespace {
+
+enum column {
+ kExchangeTimestamp,
+ kOrderId,
+ kPrice,
+ kAmount,
+ kPairId,
+ kLocalTimestamp,
+ kChannelId,
+ kEpisodeTimestamp,
+ kEventNo,
+ kBl,
+ kColumns
+};
+
+const char *const kColumnNames[kColumns] = {
+    "exchange_timestamp", "order_id",          "price",    "amount",
+    "pair_id",            "local_timestamp",   "channel_id",
+    "episode_timestamp",  "event_no",          "bl"};
+
+struct raw_book_event {
+ Datum values[kColumns];
+ bool nulls[kColumns];
+ bool is_joined = false;
+};
+
+using raw_book = obad::vector<raw_book_event>;
+
+// The layout of bitfinex.transient_raw_book_events
+class raw_book_type {
+public:
+ explicit raw_book_type(FunctionCallInfo fcinfo) {
+  array_type_ = get_fn_expr_rettype(fcinfo->flinfo);
+  if (!OidIsValid(array_type_))
+   array_type_ = get_fn_expr_argtype(fcinfo->flinfo, 0);
+  element_type_ = get_element_type(array_type_);
+  if (!OidIsValid(element_type_))
+   ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                   errmsg("the function must return an array")));
+  tupdesc_ = lookup_rowtype_tupdesc_copy(element_type_, -1);
+  for (int c = 0; c < kColumns; ++c) {
+   attnums_[c] = -1;
+   for (int i = 0; i < tupdesc_->natts; ++i)
+    if (!TupleDescAttr(tupdesc_, i)->attisdropped &&
+        strcmp(NameStr(TupleDescAttr(tupdesc_, i)->attname),
+               kColumnNames[c]) == 0)
+     attnums_[c] = i;
+   if (attnums_[c] < 0 && c != kBl)  // bl is not used by the SQL versions
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+                    errmsg("column \"%s\" does not exist", kColumnNames[c])));
+  }
+ }
+
+ raw_book load(FunctionCallInfo fcinfo, int arg) const {
+  raw_book book;
+  if (PG_ARGISNULL(arg)) return book;
+  Datum *elements;
+  bool *element_nulls;
+  int n;
+  deconstruct_array(PG_GETARG_ARRAYTYPE_P(arg), element_type_, -1, false, 'd',
+                    &elements, &element_nulls, &n);
+  book.reserve(n);
+  Datum *values = static_cast<Datum *>(palloc(tupdesc_->natts * sizeof(Datum)));
+  bool *nulls = static_cast<bool *>(palloc(tupdesc_->natts * sizeof(bool)));
+  for (int i = 0; i < n; ++i) {
+   raw_book_event event;
+   if (element_nulls[i]) {  // unnest() produces a row of NULLs
+    for (int c = 0; c < kColumns; ++c) event.nulls[c] = true;
+   } else {
+    HeapTupleHeader header = DatumGetHeapTupleHeader(elements[i]);
+    HeapTupleData tuple;
+    tuple.t_len = HeapTupleHeaderGetDatumLength(header);
+    ItemPointerSetInvalid(&(tuple.t_self));
+    tuple.t_tableOid = InvalidOid;
+    tuple.t_data = header;
+    heap_deform_tuple(&tuple, tupdesc_, values, nulls);
+    for (int c = 0; c < kColumns; ++c) {
+     event.values[c] = attnums_[c] < 0 ? 0 : values[attnums_[c]];
+     event.nulls[c] = attnums_[c] < 0 ? true : nulls[attnums_[c]];
+    }
+   }
+   book.push_back(event);
+  }
+  return book;
+ }
+
+ // Returns NULL for an empty book, as array_agg() does
+ Datum result(const raw_book &book, FunctionCallInfo fcinfo) const {
+  if (book.empty()) PG_RETURN_NULL();
+  Datum *elements = static_cast<Datum *>(palloc(book.size() * sizeof(Datum)));
+  Datum *values = static_cast<Datum *>(palloc(tupdesc_->natts * sizeof(Datum)));
+  bool *nulls = static_cast<bool *>(palloc(tupdesc_->natts * sizeof(bool)));
+  for (std::size_t i = 0; i < book.size(); ++i) {
+   for (int a = 0; a < tupdesc_->natts; ++a) {
+    values[a] = 0;
+    nulls[a] = true;
+   }
+   for (int c = 0; c < kColumns; ++c)
+    if (attnums_[c] >= 0) {
+     values[attnums_[c]] = book[i].values[c];
+     nulls[attnums_[c]] = book[i].nulls[c];
+    }
+   elements[i] = HeapTupleGetDatum(heap_form_tuple(tupdesc_, values, nulls));
+  }
+  PG_RETURN_ARRAYTYPE_P(construct_array(elements, book.size(), element_type_,
+                                        -1, false, 'd'));
+ }
+
+private:
+ Oid array_type_;
+ Oid element_type_;
+ TupleDesc tupdesc_;
+ int attnums_[kColumns];
+};
+
+int
+compare(Datum a, Datum b) {
+ return DatumGetInt32(DirectFunctionCall2(numeric_cmp, a, b));
+}
+
+int
+sign(Datum a) {
+ static Datum zero = 0;
+ if (!zero) {
+  MemoryContext old = MemoryContextSwitchTo(TopMemoryContext);
+  zero = DirectFunctionCall1(int4_numeric, Int32GetDatum(0));
+  MemoryContextSwitchTo(old);
+ }
+ return compare(a, zero);
+}
+
+// order_id -> positions in a book. Events with NULL order_id never join
+using book_index = obad::unordered_map<int64, obad::vector<std::size_t>>;
+
+book_index
+index(const raw_book &book) {
+ book_index idx;
+ idx.reserve(book.size());
+ for (std::size_t i = 0; i < book.size(); ++i)
+  if (!book[i].nulls[kOrderId])
+   idx[DatumGetInt64(book[i].values[kOrderId])].push_back(i);
+ return idx;
+}
+
+// A scalar subquery over the distinct values of the given columns of book:
+// it is evaluated on the first use and fails if there are several values
+class scalar_subquery {
+public:
+ scalar_subquery(const raw_book &book, std::initializer_list<column> columns)
+     : book_(book), columns_(columns){};
+
+ const raw_book_event *get() {
+  if (!is_evaluated_) {
+   is_evaluated_ = true;
+   for (const raw_book_event &event : book_) {
+    if (!value_) {
+     value_ = &event;
+    } else if (!is_equal(*value_, event)) {
+     ereport(ERROR,
+             (errcode(ERRCODE_CARDINALITY_VIOLATION),
+              errmsg("more than one row returned by a subquery used as an "
+                     "expression")));
+    }
+   }
+  }
+  return value_;
+ }
+
+ // The value of the column or NULL if the subquery returns no rows
+ Datum value(column c, bool &is_null) {
+  const raw_book_event *row = get();
+  is_null = !row || row->nulls[c];
+  return row ? row->values[c] : 0;
+ }
+
+private:
+ bool is_equal(const raw_book_event &a, const raw_book_event &b) const {
+  for (column c : columns_) {
+   if (a.nulls[c] != b.nulls[c]) return false;
+   // timestamptz and integer columns only
+   if (!a.nulls[c] && a.values[c] != b.values[c]) return false;
+  }
+  return true;
+ }
+ const raw_book &book_;
+ obad::vector<column> columns_;
+ bool is_evaluated_ = false;
+ const raw_book_event *value_ = nullptr;
+};
+
+void
+coalesce(raw_book_event &to, const raw_book_event *first,
+         const raw_book_event *second, column c) {
+ if (first && !first->nulls[c]) {
+  to.values[c] = first->values[c];
+  to.nulls[c] = false;
+ } else if (second && !second->nulls[c]) {
+  to.values[c] = second->values[c];
+  to.nulls[c] = false;
+ } else {
+  to.nulls[c] = true;
+ }
+}
+
+}  // namespace
+}  // namespace obad
+
+// bitfinex._diff_order_books(p_order_book_before, p_order_book_after):
+// the events which turn the first order book into the second one
+Datum
+diff_order_books(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ raw_book_type type(fcinfo);
+ raw_book before = type.load(fcinfo, 0);
+ raw_book after = type.load(fcinfo, 1);
+ book_index before_index = index(before);
+ scalar_subquery ts(after, {kEpisodeTimestamp, kChannelId});
+
+ raw_book diff;
+ auto add = [&](const raw_book_event *a, const raw_book_event *b) {
+  // The full join's condition
+  bool a_price = a && !a->nulls[kPrice], b_price = b && !b->nulls[kPrice];
+  bool a_amount = a && !a->nulls[kAmount], b_amount = b && !b->nulls[kAmount];
+  if (!((a_price && b_price &&
+         compare(a->values[kPrice], b->values[kPrice]) != 0) ||
+        (a_amount && b_amount &&
+         compare(a->values[kAmount], b->values[kAmount]) != 0) ||
+        (!a_price && b_price && sign(b->values[kPrice]) > 0) ||
+        (a_price && sign(a->values[kPrice]) > 0 && !b_price)))
+   return;
+  raw_book_event e;
+  bool is_null;
+  coalesce(e, a, nullptr, kExchangeTimestamp);
+  if (e.nulls[kExchangeTimestamp]) {
+   e.values[kExchangeTimestamp] = ts.value(kEpisodeTimestamp, is_null);
+   e.nulls[kExchangeTimestamp] = is_null;
+  }
+  coalesce(e, a, b, kOrderId);
+  if (a_price) {
+   e.values[kPrice] = a->values[kPrice];
+  } else {
+   e.values[kPrice] = DirectFunctionCall1(int4_numeric, Int32GetDatum(0));
+  }
+  e.nulls[kPrice] = false;
+  if (a_amount) {
+   e.values[kAmount] = a->values[kAmount];
+   e.nulls[kAmount] = false;
+  } else {
+   int s = b_amount ? sign(b->values[kAmount]) : 0;
+   e.values[kAmount] = DirectFunctionCall1(int4_numeric, Int32GetDatum(s));
+   e.nulls[kAmount] = s == 0;
+  }
+  coalesce(e, a, b, kPairId);
+  coalesce(e, a, nullptr, kLocalTimestamp);
+  coalesce(e, a, nullptr, kChannelId);
+  if (e.nulls[kChannelId]) {
+   e.values[kChannelId] = ts.value(kChannelId, is_null);
+   e.nulls[kChannelId] = is_null;
+  }
+  coalesce(e, a, nullptr, kEpisodeTimestamp);
+  if (e.nulls[kEpisodeTimestamp]) {
+   e.values[kEpisodeTimestamp] = ts.value(kEpisodeTimestamp, is_null);
+   e.nulls[kEpisodeTimestamp] = is_null;
+  }
+  coalesce(e, a, nullptr, kEventNo);
+  e.values[kBl] = Int32GetDatum(0);
+  e.nulls[kBl] = false;
+  diff.push_back(e);
+ };
+
+ for (raw_book_event &a : after) {
+  auto found = a.nulls[kOrderId]
+                   ? before_index.end()
+                   : before_index.find(DatumGetInt64(a.values[kOrderId]));
+  if (found == before_index.end()) {
+   add(&a, nullptr);
+  } else {
+   for (std::size_t b : found->second) {
+    before[b].is_joined = true;
+    add(&a, &before[b]);
+   }
+  }
+ }
+ for (const raw_book_event &b : before)
+  if (!b.is_joined) add(nullptr, &b);
+
+ // order by order_id (nulls last)
+ std::stable_sort(diff.begin(), diff.end(),
+                  [](const raw_book_event &x, const raw_book_event &y) {
+                   if (x.nulls[kOrderId] || y.nulls[kOrderId])
+                    return !x.nulls[kOrderId] && y.nulls[kOrderId];
+                   return DatumGetInt64(x.values[kOrderId]) <
+                          DatumGetInt64(y.values[kOrderId]);
+                  });
+ return type.result(diff, fcinfo);
+}
+
+// bitfinex._update_order_book(p_order_book, p_update): the order book after
+// the update
+Datum
+update_order_book(PG_FUNCTION_ARGS) {
+ using namespace obad;
+ raw_book_type type(fcinfo);
+ raw_book update = type.load(fcinfo, 1);
+ raw_book order_book;
+ for (const raw_book_event &e : type.load(fcinfo, 0))
+  if (!e.nulls[kPrice] && sign(e.values[kPrice]) > 0) order_book.push_back(e);
+ book_index order_book_index = index(order_book);
+ scalar_subquery episode_timestamp(update, {kEpisodeTimestamp});
+
+ raw_book result;
+ result.reserve(order_book.size() + update.size());
+ auto add = [&](const raw_book_event *u, const raw_book_event *ob) {
+  raw_book_event e;
+  for (column c : {kExchangeTimestamp, kOrderId, kPrice, kAmount, kPairId,
+                   kLocalTimestamp, kChannelId})
+   coalesce(e, u, ob, c);
+  coalesce(e, u, nullptr, kEpisodeTimestamp);
+  if (e.nulls[kEpisodeTimestamp]) {
+   bool is_null;
+   e.values[kEpisodeTimestamp] =
+       episode_timestamp.value(kEpisodeTimestamp, is_null);
+   e.nulls[kEpisodeTimestamp] = is_null;
+  }
+  coalesce(e, u, nullptr, kEventNo);
+  e.nulls[kBl] = true;
+  result.push_back(e);
+ };
+
+ for (const raw_book_event &u : update) {
+  auto found = u.nulls[kOrderId]
+                   ? order_book_index.end()
+                   : order_book_index.find(DatumGetInt64(u.values[kOrderId]));
+  if (found == order_book_index.end()) {
+   add(&u, nullptr);
+  } else {
+   for (std::size_t ob : found->second) {
+    order_book[ob].is_joined = true;
+    add(&u, &order_book[ob]);
+   }
+  }
+ }
+ for (const raw_book_event &ob : order_book)
+  if (!ob.is_joined) add(nullptr, &ob);
+ return type.result(result, fcinfo);
+}
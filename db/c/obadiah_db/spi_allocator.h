@@ -30,6 +30,7 @@ extern "C" {
 #include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -197,6 +198,10 @@ using set = std::set<Key, Compare, p_allocator<Key>>;
 template <class Key, class Hash = std::hash<Key>,
           class KeyEqual = std::equal_to<Key>>
 using unordered_set = std::unordered_set<Key, Hash, KeyEqual, p_allocator<Key>>;
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+using unordered_map = std::unordered_map<Key, T, Hash, KeyEqual,
+                                         p_allocator<std::pair<const Key, T>>>;
 
 }  // namespace obad
 
@@ -0,0 +1,78 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "spi_plan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+namespace obad {
+
+int plan_mode = 0;
+
+const struct config_enum_entry plan_mode_options[] = {
+    {"auto", 0, false},
+    {"force_generic_plan", CURSOR_OPT_GENERIC_PLAN, false},
+    {"force_custom_plan", CURSOR_OPT_CUSTOM_PLAN, false},
+    {NULL, 0, false}};
+
+SPIPlanPtr
+kept_plan(SPIPlanPtr &plan, const char *query, int nargs, Oid *types) {
+ if (!plan) {
+  SPIPlanPtr prepared = SPI_prepare(query, nargs, types);
+  if (!prepared)
+   elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+  SPI_keepplan(prepared);
+  plan = prepared;
+ }
+ return plan;
+}
+
+SPIPlanPtr
+kept_plan(cached_plan &plan, const char *query, int nargs, Oid *types) {
+ if (plan.plan && plan.mode != plan_mode) {
+  SPI_freeplan(plan.plan);
+  plan.plan = nullptr;
+ }
+ if (!plan.plan) {
+  SPIPlanPtr prepared = SPI_prepare_cursor(query, nargs, types, plan_mode);
+  if (!prepared)
+   elog(ERROR, "SPI_prepare_cursor failed: %s",
+        SPI_result_code_string(SPI_result));
+  SPI_keepplan(prepared);
+  plan.plan = prepared;
+  plan.mode = plan_mode;
+ }
+ return plan.plan;
+}
+
+Datum
+make_array(Datum *values, bool *nulls, int n, Oid type) {
+ int16 typlen;
+ bool typbyval;
+ char typalign;
+ get_typlenbyvalalign(type, &typlen, &typbyval, &typalign);
+ int lbs = 1;
+ return PointerGetDatum(construct_md_array(values, nulls, 1, &n, &lbs, type,
+                                           typlen, typbyval, typalign));
+}
+
+}  // namespace obad
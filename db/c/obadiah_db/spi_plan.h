@@ -0,0 +1,72 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 2 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef SPI_PLAN_H
+#define SPI_PLAN_H
+#include <locale>  // must be before postgres.h to fix /usr/include/libintl.h:39:14: error: expected unqualified-id before ‘const’ error
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "postgres.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#include "executor/spi.h"
+#include "utils/guc.h"
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+namespace obad {
+
+// Prepares the query on the first call and keeps the plan for the lifetime
+// of the backend
+SPIPlanPtr
+kept_plan(SPIPlanPtr &plan, const char *query, int nargs, Oid *types);
+
+// obadiah_db.plan_mode (see _PG_init()): the cursor options the plans kept
+// by kept_plan(cached_plan &, ...) are prepared with. Either 0, i.e. the plan
+// cache chooses between generic and custom plans as usual,
+// CURSOR_OPT_GENERIC_PLAN or CURSOR_OPT_CUSTOM_PLAN
+extern int plan_mode;
+extern const struct config_enum_entry plan_mode_options[];
+
+// A kept plan and the plan_mode it has been prepared with
+struct cached_plan {
+ SPIPlanPtr plan = nullptr;
+ int mode = 0;
+};
+
+// The same as kept_plan() above, for the queries which functions run with
+// different parameters on every call. The plan is prepared again once
+// plan_mode changes
+SPIPlanPtr
+kept_plan(cached_plan &plan, const char *query, int nargs, Oid *types);
+
+// One-dimensional array of the given element type, to be passed as a
+// parameter of a kept plan
+Datum
+make_array(Datum *values, bool *nulls, int n, Oid type);
+
+}  // namespace obad
+#endif
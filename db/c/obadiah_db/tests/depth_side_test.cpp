@@ -0,0 +1,122 @@
+// Copyright (C) 2019 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 1 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
+
+// Compares depth_side with a std::map reference on a deterministic sequence
+// of random updates concentrated near the touch, so levels move back and
+// forth between the flat array and the overflow tree. The containers of
+// depth_side only need palloc()/pfree(), which are malloc()/free() here, so
+// the test runs outside of a backend. 'make check' builds and runs it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "../depth.h"
+
+extern "C" {
+void *
+palloc(Size size) {
+ return std::malloc(size);
+}
+void
+pfree(void *pointer) {
+ std::free(pointer);
+}
+}
+
+namespace {
+
+template <class Better>
+class checked_side {
+public:
+ explicit checked_side(const char *name) : name(name){};
+ void set(obad::price p, obad::amount v) {
+  side.set(p, v);
+  reference[p] = v;
+ };
+ void erase(obad::price p) {
+  side.erase(p);
+  reference.erase(p);
+ };
+ obad::price best_price() const { return reference.begin()->first; };
+ bool empty() const { return reference.empty(); };
+ // Returns false and reports the first difference from the reference
+ bool check(long step) const {
+  if (side.empty() != reference.empty()) {
+   std::fprintf(stderr, "%s, step %ld: empty() is %d, expected %d\n", name,
+                step, side.empty(), reference.empty());
+   return false;
+  }
+  if (reference.empty()) return true;
+  if (side.best_price() != reference.begin()->first ||
+      side.best_volume() != reference.begin()->second) {
+   std::fprintf(stderr, "%s, step %ld: the best level is %Lf@%Lf, expected %Lf@%Lf\n",
+                name, step, side.best_volume(), side.best_price(),
+                reference.begin()->second, reference.begin()->first);
+   return false;
+  }
+  return true;
+ };
+
+private:
+ const char *name;
+ obad::depth_side<Better> side;
+ std::map<obad::price, obad::amount, Better> reference;
+};
+
+// Updates prices within a few hundred ticks of the touch, mostly close to it,
+// sets levels more often than erases them, then drains the side from the best
+// level so the whole content is compared, not only the best level. The tick is
+// negative for bids, so touch + tick is always worse than the touch.
+template <class Better>
+bool
+check_side(const char *name, obad::price touch, obad::price tick,
+           std::mt19937 &random) {
+ checked_side<Better> side{name};
+ std::geometric_distribution<int> distance{0.02};
+ std::uniform_int_distribution<int> volume{1, 1000};
+ std::bernoulli_distribution is_set{0.6}, is_through{0.05}, is_sweep{0.001};
+ long step = 0;
+ for (; step < 1000000; ++step) {
+  obad::price p = touch + tick * distance(random);
+  // sometimes a level appears better than the touch, as after a trade
+  if (is_through(random)) p = touch - tick * (1 + distance(random) % 8);
+  if (is_set(random))
+   side.set(p, volume(random) / obad::amount{100});
+  else
+   side.erase(p);
+  if (!side.check(step)) return false;
+  // a large market order sweeps the best levels and empties the array
+  if (is_sweep(random))
+   for (int i = 0; i < 100 && !side.empty(); ++i) {
+    side.erase(side.best_price());
+    if (!side.check(step)) return false;
+   }
+ }
+ for (; !side.empty(); ++step) {
+  side.erase(side.best_price());
+  if (!side.check(step)) return false;
+ }
+ return true;
+}
+}  // namespace
+
+int
+main() {
+ std::mt19937 random{20191112};
+ bool passed = check_side<std::greater<obad::price>>("bid", 8700, -0.01L, random);
+ passed = check_side<std::less<obad::price>>("ask", 8700.01L, 0.01L, random) && passed;
+ std::puts(passed ? "depth_side: passed" : "depth_side: FAILED");
+ return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
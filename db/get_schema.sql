@@ -58,34 +58,35 @@ ALTER TYPE get.draw_type OWNER TO "ob-analytics";
 --
 
 CREATE FUNCTION get._date_ceiling(base_date timestamp with time zone, round_interval interval) RETURNS timestamp with time zone
-    LANGUAGE sql STABLE
-    AS $_$-- See date_round() there: //wiki.postgresql.org/wiki/Round_time
-SELECT case when round_interval is not null and isfinite(base_date)  
-				then TO_TIMESTAMP(
-					(trunc(EXTRACT(epoch FROM $1 - '00:00:00.000001'::interval))::integer/trunc(EXTRACT(epoch FROM $2))::integer +1) * trunc(EXTRACT(epoch FROM $2))::integer)
-				else base_date end;
-$_$;
+    LANGUAGE c STABLE PARALLEL SAFE
+    AS '$libdir/libobadiah_db.so.1', 'date_ceiling';
 
 
 ALTER FUNCTION get._date_ceiling(base_date timestamp with time zone, round_interval interval) OWNER TO "ob-analytics";
 
+--
+-- Name: FUNCTION _date_ceiling(base_date timestamp with time zone, round_interval interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get._date_ceiling(base_date timestamp with time zone, round_interval interval) IS 'The end of the round_interval-long period (whole seconds, counted from the Unix epoch) containing base_date. base_date at a boundary, infinite base_date or NULL round_interval are returned as they are. See date_round() there: //wiki.postgresql.org/wiki/Round_time';
+
 --
 -- Name: _date_floor(timestamp with time zone, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
 
 CREATE FUNCTION get._date_floor(base_date timestamp with time zone, round_interval interval) RETURNS timestamp with time zone
-    LANGUAGE sql STABLE
-    AS $_$-- See date_round() there: //wiki.postgresql.org/wiki/Round_time
-
-SELECT case when round_interval is not null and isfinite(base_date)  
-				then TO_TIMESTAMP(
-					trunc(EXTRACT(epoch FROM $1))::integer/trunc(EXTRACT(epoch FROM $2))::integer * trunc(EXTRACT(epoch FROM $2))::integer)
-				else base_date end;
-$_$;
+    LANGUAGE c STABLE PARALLEL SAFE
+    AS '$libdir/libobadiah_db.so.1', 'date_floor';
 
 
 ALTER FUNCTION get._date_floor(base_date timestamp with time zone, round_interval interval) OWNER TO "ob-analytics";
 
+--
+-- Name: FUNCTION _date_floor(base_date timestamp with time zone, round_interval interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get._date_floor(base_date timestamp with time zone, round_interval interval) IS 'The start of the round_interval-long period (whole seconds, counted from the Unix epoch) containing base_date. Infinite base_date or NULL round_interval are returned as they are. See date_round() there: //wiki.postgresql.org/wiki/Round_time';
+
 --
 -- Name: _in_milliseconds(timestamp with time zone); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
@@ -300,6 +301,40 @@ $$;
 
 ALTER FUNCTION get.depth_summary(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval, p_bps_step integer, p_max_bps_level integer) OWNER TO "ob-analytics";
 
+--
+-- Name: depth_summary_fast(timestamp with time zone, timestamp with time zone, integer, integer, interval, integer, integer); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.depth_summary_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval DEFAULT NULL::interval, p_bps_step integer DEFAULT 25, p_max_bps_level integer DEFAULT 500) RETURNS TABLE("timestamp" timestamp with time zone, price numeric, volume numeric, side text, bps_level integer)
+    LANGUAGE c STABLE SECURITY DEFINER
+    AS '$libdir/libobadiah_db.so.1', 'GetDepthSummary';
+
+
+ALTER FUNCTION get.depth_summary_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval, p_bps_step integer, p_max_bps_level integer) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION depth_summary_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval, p_bps_step integer, p_max_bps_level integer); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.depth_summary_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval, p_bps_step integer, p_max_bps_level integer) IS 'The same as get.depth_summary() but the depth is replayed by the C++ DepthToSummary stage over get.depth(), so the summary starts from the full depth at p_start_time';
+
+--
+-- Name: epsilon_drawupdowns(timestamp with time zone, timestamp with time zone, integer, integer, double precision, double precision, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.epsilon_drawupdowns(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision DEFAULT 0, p_epsilon double precision DEFAULT 0, p_frequency interval DEFAULT NULL::interval) RETURNS TABLE("opened.at" timestamp with time zone, "open.price" double precision, "closed.at" timestamp with time zone, "close.price" double precision, "bps.return" double precision, rate double precision, "log.return" double precision)
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'DiscoverDrawUpDowns';
+
+
+ALTER FUNCTION get.epsilon_drawupdowns(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_epsilon double precision, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION epsilon_drawupdowns(timestamp with time zone, timestamp with time zone, integer, integer, double precision, double precision, interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.epsilon_drawupdowns(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_epsilon double precision, p_frequency interval) IS 'Epsilon draw-ups and draw-downs of the mid-price of get.trading_period(), computed without leaving the server. Unlike epsilon.drawupdowns() in R, which gets NaN mid-prices for them, the spreads with a missing side are skipped';
+
 --
 -- Name: events(timestamp with time zone, timestamp with time zone, integer, integer, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
@@ -554,6 +589,74 @@ $$;
 
 ALTER FUNCTION get.export(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer) OWNER TO "ob-analytics";
 
+--
+-- Name: export_queues(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.export_queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tick_type text, p_frequency interval DEFAULT NULL::interval) RETURNS SETOF bytea
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'ExportOrderBookQueues';
+
+
+ALTER FUNCTION get.export_queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tick_type text, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION export_queues(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.export_queues(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, interval) IS 'The output of get.queues() with p_sparse := false in the binary COPY format, in chunks to be concatenated in order';
+
+--
+-- Name: export_queues_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, text, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.export_queues_to_file(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tick_type text, p_file text, p_frequency interval DEFAULT NULL::interval) RETURNS bigint
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'ExportOrderBookQueuesToFile';
+
+
+ALTER FUNCTION get.export_queues_to_file(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tick_type text, p_file text, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION export_queues_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, text, interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.export_queues_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, text, interval) IS 'Writes the output of get.queues() with p_sparse := false to the server-side file p_file in the binary COPY format. Returns the number of rows written. Superuser only';
+
+--
+-- Name: export_trading_period(timestamp with time zone, timestamp with time zone, integer, integer, double precision, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.export_trading_period(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_frequency interval DEFAULT NULL::interval) RETURNS SETOF bytea
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'ExportTradingPeriod';
+
+
+ALTER FUNCTION get.export_trading_period(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION export_trading_period(timestamp with time zone, timestamp with time zone, integer, integer, double precision, interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.export_trading_period(timestamp with time zone, timestamp with time zone, integer, integer, double precision, interval) IS 'The output of get.trading_period() in the binary COPY format, in chunks to be concatenated in order';
+
+--
+-- Name: export_trading_period_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, text, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.export_trading_period_to_file(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_file text, p_frequency interval DEFAULT NULL::interval) RETURNS bigint
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'ExportTradingPeriodToFile';
+
+
+ALTER FUNCTION get.export_trading_period_to_file(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_volume double precision, p_file text, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION export_trading_period_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, text, interval); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.export_trading_period_to_file(timestamp with time zone, timestamp with time zone, integer, integer, double precision, text, interval) IS 'Writes the output of get.trading_period() to the server-side file p_file in the binary COPY format. Returns the number of rows written. Superuser only';
+
 --
 -- Name: order_book(timestamp with time zone, integer, integer, integer, numeric, numeric, numeric); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
@@ -617,15 +720,15 @@ CREATE FUNCTION get.pair_id(p_pair text) RETURNS smallint
 ALTER FUNCTION get.pair_id(p_pair text) OWNER TO "ob-analytics";
 
 --
--- Name: queues(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, interval); Type: FUNCTION; Schema: get; Owner: ob-analytics
+-- Name: queues(timestamp with time zone, timestamp with time zone, integer, integer, double precision, integer, integer, text, interval, boolean); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
 
-CREATE FUNCTION get.queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tich_type text, p_frequency interval DEFAULT NULL::interval) RETURNS TABLE("timestamp" timestamp with time zone, "bid.price" double precision, "ask.price" double precision, b double precision[], a double precision[])
+CREATE FUNCTION get.queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tich_type text, p_frequency interval DEFAULT NULL::interval, p_sparse boolean DEFAULT false) RETURNS TABLE("timestamp" timestamp with time zone, "bid.price" double precision, "ask.price" double precision, b double precision[], a double precision[])
     LANGUAGE c
     AS '$libdir/libobadiah_db.so.1', 'GetOrderBookQueues';
 
 
-ALTER FUNCTION get.queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tich_type text, p_frequency interval) OWNER TO "ob-analytics";
+ALTER FUNCTION get.queues(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_tick_size double precision, p_first_tick integer, p_last_tick integer, p_tich_type text, p_frequency interval, p_sparse boolean) OWNER TO "ob-analytics";
 
 --
 -- Name: set_log_level(text); Type: FUNCTION; Schema: get; Owner: ob-analytics
@@ -681,6 +784,23 @@ $$;
 
 ALTER FUNCTION get.spread(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval) OWNER TO "ob-analytics";
 
+--
+-- Name: stage_metrics(); Type: FUNCTION; Schema: get; Owner: ob-analytics
+--
+
+CREATE FUNCTION get.stage_metrics() RETURNS TABLE(stage text, "elements.in" bigint, "elements.out" bigint, episodes bigint, "max.book.size" bigint, refills bigint, seconds double precision)
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'GetStageMetrics';
+
+
+ALTER FUNCTION get.stage_metrics() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION stage_metrics(); Type: COMMENT; Schema: get; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION get.stage_metrics() IS 'Per-stage counters of the latest C++ pipeline run in this backend (e.g. by get.trading_period(), get.queues(), get.depth_summary_fast() or get.export_queues()). A call which has not returned all its rows (e.g. because of LIMIT) reports nothing';
+
 --
 -- Name: trades(timestamp with time zone, timestamp with time zone, integer, integer); Type: FUNCTION; Schema: get; Owner: ob-analytics
 --
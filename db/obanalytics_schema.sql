@@ -1149,7 +1149,7 @@ ALTER FUNCTION obanalytics._spread_from_order_book(p_ts timestamp with time zone
 --
 
 CREATE FUNCTION obanalytics._to_microseconds(p_timestamptz timestamp with time zone) RETURNS bigint
-    LANGUAGE c
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
     AS '$libdir/libobadiah_db.so.1', 'to_microseconds';
 
 
@@ -1176,6 +1176,23 @@ $$;
 
 ALTER FUNCTION obanalytics.check_microtimestamp_change() OWNER TO "ob-analytics";
 
+--
+-- Name: check_microtimestamp_change_fast(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.check_microtimestamp_change_fast() RETURNS trigger
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'check_microtimestamp_change';
+
+
+ALTER FUNCTION obanalytics.check_microtimestamp_change_fast() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION check_microtimestamp_change_fast(); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.check_microtimestamp_change_fast() IS 'The same as check_microtimestamp_change() but implemented in C. To be used instead of check_microtimestamp_change() in triggers';
+
 --
 -- Name: crossed_books(timestamp with time zone, timestamp with time zone, integer, integer); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
@@ -1218,12 +1235,74 @@ $$;
 
 ALTER FUNCTION obanalytics.crossed_books(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer) OWNER TO "ob-analytics";
 
+--
+-- Name: crossed_books_by_episode_fast(timestamp with time zone, timestamp with time zone, integer, integer, interval); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.crossed_books_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval DEFAULT NULL::interval) RETURNS TABLE(run_start timestamp with time zone, run_end timestamp with time zone, is_crossed boolean)
+    LANGUAGE c STABLE PARALLEL RESTRICTED
+    AS '$libdir/libobadiah_db.so.1', 'crossed_books_by_episode';
+
+
+ALTER FUNCTION obanalytics.crossed_books_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION crossed_books_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.crossed_books_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval) IS 'Replays the episodes within one era like spread_by_episode_fast() and returns the runs of changes of the best prices which are all crossed or all not crossed';
+
+--
+-- Name: crossed_books_fast(timestamp with time zone, timestamp with time zone, integer, integer); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.crossed_books_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer) RETURNS TABLE(previous_uncrossed timestamp with time zone, first_crossed timestamp with time zone, next_uncrossed timestamp with time zone, pair_id smallint, exchange_id smallint)
+    LANGUAGE sql
+    AS $$
+
+with runs as (
+	select runs.*
+	from obanalytics._periods_within_eras(p_start_time, p_end_time, p_pair_id, p_exchange_id, null) periods
+		  join obanalytics.crossed_books_by_episode_fast(period_start, period_end, p_pair_id, p_exchange_id) runs on true
+),
+spread_periods as (	-- the runs of adjacent periods are merged
+	select min(run_start) as period_start, max(run_end) as period_end, bool_or(is_crossed) as crossed
+	from (
+		select *, sum(t) over (order by run_start) as g
+		from (
+			select *, coalesce(is_crossed <> lag(is_crossed) over (order by run_start), true)::integer as t
+			from runs
+		) a
+	) a
+	group by g
+),
+spread_periods_chain as (
+	select *,lag(period_end) over w as previous_end, lead(period_start) over w as next_start
+	from spread_periods
+	window w as (order by period_start)
+)
+select previous_end, period_start, next_start, p_pair_id::smallint, p_exchange_id::smallint
+from spread_periods_chain
+where crossed 
+  and coalesce(previous_end, period_start) < p_end_time
+;  
+$$;
+
+
+ALTER FUNCTION obanalytics.crossed_books_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION crossed_books_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.crossed_books_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer) IS 'The same as crossed_books() but the crossed episodes are detected during the replay of the order book by crossed_books_by_episode_fast(), so level1 is not materialized';
+
 --
 -- Name: depth_change_by_episode_fast(timestamp with time zone, timestamp with time zone, integer, integer, interval); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
 
 CREATE FUNCTION obanalytics.depth_change_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval DEFAULT NULL::interval) RETURNS SETOF obanalytics.level2
-    LANGUAGE c
+    LANGUAGE c STABLE PARALLEL RESTRICTED
     AS '$libdir/libobadiah_db.so.1', 'depth_change_by_episode';
 
 
@@ -1329,7 +1408,7 @@ begin
 		while (v_something_was_fixed) loop
 			v_something_was_fixed := false;
 
-			for v_crossed in select first_crossed from obanalytics.crossed_books(v_crossed, v_end, p_pair_id, p_exchange_id) loop
+			for v_crossed in select first_crossed from obanalytics.crossed_books_fast(v_crossed, v_end, p_pair_id, p_exchange_id) loop
 
 				-- Fix eternal takers, which should have been removed by an exchange, but weren't for some reasons
 				return query 
@@ -1836,6 +1915,40 @@ $$;
 
 ALTER FUNCTION obanalytics.level3_incorporate_new_event() OWNER TO "ob-analytics";
 
+--
+-- Name: level3_incorporate_new_event_fast(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.level3_incorporate_new_event_fast() RETURNS trigger
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'level3_incorporate_new_event';
+
+
+ALTER FUNCTION obanalytics.level3_incorporate_new_event_fast() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION level3_incorporate_new_event_fast(); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.level3_incorporate_new_event_fast() IS 'The same as level3_incorporate_new_event() but implemented in C. To be used instead of level3_incorporate_new_event() in triggers';
+
+--
+-- Name: level3_insert_events(integer, integer, timestamp with time zone[], bigint[], character[], numeric[], numeric[], timestamp with time zone[]); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.level3_insert_events(p_exchange_id integer, p_pair_id integer, p_microtimestamp timestamp with time zone[], p_order_id bigint[], p_side character[], p_price numeric[], p_amount numeric[], p_local_timestamp timestamp with time zone[]) RETURNS integer
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'level3_insert_events';
+
+
+ALTER FUNCTION obanalytics.level3_insert_events(p_exchange_id integer, p_pair_id integer, p_microtimestamp timestamp with time zone[], p_order_id bigint[], p_side character[], p_price numeric[], p_amount numeric[], p_local_timestamp timestamp with time zone[]) OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION level3_insert_events(integer, integer, timestamp with time zone[], bigint[], character[], numeric[], numeric[], timestamp with time zone[]); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.level3_insert_events(p_exchange_id integer, p_pair_id integer, p_microtimestamp timestamp with time zone[], p_order_id bigint[], p_side character[], p_price numeric[], p_amount numeric[], p_local_timestamp timestamp with time zone[]) IS 'Inserts a batch of events of one pair into level3. The events are linked into chains in memory as level3_incorporate_new_event() would do, so event_no, fill, price_microtimestamp etc. are not needed. price = 0 deletes the order. Returns the number of inserted events';
+
 --
 -- Name: level3_update_chain_after_delete(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
@@ -1914,6 +2027,23 @@ $$;
 
 ALTER FUNCTION obanalytics.level3_update_level3_eras() OWNER TO "ob-analytics";
 
+--
+-- Name: level3_update_level3_eras_fast(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.level3_update_level3_eras_fast() RETURNS trigger
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'level3_update_level3_eras';
+
+
+ALTER FUNCTION obanalytics.level3_update_level3_eras_fast() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION level3_update_level3_eras_fast(); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.level3_update_level3_eras_fast() IS 'The same as level3_update_level3_eras() but implemented in C. To be used instead of level3_update_level3_eras() in triggers';
+
 --
 -- Name: merge_crossed_books(timestamp with time zone, timestamp with time zone, integer, integer); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
@@ -1927,7 +2057,7 @@ begin
 	v_execution_start_time := clock_timestamp();
 	raise debug 'merge_crossed_books(%, %, %, %)', p_start_time, p_end_time,  p_pair_id, p_exchange_id;
 
-	for crossed_books in (select * from obanalytics.crossed_books(p_start_time, p_end_time, p_pair_id, p_exchange_id) where next_uncrossed is not null) loop
+	for crossed_books in (select * from obanalytics.crossed_books_fast(p_start_time, p_end_time, p_pair_id, p_exchange_id) where next_uncrossed is not null) loop
 		if crossed_books.next_uncrossed is null then 
 			raise exception 'Unable to find next uncrossed order book:  previous_uncrossed=%, pair_id=%, exchange_id=%', crossed_books.previous_uncrossed, p_pair_id, p_exchange_id;
 		end if;
@@ -2150,6 +2280,23 @@ $$;
 
 ALTER FUNCTION obanalytics.propagate_microtimestamp_change() OWNER TO "ob-analytics";
 
+--
+-- Name: propagate_microtimestamp_change_fast(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.propagate_microtimestamp_change_fast() RETURNS trigger
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'propagate_microtimestamp_change';
+
+
+ALTER FUNCTION obanalytics.propagate_microtimestamp_change_fast() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION propagate_microtimestamp_change_fast(); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.propagate_microtimestamp_change_fast() IS 'The same as propagate_microtimestamp_change() but implemented in C. To be used instead of propagate_microtimestamp_change() in triggers';
+
 --
 -- Name: qty_level3_fix_duplicate_order_events(integer, integer, timestamp with time zone); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
@@ -2449,12 +2596,29 @@ $$;
 
 ALTER FUNCTION obanalytics.save_exchange_microtimestamp() OWNER TO "ob-analytics";
 
+--
+-- Name: save_exchange_microtimestamp_fast(); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
+--
+
+CREATE FUNCTION obanalytics.save_exchange_microtimestamp_fast() RETURNS trigger
+    LANGUAGE c
+    AS '$libdir/libobadiah_db.so.1', 'save_exchange_microtimestamp';
+
+
+ALTER FUNCTION obanalytics.save_exchange_microtimestamp_fast() OWNER TO "ob-analytics";
+
+--
+-- Name: FUNCTION save_exchange_microtimestamp_fast(); Type: COMMENT; Schema: obanalytics; Owner: ob-analytics
+--
+
+COMMENT ON FUNCTION obanalytics.save_exchange_microtimestamp_fast() IS 'The same as save_exchange_microtimestamp() but implemented in C. To be used instead of save_exchange_microtimestamp() in triggers';
+
 --
 -- Name: spread_by_episode_fast(timestamp with time zone, timestamp with time zone, integer, integer, interval); Type: FUNCTION; Schema: obanalytics; Owner: ob-analytics
 --
 
 CREATE FUNCTION obanalytics.spread_by_episode_fast(p_start_time timestamp with time zone, p_end_time timestamp with time zone, p_pair_id integer, p_exchange_id integer, p_frequency interval DEFAULT NULL::interval) RETURNS SETOF obanalytics.level1
-    LANGUAGE c
+    LANGUAGE c STABLE PARALLEL RESTRICTED
     AS '$libdir/libobadiah_db.so.1', 'spread_by_episode';
 
 
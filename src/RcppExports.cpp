@@ -19,8 +19,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // CalculateOrderBookQueues
-DataFrame CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size, IntegerVector ticks, CharacterVector type, CharacterVector debug_level);
-RcppExport SEXP _obadiah_CalculateOrderBookQueues(SEXP depth_changesSEXP, SEXP tick_sizeSEXP, SEXP ticksSEXP, SEXP typeSEXP, SEXP debug_levelSEXP) {
+DataFrame CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size, IntegerVector ticks, CharacterVector type, LogicalVector sparse, CharacterVector debug_level);
+RcppExport SEXP _obadiah_CalculateOrderBookQueues(SEXP depth_changesSEXP, SEXP tick_sizeSEXP, SEXP ticksSEXP, SEXP typeSEXP, SEXP sparseSEXP, SEXP debug_levelSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -28,20 +28,37 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< NumericVector >::type tick_size(tick_sizeSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type ticks(ticksSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type type(typeSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type sparse(sparseSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type debug_level(debug_levelSEXP);
-    rcpp_result_gen = Rcpp::wrap(CalculateOrderBookQueues(depth_changes, tick_size, ticks, type, debug_level));
+    rcpp_result_gen = Rcpp::wrap(CalculateOrderBookQueues(depth_changes, tick_size, ticks, type, sparse, debug_level));
+    return rcpp_result_gen;
+END_RCPP
+}
+// CalculateDepthSummary
+DataFrame CalculateDepthSummary(DataFrame depth_changes, IntegerVector bps_step, IntegerVector max_bps_level, IntegerVector digits, CharacterVector debug_level);
+RcppExport SEXP _obadiah_CalculateDepthSummary(SEXP depth_changesSEXP, SEXP bps_stepSEXP, SEXP max_bps_levelSEXP, SEXP digitsSEXP, SEXP debug_levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< DataFrame >::type depth_changes(depth_changesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type bps_step(bps_stepSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type max_bps_level(max_bps_levelSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type digits(digitsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type debug_level(debug_levelSEXP);
+    rcpp_result_gen = Rcpp::wrap(CalculateDepthSummary(depth_changes, bps_step, max_bps_level, digits, debug_level));
     return rcpp_result_gen;
 END_RCPP
 }
 // CalculateDepthChanges
-DataFrame CalculateDepthChanges(DataFrame depth_updates, CharacterVector debug_level);
-RcppExport SEXP _obadiah_CalculateDepthChanges(SEXP depth_updatesSEXP, SEXP debug_levelSEXP) {
+DataFrame CalculateDepthChanges(DataFrame depth_updates, NumericVector chain_expiry, CharacterVector debug_level);
+RcppExport SEXP _obadiah_CalculateDepthChanges(SEXP depth_updatesSEXP, SEXP chain_expirySEXP, SEXP debug_levelSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< DataFrame >::type depth_updates(depth_updatesSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type chain_expiry(chain_expirySEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type debug_level(debug_levelSEXP);
-    rcpp_result_gen = Rcpp::wrap(CalculateDepthChanges(depth_updates, debug_level));
+    rcpp_result_gen = Rcpp::wrap(CalculateDepthChanges(depth_updates, chain_expiry, debug_level));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -88,6 +105,16 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetStageMetrics
+DataFrame GetStageMetrics();
+RcppExport SEXP _obadiah_GetStageMetrics() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(GetStageMetrics());
+    return rcpp_result_gen;
+END_RCPP
+}
 // spread_from_depth
 DataFrame spread_from_depth(DatetimeVector timestamp, NumericVector price, NumericVector volume, CharacterVector side);
 RcppExport SEXP _obadiah_spread_from_depth(SEXP timestampSEXP, SEXP priceSEXP, SEXP volumeSEXP, SEXP sideSEXP) {
@@ -107,11 +134,13 @@ RcppExport SEXP run_testthat_tests();
 
 static const R_CallMethodDef CallEntries[] = {
     {"_obadiah_CalculateTradingPeriod", (DL_FUNC) &_obadiah_CalculateTradingPeriod, 3},
-    {"_obadiah_CalculateOrderBookQueues", (DL_FUNC) &_obadiah_CalculateOrderBookQueues, 5},
-    {"_obadiah_CalculateDepthChanges", (DL_FUNC) &_obadiah_CalculateDepthChanges, 2},
+    {"_obadiah_CalculateOrderBookQueues", (DL_FUNC) &_obadiah_CalculateOrderBookQueues, 6},
+    {"_obadiah_CalculateDepthSummary", (DL_FUNC) &_obadiah_CalculateDepthSummary, 5},
+    {"_obadiah_CalculateDepthChanges", (DL_FUNC) &_obadiah_CalculateDepthChanges, 3},
     {"_obadiah_ResampleDepth", (DL_FUNC) &_obadiah_ResampleDepth, 6},
     {"_obadiah_DiscoverPositions", (DL_FUNC) &_obadiah_DiscoverPositions, 4},
     {"_obadiah_DiscoverDrawUpDowns", (DL_FUNC) &_obadiah_DiscoverDrawUpDowns, 3},
+    {"_obadiah_GetStageMetrics", (DL_FUNC) &_obadiah_GetStageMetrics, 0},
     {"_obadiah_spread_from_depth", (DL_FUNC) &_obadiah_spread_from_depth, 4},
     {"run_testthat_tests", (DL_FUNC) &run_testthat_tests, 0},
     {NULL, NULL, 0}
@@ -48,6 +48,15 @@ BidAskSpread::operator char *() {
  return buffer;
 }
 
+Level1::operator char *() {
+ const size_t kBufferSize = 200;
+ static char buffer[kBufferSize];
+ snprintf(buffer, kBufferSize,
+          "L1 t: %s bid: %.5lf (%.8lf) ask: %.5lf (%.8lf)",
+          static_cast<char *>(t), p_bid, v_bid, p_ask, v_ask);
+ return buffer;
+}
+
 Timestamp::operator char *() {
  const size_t kBufferSize = 50;
  static char buffer[kBufferSize];
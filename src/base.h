@@ -16,27 +16,14 @@
 #ifndef OBADIAH_BASE_H
 #define OBADIAH_BASE_H
 
-#ifndef NDEBUG
-#include <boost/log/attributes/scoped_attribute.hpp>
-#include <boost/log/attributes/timer.hpp>
-#include <boost/log/sources/severity_feature.hpp>
-#include <boost/log/sources/severity_logger.hpp>
-#endif
-
 #include <cmath>
+#include <limits>
 #include <map>
 #include <ostream>
 #include <string>
 #include <unordered_map>
-#include "severity_level.h"
-
-#ifndef NDEBUG
-namespace logging = boost::log;
-namespace src = boost::log::sources;
-namespace sinks = boost::log::sinks;
-namespace keywords = boost::log::keywords;
-namespace attrs = boost::log::attributes;
-#endif
+#include "logger.h"
+#include "metrics.h"
 
 namespace obadiah {
 namespace R {
@@ -93,6 +80,8 @@ AlignDown(Price price, Price tick_size) {
 #define R_NAREAL std::nan("1954")
 
 using Volume = double;
+constexpr double kVolumePrecision =
+    0.00000001;  // the minimal difference between two volumes
 
 inline static bool
 geq(Price first, Price second) {
@@ -143,6 +132,35 @@ struct BidAskSpread {
  explicit operator char*();
 };
 
+// The best price and the volume available at it on each side of the book.
+// An empty side has NaN (not R's NA) price and volume.
+struct Level1 {
+ Level1()
+     : t(0),
+       p_bid(std::numeric_limits<Price>::quiet_NaN()),
+       v_bid(std::numeric_limits<Volume>::quiet_NaN()),
+       p_ask(std::numeric_limits<Price>::quiet_NaN()),
+       v_ask(std::numeric_limits<Volume>::quiet_NaN()){};
+ Timestamp t;
+ Price p_bid;
+ Volume v_bid;
+ Price p_ask;
+ Volume v_ask;
+
+ // Exact, since spread_from_depth() reports any change of the best levels,
+ // even by less than kVolumePrecision. NaN (an empty side) equals NaN.
+ inline static bool eq(double x1, double x2) {
+  return x1 == x2 || (std::isnan(x1) && std::isnan(x2));
+ }
+
+ // Note that Timestamp t is EXCLUDED from the comparison
+ inline bool operator!=(const Level1& a) const {
+  return !eq(p_bid, a.p_bid) || !eq(v_bid, a.v_bid) || !eq(p_ask, a.p_ask) ||
+         !eq(v_ask, a.v_ask);
+ }
+ explicit operator char*();
+};
+
 struct InstantPrice {
  InstantPrice() : p(0), t(0){};
  InstantPrice(double price, double time) : p(price), t(time){};
@@ -165,16 +183,16 @@ operator<<(std::ostream& stream, InstantPrice& p);
 template <typename O>
 class ObjectStream {
 public:
- explicit ObjectStream() : is_all_processed_(true){};
+ explicit ObjectStream(const char* stage = "ObjectStream")
+     : is_all_processed_(true), metrics_(stage){};
  virtual explicit operator bool();
  virtual ObjectStream<O>& operator>>(O&) = 0;
- virtual ~ObjectStream(){};
+ virtual ~ObjectStream() { PipelineMetrics::Report(metrics_); };
 
 protected:
  bool is_all_processed_;
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ StageMetrics metrics_;
+ Logger lg;
 };
 
 template <typename O>
@@ -187,6 +205,8 @@ class OrderBook {
 public:
  OrderBook<Allocator>& operator<<(const Level2&);
  BidAskSpread GetBidAskSpread(Volume) const;
+ Level1 GetLevel1() const;
+ inline std::size_t GetSize() const { return bids_.size() + asks_.size(); }
 
  template <template <typename> class A>
  friend std::ostream& operator<<(std::ostream&, const OrderBook<A>&);
@@ -197,18 +217,18 @@ protected:
  PriceVolumeMap bids_;
  PriceVolumeMap asks_;
  Timestamp latest_timestamp_;
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ Logger lg;
 };
 
 template <template <typename> class Allocator, class Output>
 class EpisodeProcessor : public ObjectStream<Output> {
 public:
- EpisodeProcessor(ObjectStream<Level2>* depth_changes);
+ EpisodeProcessor(ObjectStream<Level2>* depth_changes, const char* stage);
 
 protected:
- bool ProcessNextEpisode(OrderBook<Allocator>&);
+ // Book is a template parameter so that its own operator<< is called
+ template <class Book>
+ bool ProcessNextEpisode(Book&);
 
  ObjectStream<Level2>* depth_changes_;
  Level2 unprocessed_;
@@ -218,14 +238,13 @@ template <template <typename> class Allocator>
 class TradingPeriod : public EpisodeProcessor<Allocator, BidAskSpread> {
 public:
  TradingPeriod(ObjectStream<Level2>* depth_changes, double volume)
-     : EpisodeProcessor<Allocator, BidAskSpread>{depth_changes},
+     : EpisodeProcessor<Allocator, BidAskSpread>{depth_changes,
+                                                 "TradingPeriod"},
        volume_(volume) {
   if (volume_ < 0) {
-#ifndef NDEBUG
-   BOOST_LOG_SEV(this->lg, SeverityLevel::kWarning)
+   OBADIAH_LOG(this->lg, SeverityLevel::kWarning)
        << "A wrong value for volume (" << volume_
        << ") was provided. Will use 0.0 instead";
-#endif
    volume_ = 0;
   }
  };
@@ -237,6 +256,20 @@ protected:
  BidAskSpread current_;
 };
 
+// Produces a Level1 after every episode which changes the best prices or the
+// volumes available at them
+template <template <typename> class Allocator>
+class TopOfBook : public EpisodeProcessor<Allocator, Level1> {
+public:
+ explicit TopOfBook(ObjectStream<Level2>* depth_changes)
+     : EpisodeProcessor<Allocator, Level1>{depth_changes, "TopOfBook"} {};
+ TopOfBook<Allocator>& operator>>(Level1&);
+
+protected:
+ OrderBook<Allocator> ob_;
+ Level1 current_;
+};
+
 template <template <typename> class Allocator>
 std::ostream&
 operator<<(std::ostream& stream, const OrderBook<Allocator>& ob) {
@@ -261,26 +294,19 @@ OrderBook<Allocator>::operator<<(const Level2& next_depth) {
   auto search = side->find(next_depth.p);
   if (search != side->end()) {
    side->erase(search);
-#ifndef NDEBUG
-   BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug5)
+   OBADIAH_LOG(this->lg, SeverityLevel::kDebug5)
        << "From OB " << next_depth.p << " " << static_cast<char>(next_depth.s)
        << " (" << side->size() << ")";
-#endif
-  }
-#ifndef NDEBUG
-  else
-   BOOST_LOG_SEV(this->lg, SeverityLevel::kWarning)
+  } else
+   OBADIAH_LOG(this->lg, SeverityLevel::kWarning)
        << "From OB(NOT FOUND!)" << next_depth.p << " "
        << static_cast<char>(next_depth.s) << " (" << side->size() << ")";
-#endif
 
  } else {
   (*side)[next_depth.p] = next_depth.v;
-#ifndef NDEBUG
-  BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug5)
+  OBADIAH_LOG(this->lg, SeverityLevel::kDebug5)
       << "In OB " << next_depth.p << " " << static_cast<char>(next_depth.s)
       << " (" << side->size() << ")";
-#endif
  }
  return *this;
 };
@@ -348,22 +374,42 @@ OrderBook<Allocator>::GetBidAskSpread(Volume volume) const {
  return to_be_returned;
 };
 
+template <template <typename> class Allocator>
+Level1
+OrderBook<Allocator>::GetLevel1() const {
+ Level1 to_be_returned;
+ to_be_returned.t = latest_timestamp_;
+ if (!bids_.empty()) {
+  to_be_returned.p_bid = bids_.rbegin()->first;
+  to_be_returned.v_bid = bids_.rbegin()->second;
+ }
+ if (!asks_.empty()) {
+  to_be_returned.p_ask = asks_.begin()->first;
+  to_be_returned.v_ask = asks_.begin()->second;
+ }
+ return to_be_returned;
+}
+
 template <template <typename> class Allocator, class Output>
 EpisodeProcessor<Allocator, Output>::EpisodeProcessor(
-    ObjectStream<Level2>* depth_changes)
-    : depth_changes_{depth_changes} {
- if (*depth_changes_ >> unprocessed_) this->is_all_processed_ = false;
+    ObjectStream<Level2>* depth_changes, const char* stage)
+    : ObjectStream<Output>{stage}, depth_changes_{depth_changes} {
+ if (*depth_changes_ >> unprocessed_) {
+  this->is_all_processed_ = false;
+  ++this->metrics_.in;
+ }
 }
 
 template <template <typename> class Allocator, class Output>
+template <class Book>
 bool
-EpisodeProcessor<Allocator, Output>::ProcessNextEpisode(
-    OrderBook<Allocator>& ob) {
+EpisodeProcessor<Allocator, Output>::ProcessNextEpisode(Book& ob) {
  if (unprocessed_) {
   Timestamp current_timestamp = unprocessed_.t;
   bool is_unprocessed_ = false;
   ob << unprocessed_;
   while (*depth_changes_ >> unprocessed_) {
+   ++this->metrics_.in;
    if (unprocessed_.t == current_timestamp)
     ob << unprocessed_;
    else {
@@ -372,6 +418,8 @@ EpisodeProcessor<Allocator, Output>::ProcessNextEpisode(
    }
   }
   if (!is_unprocessed_) unprocessed_.falsify();
+  ++this->metrics_.episodes;
+  this->metrics_.BookSize(ob.GetSize());
   return true;
  } else
   return false;
@@ -380,26 +428,43 @@ EpisodeProcessor<Allocator, Output>::ProcessNextEpisode(
 template <template <typename> class Allocator>
 TradingPeriod<Allocator>&
 TradingPeriod<Allocator>::operator>>(BidAskSpread& to_be_returned) {
+ StageTimer timer{this->metrics_};
  if (!this->is_all_processed_) {
   to_be_returned = current_;
-#ifndef NDEBUG
-  BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug2)
+  OBADIAH_LOG(this->lg, SeverityLevel::kDebug2)
       << "Previous=" << static_cast<char*>(current_);
-#endif
   while (this->ProcessNextEpisode(ob_)) {
    current_ = ob_.GetBidAskSpread(volume_);
-#ifndef NDEBUG
-   BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug3)
+   OBADIAH_LOG(this->lg, SeverityLevel::kDebug3)
        << "Current=" << static_cast<char*>(current_) << ob_;
-#endif
    if (current_ != to_be_returned) break;
   }
   if (current_ != to_be_returned) {
-#ifndef NDEBUG
-   BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug2)
+   OBADIAH_LOG(this->lg, SeverityLevel::kDebug2)
        << "Returned=" << static_cast<char*>(current_);
-#endif
    to_be_returned = current_;
+   ++this->metrics_.out;
+  } else
+   this->is_all_processed_ = true;
+ }
+ return *this;
+}
+
+template <template <typename> class Allocator>
+TopOfBook<Allocator>&
+TopOfBook<Allocator>::operator>>(Level1& to_be_returned) {
+ StageTimer timer{this->metrics_};
+ if (!this->is_all_processed_) {
+  to_be_returned = current_;
+  while (this->ProcessNextEpisode(ob_)) {
+   current_ = ob_.GetLevel1();
+   OBADIAH_LOG(this->lg, SeverityLevel::kDebug3)
+       << "Current=" << static_cast<char*>(current_) << ob_;
+   if (current_ != to_be_returned) break;
+  }
+  if (current_ != to_be_returned) {
+   to_be_returned = current_;
+   ++this->metrics_.out;
   } else
    this->is_all_processed_ = true;
  }
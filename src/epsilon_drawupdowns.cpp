@@ -13,14 +13,34 @@
 // with this program; if not, write to the Free Software Foundation, Inc.,
 // 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
 #include "epsilon_drawupdowns.h"
-
-#ifndef NDEBUG
-#include <boost/log/sources/record_ostream.hpp>
-#endif
+#include <cmath>
 
 namespace obadiah {
 namespace R {
 
+MidPrices::MidPrices(ObjectStream<BidAskSpread>* spreads)
+    : ObjectStream<InstantPrice>("MidPrices"), spreads_(spreads) {
+ is_all_processed_ = false;
+}
+
+ObjectStream<InstantPrice>&
+MidPrices::operator>>(InstantPrice& price) {
+ StageTimer timer{metrics_};
+ BidAskSpread spread;
+ while (!is_all_processed_) {
+  if (!(*spreads_ >> spread)) {
+   is_all_processed_ = true;
+   break;
+  }
+  ++metrics_.in;
+  if (std::isnan(spread.p_bid) || std::isnan(spread.p_ask)) continue;
+  price = InstantPrice{(spread.p_bid + spread.p_ask) / 2, spread.t.t};
+  ++metrics_.out;
+  break;
+ }
+ return *this;
+}
+
 std::ostream&
 operator<<(std::ostream& stream, EpsilonDrawUpDowns& p) {
  stream << "st_:" << p.st_ << " tp_:" << p.tp_ << " en_:" << p.en_
@@ -31,35 +51,31 @@ operator<<(std::ostream& stream, EpsilonDrawUpDowns& p) {
 
 EpsilonDrawUpDowns::EpsilonDrawUpDowns(ObjectStream<InstantPrice>* period,
                                        double epsilon)
-    : trading_period_(period), epsilon_(epsilon) {
+    : ObjectStream<Position>("EpsilonDrawUpDowns"),
+      trading_period_(period),
+      epsilon_(epsilon) {
  if (*trading_period_ >> st_) {
   tp_ = st_;
   en_ = st_;
   is_all_processed_ = false;
  }
-#ifndef NDEBUG
- BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << "Created " << *this;
-#endif
+ OBADIAH_LOG(lg, SeverityLevel::kDebug4) << "Created " << *this;
 }
 
 ObjectStream<Position>&
 EpsilonDrawUpDowns::operator>>(Position& pos) {
+ StageTimer timer{metrics_};
  if (!is_all_processed_) {
   while (*trading_period_ >> en_) {
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << "End point " << en_;
-#endif
+   ++metrics_.in;
+   OBADIAH_LOG(lg, SeverityLevel::kDebug4) << "End point " << en_;
    if (en_.p == tp_.p) {
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << *this;
-#endif
+    OBADIAH_LOG(lg, SeverityLevel::kDebug4) << *this;
     continue;
    }
    if ((tp_.p >= st_.p && en_.p > tp_.p) || (tp_.p <= st_.p && en_.p < tp_.p)) {
     tp_ = en_;  // Extend the draw, set the new turning point
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << "E " << *this;
-#endif
+    OBADIAH_LOG(lg, SeverityLevel::kDebug4) << "E " << *this;
     continue;
    } else {
     double delta = std::abs(en_ - tp_);
@@ -67,14 +83,11 @@ EpsilonDrawUpDowns::operator>>(Position& pos) {
      pos.s = st_;
      pos.e = tp_;
      st_ = tp_;
-#ifndef NDEBUG
-     BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << "N " << *this;
-#endif
+     OBADIAH_LOG(lg, SeverityLevel::kDebug4) << "N " << *this;
+     ++metrics_.out;
      return *this;
     }
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, SeverityLevel::kDebug4) << "TP " << *this;
-#endif
+    OBADIAH_LOG(lg, SeverityLevel::kDebug4) << "TP " << *this;
     continue;
    }
   }
@@ -82,6 +95,7 @@ EpsilonDrawUpDowns::operator>>(Position& pos) {
    pos.s = st_;
    pos.e = en_;
    st_ = en_;
+   ++metrics_.out;
   } else
    is_all_processed_ = true;
  }
@@ -18,23 +18,34 @@
 #include "base.h"
 namespace obadiah {
 namespace R {
+// Mid-prices of the bid-ask spreads. The spreads with a missing side are
+// skipped
+class MidPrices : public ObjectStream<InstantPrice> {
+public:
+ explicit MidPrices(ObjectStream<BidAskSpread>* spreads);
+ ObjectStream<InstantPrice>& operator>>(InstantPrice&);
+
+protected:
+ ObjectStream<BidAskSpread>* spreads_;
+};
+
 class EpsilonDrawUpDowns : public ObjectStream<Position> {
 public:
  EpsilonDrawUpDowns(ObjectStream<InstantPrice>* period, double epsilon);
  ObjectStream<Position>& operator>>(Position&);
  friend std::ostream& operator<<(std::ostream& stream, EpsilonDrawUpDowns& p);
 
-private:
+protected:
  ObjectStream<InstantPrice>* trading_period_;
+
+private:
  double epsilon_;
 
  InstantPrice st_;  // start
  InstantPrice tp_;  // turning point
  InstantPrice en_;  // end
 
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ Logger lg;
 };
 }  // namespace R
 }  // namespace obadiah
@@ -0,0 +1,88 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 1 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
+
+#ifndef OBADIAH_LOGGER_H
+#define OBADIAH_LOGGER_H
+
+// Logging is selected at compile time and does not depend on NDEBUG:
+//
+//  OBADIAH_LOGGING    0 (default) - no Boost.Log code is compiled in at all,
+//                     OBADIAH_LOG() statements are discarded by the compiler.
+//                     1 - the tracing build flavour.
+//  OBADIAH_LOG_LEVEL  the least SeverityLevel (as int) compiled into the
+//                     tracing build, e.g. -1 keeps kLog and above only.
+#ifndef OBADIAH_LOGGING
+#define OBADIAH_LOGGING 0
+#endif
+
+#ifndef OBADIAH_LOG_LEVEL
+#define OBADIAH_LOG_LEVEL -6  // SeverityLevel::kDebug5
+#endif
+
+#include "severity_level.h"
+
+#if OBADIAH_LOGGING
+#include <boost/log/attributes/scoped_attribute.hpp>
+#include <boost/log/attributes/timer.hpp>
+#include <boost/log/sources/record_ostream.hpp>
+#include <boost/log/sources/severity_feature.hpp>
+#include <boost/log/sources/severity_logger.hpp>
+
+namespace logging = boost::log;
+namespace src = boost::log::sources;
+namespace sinks = boost::log::sinks;
+namespace keywords = boost::log::keywords;
+namespace attrs = boost::log::attributes;
+#endif
+
+namespace obadiah {
+namespace R {
+
+constexpr bool
+IsLogged(SeverityLevel level) {
+ return static_cast<int>(level) >= OBADIAH_LOG_LEVEL;
+}
+
+#if OBADIAH_LOGGING
+using Logger = boost::log::sources::severity_logger<SeverityLevel>;
+#else
+struct Logger {};
+
+// Swallows whatever is streamed into a discarded OBADIAH_LOG() statement
+struct NullRecord {
+ template <typename T>
+ inline NullRecord& operator<<(const T&) {
+  return *this;
+ }
+};
+#endif
+
+}  // namespace R
+}  // namespace obadiah
+
+#if OBADIAH_LOGGING
+#define OBADIAH_LOG(lg, level)          \
+ if (!obadiah::R::IsLogged(level)) { \
+ } else                                 \
+  BOOST_LOG_SEV(lg, level)
+#define OBADIAH_LOG_SCOPED_TIMER(lg) \
+ BOOST_LOG_SCOPED_LOGGER_ATTR(lg, "RunTime", attrs::timer())
+#else
+#define OBADIAH_LOG(lg, level) \
+ while (false) obadiah::R::NullRecord {}
+#define OBADIAH_LOG_SCOPED_TIMER(lg)
+#endif
+
+#endif
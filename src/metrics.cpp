@@ -0,0 +1,59 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 1 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
+
+#include "metrics.h"
+#include <algorithm>
+
+namespace obadiah {
+namespace R {
+
+unsigned PipelineMetrics::next_sequence_ = 0;
+
+StageMetrics::StageMetrics(const char* name)
+    : stage{name}, sequence{PipelineMetrics::next_sequence_++} {}
+
+PipelineMetrics::Stages&
+PipelineMetrics::stages() {
+ static Stages stages;
+ return stages;
+}
+
+void
+PipelineMetrics::Clear() {
+ stages().clear();
+ next_sequence_ = 0;
+}
+
+void
+PipelineMetrics::Report(const StageMetrics& metrics) noexcept {
+ auto position = std::upper_bound(
+     stages().begin(), stages().end(), metrics,
+     [](const StageMetrics& a, const StageMetrics& b) {
+      return a.sequence < b.sequence;
+     });
+ try {
+  stages().insert(position, metrics);
+ } catch (...) {
+  // may be unwinding an exception already, so there is nothing to do
+ }
+}
+
+const PipelineMetrics::Stages&
+PipelineMetrics::Get() {
+ return stages();
+}
+
+}  // namespace R
+}  // namespace obadiah
@@ -0,0 +1,84 @@
+// Copyright (C) 2020 Petr Fedorov <petr.fedorov@phystech.edu>
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  version 1 of the License
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 01110-1301 USA.
+
+#ifndef OBADIAH_METRICS_H
+#define OBADIAH_METRICS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace obadiah {
+namespace R {
+
+using Counter = std::uint64_t;
+
+// Counters and the time spent by one ObjectStream stage of a pipeline
+struct StageMetrics {
+ explicit StageMetrics(const char* name);
+ const char* stage;
+ unsigned sequence;     // upstream stages are constructed first
+ Counter in = 0;        // elements consumed from the upstream stage
+ Counter out = 0;       // elements produced
+ Counter episodes = 0;  // order book episodes processed
+ Counter refills = 0;   // cache refills (i.e. cursor fetches) by the source
+ std::size_t max_book_size = 0;  // price levels, both sides
+ std::chrono::steady_clock::duration elapsed{0};  // includes upstream stages
+
+ inline void BookSize(std::size_t size) {
+  if (size > max_book_size) max_book_size = size;
+ }
+ inline double Seconds() const {
+  return std::chrono::duration<double>(elapsed).count();
+ }
+};
+
+// Adds the time spent in the enclosing scope to StageMetrics::elapsed
+class StageTimer {
+public:
+ explicit StageTimer(StageMetrics& metrics)
+     : metrics_(metrics), start_(std::chrono::steady_clock::now()){};
+ ~StageTimer() { metrics_.elapsed += std::chrono::steady_clock::now() - start_; }
+
+private:
+ StageMetrics& metrics_;
+ std::chrono::steady_clock::time_point start_;
+};
+
+// Metrics of the stages of the latest pipeline run in this process (an R
+// session or a Postgres backend). A stage reports its metrics when it is
+// destroyed. Stages are listed upstream first.
+// A Postgres set-returning function abandoned before its last row (e.g. by
+// LIMIT) never destroys its pipeline, which is freed with the function's
+// memory context, so nothing is reported for that call.
+class PipelineMetrics {
+public:
+ using Stages = std::deque<StageMetrics>;
+ static void Clear();
+ // Never throws, since it is called from destructors; the metrics are
+ // dropped if they can't be stored
+ static void Report(const StageMetrics&) noexcept;
+ static const Stages& Get();
+
+private:
+ friend struct StageMetrics;
+ static Stages& stages();
+ static unsigned next_sequence_;
+};
+
+}  // namespace R
+}  // namespace obadiah
+#endif
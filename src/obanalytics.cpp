@@ -2,31 +2,24 @@
 #include <cmath>
 #include <cstring>
 #include <limits>
-#include <map>
 
-#ifndef NDEBUG
+#include "epsilon_drawupdowns.h"
+#include "order_book_investigation.h"
+#include "position_discovery.h"
+
+#if OBADIAH_LOGGING
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
 #include <boost/log/sinks/text_file_backend.hpp>
-#include <boost/log/sources/record_ostream.hpp>
-#include <boost/log/sources/severity_logger.hpp>
 #include <boost/log/support/date_time.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/file.hpp>
 #endif
 
-#include "epsilon_drawupdowns.h"
-#include "order_book_investigation.h"
-#include "position_discovery.h"
-
 using namespace Rcpp;
 using namespace std;
 
-#ifndef NDEBUG
-namespace logging = boost::log;
-namespace src = boost::log::sources;
-namespace sinks = boost::log::sinks;
-namespace keywords = boost::log::keywords;
+#if OBADIAH_LOGGING
 namespace expr = boost::log::expressions;
 
 #define START_LOGGING(f, s)                                                   \
@@ -66,7 +59,7 @@ namespace expr = boost::log::expressions;
 #define FINISH_LOGGING
 #endif
 
-#ifndef NDEBUG
+#if OBADIAH_LOGGING
 __attribute__((constructor)) void
 init() {
  logging::add_common_attributes();
@@ -79,11 +72,19 @@ BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", obadiah::R::SeverityLevel)
 class DepthUpdatesStream : public obadiah::R::ObjectStream<obadiah::R::Level2> {
 public:
  DepthUpdatesStream(DataFrame depth_changes)
-     : timestamp_{as<NumericVector>(
-           depth_changes["timestamp"])},  // as<> is rather expensive!
-       price_{as<NumericVector>(depth_changes["price"])},
-       volume_{as<NumericVector>(depth_changes["volume"])},
-       side_{as<CharacterVector>(depth_changes["side"])},
+     : DepthUpdatesStream{
+           as<NumericVector>(
+               depth_changes["timestamp"]),  // as<> is rather expensive!
+           as<NumericVector>(depth_changes["price"]),
+           as<NumericVector>(depth_changes["volume"]),
+           as<CharacterVector>(depth_changes["side"])} {};
+ DepthUpdatesStream(NumericVector timestamp, NumericVector price,
+                    NumericVector volume, CharacterVector side)
+     : obadiah::R::ObjectStream<obadiah::R::Level2>{"DepthUpdatesStream"},
+       timestamp_{timestamp},
+       price_{price},
+       volume_{volume},
+       side_{side},
        j_(0){};
  operator bool() { return j_ <= timestamp_.length(); }
  DepthUpdatesStream& operator>>(obadiah::R::Level2& dc) {
@@ -94,10 +95,9 @@ public:
    dc.v = volume_[j_ - 1];
    dc.s = !std::strcmp(side_[j_ - 1], "ask") ? obadiah::R::Side::kAsk
                                              : obadiah::R::Side::kBid;
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug5)
+   ++metrics_.out;
+   OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug5)
        << "j_-1=" << j_ - 1 << " " << static_cast<char*>(dc);
-#endif
   }
   return *this;
  }
@@ -108,9 +108,7 @@ private:
  NumericVector volume_;
  CharacterVector side_;
  R_xlen_t j_;
-#ifndef NDEBUG
- src::severity_logger<obadiah::R::SeverityLevel> lg;
-#endif
+ obadiah::R::Logger lg;
 };
 
 // [[Rcpp::export]]
@@ -118,6 +116,7 @@ DataFrame
 CalculateTradingPeriod(DataFrame depth_changes, NumericVector volume,
                        CharacterVector debug_level) {
  START_LOGGING(CalculateTradingPeriod.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
 
  DepthUpdatesStream dc{depth_changes};
  obadiah::R::TradingPeriod<std::allocator> trading_period{&dc,
@@ -125,17 +124,13 @@ CalculateTradingPeriod(DataFrame depth_changes, NumericVector volume,
  std::vector<double> timestamp, bid_price, ask_price;
  obadiah::R::BidAskSpread output;
  while (true) {
-#ifndef NDEBUG
-  BOOST_LOG_SCOPED_LOGGER_ATTR(lg, "RunTime", attrs::timer());
-#endif
+  OBADIAH_LOG_SCOPED_TIMER(lg);
   if (!(trading_period >> output)) break;
   timestamp.push_back(output.t.t);
   bid_price.push_back(output.p_bid);
   ask_price.push_back(output.p_ask);
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug1)
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug1)
       << static_cast<char*>(output);
-#endif
  }
  FINISH_LOGGING;
  Rcpp::List tmp(3);
@@ -160,9 +155,10 @@ CalculateTradingPeriod(DataFrame depth_changes, NumericVector volume,
 DataFrame
 CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size,
                          IntegerVector ticks, CharacterVector type,
-                         CharacterVector debug_level) {
+                         LogicalVector sparse, CharacterVector debug_level) {
  if (tick_size[0] > 0 && ticks[0] > 0 && ticks[1] > 0 && ticks[1] >= ticks[0]) {
   START_LOGGING(CalculateOrderBookQueues.log, as<string>(debug_level));
+  obadiah::R::PipelineMetrics::Clear();
   DepthUpdatesStream dc{depth_changes};
   using LevelNo = obadiah::R::DepthToQueues<>::LevelNo;
   LevelNo first_tick = static_cast<LevelNo>(ticks[0]),
@@ -173,13 +169,36 @@ CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size,
       &dc, tick_size[0], first_tick, last_tick, as<string>(type[0])};
 
   std::vector<double> timestamp, bid_price, ask_price;
+  obadiah::R::OrderBookQueues<> output;
+  if (sparse[0]) {
+   // Only the queues changed by an episode, one row per queue
+   std::vector<string> side;
+   std::vector<int> queue;
+   std::vector<obadiah::R::Volume> volume;
+   auto add = [&](const char* s, LevelNo i, obadiah::R::Volume v) {
+    timestamp.push_back(output.t.t);
+    bid_price.push_back(output.bid_price);
+    ask_price.push_back(output.ask_price);
+    side.push_back(s);
+    queue.push_back(i + first_tick);
+    volume.push_back(v);
+   };
+   while (depth_to_snapshots >> output) {
+    for (auto i : output.changed_bids) add("bid", i, output.bids[i]);
+    for (auto i : output.changed_asks) add("ask", i, output.asks[i]);
+   }
+   FINISH_LOGGING;
+   return Rcpp::DataFrame::create(
+       Rcpp::Named("timestamp") = timestamp,
+       Rcpp::Named("bid.price") = bid_price,
+       Rcpp::Named("ask.price") = ask_price, Rcpp::Named("side") = side,
+       Rcpp::Named("queue") = queue, Rcpp::Named("volume") = volume,
+       Rcpp::Named("stringsAsFactors") = false);
+  }
   std::vector<std::vector<obadiah::R::Volume>> ask_levels{total_ticks};
   std::vector<std::vector<obadiah::R::Volume>> bid_levels{total_ticks};
-  obadiah::R::OrderBookQueues<> output;
   while (true) {
-#ifndef NDEBUG
-   BOOST_LOG_SCOPED_LOGGER_ATTR(lg, "RunTime", attrs::timer());
-#endif
+   OBADIAH_LOG_SCOPED_TIMER(lg);
    if (!(depth_to_snapshots >> output)) break;
    timestamp.push_back(output.t.t);
    bid_price.push_back(output.bid_price);
@@ -188,10 +207,8 @@ CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size,
     ask_levels[i].push_back(output.asks[i]);
     bid_levels[i].push_back(output.bids[i]);
    }
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug1)
+   OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug1)
        << static_cast<char*>(output.t);
-#endif
   }
   FINISH_LOGGING;
   Rcpp::List tmp(3 + 2 * total_ticks);
@@ -225,22 +242,60 @@ CalculateOrderBookQueues(DataFrame depth_changes, NumericVector tick_size,
 };
 // [[Rcpp::export]]
 DataFrame
-CalculateDepthChanges(DataFrame depth_updates, CharacterVector debug_level) {
+CalculateDepthSummary(DataFrame depth_changes, IntegerVector bps_step,
+                      IntegerVector max_bps_level, IntegerVector digits,
+                      CharacterVector debug_level) {
+ if (bps_step[0] <= 0 || max_bps_level[0] < 0)
+  ::Rf_error("Some argument(s) is invalid");
+ START_LOGGING(CalculateDepthSummary.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
+
+ DepthUpdatesStream dc{depth_changes};
+ obadiah::R::DepthToSummary<> depth_to_summary{&dc, bps_step[0],
+                                               max_bps_level[0], digits[0]};
+ std::vector<double> timestamp, price, volume;
+ std::vector<string> side;
+ std::vector<int> bps_level;
+
+ obadiah::R::DepthSummary<> output;
+ while (depth_to_summary >> output) {
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug1)
+      << static_cast<char*>(output.t);
+  for (const auto& level : output.levels) {
+   timestamp.push_back(output.t.t);
+   price.push_back(level.p);
+   volume.push_back(level.v);
+   side.push_back(level.s == obadiah::R::Side::kAsk ? "ask" : "bid");
+   bps_level.push_back(level.bps_level);
+  }
+ }
+ FINISH_LOGGING;
+
+ return Rcpp::DataFrame::create(
+     Rcpp::Named("timestamp") = timestamp, Rcpp::Named("price") = price,
+     Rcpp::Named("volume") = volume, Rcpp::Named("side") = side,
+     Rcpp::Named("bps_level") = bps_level,
+     Rcpp::Named("stringsAsFactors") = false);
+};
+
+// [[Rcpp::export]]
+DataFrame
+CalculateDepthChanges(DataFrame depth_updates, NumericVector chain_expiry,
+                      CharacterVector debug_level) {
  START_LOGGING(CalculateDepthChanges.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
 
  DepthUpdatesStream dc{depth_updates};
 
- obadiah::R::DepthChanges<> depth_changes(&dc);
+ obadiah::R::DepthChanges<> depth_changes(&dc, chain_expiry[0]);
  std::vector<double> timestamp, price, volume, bid_price, ask_price;
  std::vector<string> side;
  std::vector<obadiah::R::ChainId> chain_id;
 
  obadiah::R::DepthChange output;
  while (depth_changes >> output) {
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug4)
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug4)
       << static_cast<char*>(output);
-#endif
   timestamp.push_back(output.t.t);
   price.push_back(output.p);
   volume.push_back(output.v);
@@ -267,19 +322,22 @@ ResampleDepth(DataFrame depth_updates, NumericVector tick_size,
               NumericVector start_time, NumericVector end_time,
               NumericVector frequency, CharacterVector debug_level) {
  START_LOGGING(ResampleDepth.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
 
  DepthUpdatesStream dc{depth_updates};
- obadiah::R::DepthResampler<> depth_resampler(&dc, tick_size[0], start_time[0],
-                                              end_time[0], frequency[0]);
- std::vector<double> timestamp, price, volume;
+ obadiah::R::DepthResampler<>::Resolutions resolutions;
+ for (int i = 0; i < frequency.length(); ++i)
+  resolutions.push_back({frequency[i], tick_size[i]});
+ obadiah::R::DepthResampler<> depth_resampler(&dc, resolutions, start_time[0],
+                                              end_time[0]);
+ std::vector<double> timestamp, price, volume, output_frequency,
+     output_tick_size;
  std::vector<string> side;
 
- obadiah::R::Level2 output;
+ obadiah::R::ResampledLevel2 output;
  while (depth_resampler >> output) {
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug4)
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug4)
       << static_cast<char*>(output);
-#endif
   timestamp.push_back(output.t.t);
   price.push_back(output.p);
   volume.push_back(output.v);
@@ -287,9 +345,17 @@ ResampleDepth(DataFrame depth_updates, NumericVector tick_size,
    side.push_back("bid");
   else
    side.push_back("ask");
+  output_frequency.push_back(resolutions[output.resolution].frequency);
+  output_tick_size.push_back(resolutions[output.resolution].tick_size);
  }
  FINISH_LOGGING;
 
+ if (resolutions.size() > 1)
+  return Rcpp::DataFrame::create(
+      Rcpp::Named("timestamp") = timestamp, Rcpp::Named("price") = price,
+      Rcpp::Named("volume") = volume, Rcpp::Named("side") = side,
+      Rcpp::Named("frequency") = output_frequency,
+      Rcpp::Named("tick.size") = output_tick_size);
  return Rcpp::DataFrame::create(
      Rcpp::Named("timestamp") = timestamp, Rcpp::Named("price") = price,
      Rcpp::Named("volume") = volume, Rcpp::Named("side") = side);
@@ -299,7 +365,9 @@ class TradingPeriod
     : public obadiah::R::ObjectStream<obadiah::R::BidAskSpread> {
 public:
  TradingPeriod(DataFrame trading_period)
-     : timestamp_(as<NumericVector>(trading_period["timestamp"])),
+     : obadiah::R::ObjectStream<obadiah::R::BidAskSpread>(
+           "TradingPeriodStream"),
+       timestamp_(as<NumericVector>(trading_period["timestamp"])),
        bid_(as<NumericVector>(trading_period["bid.price"])),
        ask_(as<NumericVector>(trading_period["ask.price"])),
        j_(0){};
@@ -310,10 +378,9 @@ public:
    s.t = timestamp_[j_ - 1];
    s.p_bid = bid_[j_ - 1];
    s.p_ask = ask_[j_ - 1];
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug5)
+   ++metrics_.out;
+   OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug5)
        << static_cast<char*>(s);
-#endif
   }
   return *this;
  }
@@ -323,9 +390,7 @@ private:
  NumericVector bid_;
  NumericVector ask_;
  R_xlen_t j_;
-#ifndef NDEBUG
- src::severity_logger<obadiah::R::SeverityLevel> lg;
-#endif
+ obadiah::R::Logger lg;
 };
 
 // [[Rcpp::export]]
@@ -333,6 +398,7 @@ DataFrame
 DiscoverPositions(DataFrame computed_trading_period, NumericVector phi,
                   NumericVector rho, CharacterVector debug_level) {
  START_LOGGING(DiscoverPositions.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
 
  TradingPeriod trading_period(computed_trading_period);
  obadiah::R::TradingStrategy trading_strategy(&trading_period, phi[0], rho[0]);
@@ -340,9 +406,7 @@ DiscoverPositions(DataFrame computed_trading_period, NumericVector phi,
      rate;
  obadiah::R::Position p;
  while (trading_strategy >> p) {
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3) << p;
-#endif
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug3) << p;
   opened_at.push_back(p.s.t);
   open_price.push_back(p.s.p);
   closed_at.push_back(p.e.t);
@@ -363,7 +427,8 @@ DiscoverPositions(DataFrame computed_trading_period, NumericVector phi,
 class Prices : public obadiah::R::ObjectStream<obadiah::R::InstantPrice> {
 public:
  Prices(DataFrame trading_period)
-     : timestamp_(as<NumericVector>(trading_period["timestamp"])),
+     : obadiah::R::ObjectStream<obadiah::R::InstantPrice>("PricesStream"),
+       timestamp_(as<NumericVector>(trading_period["timestamp"])),
        prices_(as<NumericVector>(trading_period["price"])),
        j_(0){};
  operator bool() { return j_ <= timestamp_.length(); }
@@ -372,9 +437,8 @@ public:
   if (j_ <= timestamp_.length()) {
    s.t = timestamp_[j_ - 1];
    s.p = prices_[j_ - 1];
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug5) << s;
-#endif
+   ++metrics_.out;
+   OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug5) << s;
   }
   return *this;
  }
@@ -383,9 +447,7 @@ private:
  NumericVector timestamp_;
  NumericVector prices_;
  R_xlen_t j_;
-#ifndef NDEBUG
- src::severity_logger<obadiah::R::SeverityLevel> lg;
-#endif
+ obadiah::R::Logger lg;
 };
 
 // [[Rcpp::export]]
@@ -393,6 +455,7 @@ DataFrame
 DiscoverDrawUpDowns(DataFrame precomputed_prices, NumericVector epsilon,
                     CharacterVector debug_level) {
  START_LOGGING(DiscoverDrawUpDowns.log, as<string>(debug_level));
+ obadiah::R::PipelineMetrics::Clear();
 
  Prices prices(precomputed_prices);
  obadiah::R::EpsilonDrawUpDowns trading_strategy(&prices, epsilon[0]);
@@ -400,9 +463,7 @@ DiscoverDrawUpDowns(DataFrame precomputed_prices, NumericVector epsilon,
      rate;
  obadiah::R::Position p;
  while (trading_strategy >> p) {
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3) << p;
-#endif
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug3) << p;
   opened_at.push_back(p.s.t);
   open_price.push_back(p.s.p);
   closed_at.push_back(p.e.t);
@@ -419,128 +480,65 @@ DiscoverDrawUpDowns(DataFrame precomputed_prices, NumericVector epsilon,
                                 Rcpp::Named("log.return") = log_return,
                                 Rcpp::Named("rate") = rate);
 }
+// [[Rcpp::export]]
+DataFrame
+GetStageMetrics() {
+ const auto& stages = obadiah::R::PipelineMetrics::Get();
+ std::vector<string> stage;
+ std::vector<double> in, out, episodes, max_book_size, refills, seconds;
+ for (const auto& m : stages) {
+  stage.push_back(m.stage);
+  in.push_back(m.in);
+  out.push_back(m.out);
+  episodes.push_back(m.episodes);
+  max_book_size.push_back(m.max_book_size);
+  refills.push_back(m.refills);
+  seconds.push_back(m.Seconds());
+ }
+ return Rcpp::DataFrame::create(
+     Rcpp::Named("stage") = stage, Rcpp::Named("elements.in") = in,
+     Rcpp::Named("elements.out") = out, Rcpp::Named("episodes") = episodes,
+     Rcpp::Named("max.book.size") = max_book_size,
+     Rcpp::Named("refills") = refills, Rcpp::Named("seconds") = seconds,
+     Rcpp::Named("stringsAsFactors") = false);
+}
+
 // [[Rcpp::export]]
 DataFrame
 spread_from_depth(DatetimeVector timestamp, NumericVector price,
                   NumericVector volume, CharacterVector side) {
  START_LOGGING(spread_from_depth.log, "kInfo");
-
- double episode = timestamp[0];
- double best_bid_price = 0, best_bid_qty = 0, best_ask_price = 0,
-        best_ask_qty = 0;
-
- map<double, double> bids;
- map<double, double> asks;
-
- DatetimeVector timestamp_s(0);
- NumericVector best_bid_prices(0);
- NumericVector best_bid_qtys(0);
- NumericVector best_ask_prices(0);
- NumericVector best_ask_qtys(0);
-
- for (int i = 0; i <= timestamp.size(); i++) {
-  if (i == timestamp.size() || timestamp[i] > episode) {
-#ifndef NDEBUG
-   BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3)
-       << "Updating spread after episode " << Datetime(episode);
-#endif
-
-   bool is_changed = false;
-
-   if (!bids.empty()) {
-    if (bids.rbegin()->first != best_bid_price) {
-     best_bid_price = bids.rbegin()->first;
-     is_changed = true;
-    }
-    if (bids.rbegin()->first == best_bid_price &&
-        bids.rbegin()->second != best_bid_qty) {
-     best_bid_qty = bids.rbegin()->second;
-     is_changed = true;
-    }
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3)
-        << " BID Current price: " << bids.rbegin()->first
-        << " Best price: " << best_bid_price
-        << " Current qty: " << bids.rbegin()->second
-        << " Best qty: " << best_bid_qty;
-#endif
-   } else {
-    if (best_bid_price > 0) {
-     best_bid_price = 0;
-     is_changed = true;
-    }
-   }
-   if (!asks.empty()) {
-    if (asks.begin()->first != best_ask_price) {
-     best_ask_price = asks.begin()->first;
-     is_changed = true;
-    }
-    if (asks.begin()->first == best_ask_price &&
-        asks.begin()->second != best_ask_qty) {
-     best_ask_qty = asks.begin()->second;
-     is_changed = true;
-    }
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3)
-        << "ASK Current price: " << asks.begin()->first
-        << " Best price: " << best_ask_price
-        << " Current qty: " << asks.begin()->second
-        << " Best qty: " << best_ask_qty;
-#endif
-   } else {
-    if (best_ask_price > 0) {
-     best_ask_price = 0;
-     is_changed = true;
-    }
-   }
-   if (is_changed) {
-    timestamp_s.push_back(episode);
-    if (best_bid_price > 0) {
-     best_bid_prices.push_back(best_bid_price);
-     best_bid_qtys.push_back(best_bid_qty);
-    } else {
-     best_bid_prices.push_back(R_NaN);
-     best_bid_qtys.push_back(R_NaN);
-    }
-    if (best_ask_price > 0) {
-     best_ask_prices.push_back(best_ask_price);
-     best_ask_qtys.push_back(best_ask_qty);
-    } else {
-     best_ask_prices.push_back(R_NaN);
-     best_ask_qtys.push_back(R_NaN);
-    }
-
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, obadiah::R::SeverityLevel::kDebug3)
-        << "Produced spread change record - timestamp:" << Datetime(episode)
-        << "BID P: " << best_bid_price << " Q: " << best_bid_qty
-        << "ASK P: " << best_ask_price << " Q: " << best_ask_qty;
-#endif
-   }
-
-   if (i < timestamp.size())
-    episode = timestamp[i];
-   else
-    break;  // We are done!
-  }
-  if (side[i] == "bid") {
-   if (volume[i] > 0.0)
-    bids[price[i]] = volume[i];
-   else
-    bids.erase(price[i]);
-  } else {
-   if (volume[i] > 0.0)
-    asks[price[i]] = volume[i];
-   else
-    asks.erase(price[i]);
-  }
+ obadiah::R::PipelineMetrics::Clear();
+
+ // OrderBook removes a level on zero volume only, while spread_from_depth
+ // has always removed it on any non-positive one
+ NumericVector level_volume = clone(volume);
+ for (auto& v : level_volume)
+  if (!(v > 0.0)) v = 0.0;
+
+ DepthUpdatesStream dc{timestamp, price, level_volume, side};
+ obadiah::R::TopOfBook<std::allocator> top_of_book{&dc};
+ std::vector<double> timestamp_s, best_bid_price, best_bid_volume,
+     best_ask_price, best_ask_volume;
+
+ obadiah::R::Level1 output;
+ while (top_of_book >> output) {
+  OBADIAH_LOG(lg, obadiah::R::SeverityLevel::kDebug3)
+      << static_cast<char*>(output);
+  timestamp_s.push_back(output.t.t);
+  best_bid_price.push_back(output.p_bid);
+  best_bid_volume.push_back(output.v_bid);
+  best_ask_price.push_back(output.p_ask);
+  best_ask_volume.push_back(output.v_ask);
  }
  FINISH_LOGGING;
- return DataFrame::create(Named("timestamp") = as<DatetimeVector>(timestamp_s),
-                          Named("best.bid.price") = best_bid_prices,
-                          Named("best.bid.volume") = best_bid_qtys,
-                          Named("best.ask.price") = best_ask_prices,
-                          Named("best.ask.volume") = best_ask_qtys);
+ NumericVector result_timestamp = wrap(timestamp_s);
+ result_timestamp.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+ return DataFrame::create(Named("timestamp") = result_timestamp,
+                          Named("best.bid.price") = best_bid_price,
+                          Named("best.bid.volume") = best_bid_volume,
+                          Named("best.ask.price") = best_ask_price,
+                          Named("best.ask.volume") = best_ask_volume);
 }
 
 struct point {
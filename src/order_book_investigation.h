@@ -16,34 +16,145 @@
 #ifndef OBADIAH_ORDER_BOOK_INVESTIGATION_H
 #define OBADIAH_ORDER_BOOK_INVESTIGATION_H
 
-#include <deque>
+#include <algorithm>
+#include <cmath>
 #include <limits>
-#include <set>
+#include <unordered_map>
 #include <vector>
 #include "base.h"
 
-#ifndef NDEBUG
-#include <boost/log/sources/record_ostream.hpp>
-#include <boost/log/sources/severity_feature.hpp>
-#include <boost/log/sources/severity_logger.hpp>
-#endif
-
 namespace obadiah {
 namespace R {
 template <template <typename> class Allocator = std::allocator>
 struct OrderBookQueues {
  using Queues = std::vector<Volume, Allocator<Volume>>;
+ using Changes = std::vector<unsigned, Allocator<unsigned>>;
  Timestamp t;
  Price bid_price;
  Price ask_price;
  Queues bids;
  Queues asks;
+ Changes changed_bids;  // indices of bids updated by the latest episode
+ Changes changed_asks;  // indices of asks updated by the latest episode
+};
+
+// A bucket of obanalytics._depth_summary(): the volume of side s at the
+// prices more than bps_level - bps_step but at most bps_level basis points
+// away from the side's best price. The bucket 0 is the best price itself.
+// p is the best price moved by bps_level basis points, rounded.
+struct DepthSummaryLevel {
+ Price p;
+ Volume v;
+ Side s;
+ int bps_level;
+};
+
+template <template <typename> class Allocator = std::allocator>
+struct DepthSummary {
+ using Levels = std::vector<DepthSummaryLevel, Allocator<DepthSummaryLevel>>;
+ Timestamp t;
+ Levels levels;  // asks, then bids, each side by bps_level
 };
 
 enum class TickSizeType { kAbsolute, kLogRelative };
 TickSizeType
 GetTickSizeType(const std::string s);
 
+// Bucket boundaries of the queues of one side. They are computed in price
+// space once per reference price, so assigning a book entry to a bucket is a
+// plain price comparison in kLogRelative mode too.
+//
+// The bucket of tick lvl holds the prices from Bound(lvl) (inclusive) to
+// Bound(lvl - 1) (exclusive). For bids the reference price is the best ask
+// and the boundaries go down; for asks it is the best bid and they go up.
+template <template <typename> class Allocator = std::allocator>
+class TickBoundaries {
+public:
+ using LevelNo = unsigned;
+ TickBoundaries(Side side) : side_{side} {};
+ void Set(Price reference, Price tick_size, LevelNo first_tick,
+          LevelNo last_tick, TickSizeType type);
+ inline bool IsSetFor(Price reference, Price tick_size, LevelNo first_tick,
+                      LevelNo last_tick, TickSizeType type) const {
+  return reference == reference_ && tick_size == tick_size_ &&
+         type == type_ && first_tick == first_tick_ &&
+         last_tick == LastTick() && !bounds_.empty();
+ }
+ inline LevelNo FirstTick() const { return first_tick_; }
+ inline LevelNo LastTick() const { return first_tick_ + bounds_.size() - 2; }
+ // There is no reference price, so all buckets are empty
+ inline bool IsEmpty() const { return std::isinf(reference_); }
+ inline Price Bound(LevelNo lvl) const {
+  return bounds_[lvl + 1 - first_tick_];
+ }
+ inline bool Encompass(LevelNo lvl, Price price) const {
+  return side_ == Side::kBid ? geq(price, Bound(lvl)) : geq(Bound(lvl), price);
+ }
+ // Returns the tick whose bucket contains the price or LastTick() + 1
+ LevelNo Find(Price price) const;
+ // Returns the side's best price aligned to the tick grid
+ Price BestPrice(Price actual) const;
+
+private:
+ using Bounds = std::vector<Price, Allocator<Price>>;
+ Side side_;
+ Price reference_ = std::numeric_limits<Price>::quiet_NaN();
+ Price tick_size_ = 0;
+ TickSizeType type_ = TickSizeType::kAbsolute;
+ LevelNo first_tick_ = 0;
+ Bounds bounds_;  // ticks first_tick - 1 .. last_tick
+};
+
+template <template <typename> class Allocator>
+void
+TickBoundaries<Allocator>::Set(Price reference, Price tick_size,
+                               LevelNo first_tick, LevelNo last_tick,
+                               TickSizeType type) {
+ reference_ = reference;
+ tick_size_ = tick_size;
+ type_ = type;
+ first_tick_ = first_tick;
+ bounds_.resize(last_tick - first_tick + 2);
+ if (IsEmpty()) return;
+ Price origin = type == TickSizeType::kLogRelative ? std::log(reference)
+                                                    : reference;
+ Price step = side_ == Side::kBid ? -tick_size : tick_size;
+ for (std::size_t i = 0; i < bounds_.size(); ++i) {
+  Price bound = origin + (static_cast<Price>(first_tick) - 1 + i) * step;
+  bound = side_ == Side::kBid ? AlignUp(bound, tick_size)
+                              : AlignDown(bound, tick_size);
+  bounds_[i] = type == TickSizeType::kLogRelative ? std::exp(bound) : bound;
+ }
+}
+
+template <template <typename> class Allocator>
+typename TickBoundaries<Allocator>::LevelNo
+TickBoundaries<Allocator>::Find(Price price) const {
+ LevelNo lo = FirstTick(), hi = LastTick();
+ if (IsEmpty() || Encompass(lo - 1, price) || !Encompass(hi, price))
+  return hi + 1;
+ // Encompass() holds for the price's tick and all ticks after it
+ while (lo < hi) {
+  LevelNo mid = lo + (hi - lo) / 2;
+  if (Encompass(mid, price))
+   hi = mid;
+  else
+   lo = mid + 1;
+ }
+ return lo;
+}
+
+template <template <typename> class Allocator>
+Price
+TickBoundaries<Allocator>::BestPrice(Price actual) const {
+ if (type_ == TickSizeType::kLogRelative)
+  return std::exp(side_ == Side::kBid ? AlignDown(std::log(actual), tick_size_)
+                                      : AlignUp(std::log(actual), tick_size_));
+ else
+  return side_ == Side::kBid ? AlignDown(actual, tick_size_)
+                             : AlignUp(actual, tick_size_);
+}
+
 template <template <typename> class Allocator = std::allocator>
 class InstrumentedOrderBook : public OrderBook<Allocator> {
  using Pair = std::pair<const Price, Volume>;
@@ -52,176 +163,227 @@ public:
  using LevelNo = unsigned;
  Volume GetVolume(Price p, Side s);
  Volume GetVolume(Price p, Side s, Price tick_size) noexcept;
- inline void GetQueues(OrderBookQueues<Allocator>& ds, const Price tick_size,
-                       LevelNo first_tick, LevelNo last_tick,
-                       TickSizeType type) {
-  switch (type) {
-   case TickSizeType::kAbsolute:
-    GetBidsQueues(ds, first_tick, last_tick, AbsoluteBidPriceLevel{tick_size});
-    GetAsksQueues(ds, first_tick, last_tick, AbsoluteAskPriceLevel{tick_size});
-    break;
-   case TickSizeType::kLogRelative:
-    GetBidsQueues(ds, first_tick, last_tick,
-                  LogRelativeBidPriceLevel{tick_size});
-    GetAsksQueues(ds, first_tick, last_tick,
-                  LogRelativeAskPriceLevel{tick_size});
-    break;
-  }
- }
+ // The same as GetVolume(prices[i], s, tick_size) for i in [0, n), where
+ // prices are ascending and no two are in the same bucket, in one walk
+ void GetVolumes(Side s, Price tick_size, const Price* prices, std::size_t n,
+                 Volume* volumes) const noexcept;
+ void GetQueues(OrderBookQueues<Allocator>& ds, const Price tick_size,
+                LevelNo first_tick, LevelNo last_tick, TickSizeType type);
+ // Replaces ds.levels with the non-empty buckets of both sides up to
+ // max_bps_level. Prices are rounded to decimal_places.
+ void GetDepthSummary(DepthSummary<Allocator>& ds, int bps_step,
+                      int max_bps_level, int decimal_places) const;
 
 protected:
- class LogRelativeBidPriceLevel {
- public:
-  LogRelativeBidPriceLevel(Price tick_size)
-      : tick_size_{tick_size},
-        price_{std::numeric_limits<Price>::infinity()} {};
-  Price set(Price price, LevelNo lvl) {
-   price_ = AlignUp(std::log(price) - lvl * tick_size_, tick_size_);
-   return std::exp(price_);
-  }
-  inline bool encompass(Price price) {
-   price = std::log(price);
-   return geq(price, price_);
-  }
-
-  inline Price BestBidPrice(Price actual_bid) {
-   return std::exp(AlignDown(std::log(actual_bid), tick_size_));
-  }
+ using Boundaries = TickBoundaries<Allocator>;
+ template <class Iterator>
+ static void GetSideSummary(Iterator it, Iterator end, Side s, int bps_step,
+                            int max_bps_level, Price scale,
+                            typename DepthSummary<Allocator>::Levels& levels);
+ // The best ask for bids, the best bid for asks or infinity if there is none
+ Price GetReferencePrice(Side) const;
+ void GetBidsQueues(OrderBookQueues<Allocator>&, const Boundaries&);
+ void GetAsksQueues(OrderBookQueues<Allocator>&, const Boundaries&);
+ Volume GetBidsQueue(LevelNo, const Boundaries&) const;
+ Volume GetAsksQueue(LevelNo, const Boundaries&) const;
+};
 
- private:
-  Price tick_size_;
-  Price price_;
- };
- class AbsoluteBidPriceLevel {
- public:
-  AbsoluteBidPriceLevel(Price tick_size)
-      : tick_size_{tick_size},
-        price_{std::numeric_limits<Price>::infinity()} {};
-  Price set(Price price, LevelNo lvl) {
-   price_ = AlignUp(price - lvl * tick_size_, tick_size_);
-   return price_;
-  }
-  inline bool encompass(Price price) { return geq(price, price_); }
-  inline Price BestBidPrice(Price actual_bid) {
-   return AlignDown(actual_bid, tick_size_);
-  }
+// Maintains OrderBookQueues between episodes. Only the buckets containing
+// prices touched by the episode are recomputed. The queues of a side are
+// rebuilt when its reference price (the best price of the opposite side)
+// moves, since then every bucket boundary moves too.
+template <template <typename> class Allocator = std::allocator>
+class QueuesOrderBook : public InstrumentedOrderBook<Allocator> {
+public:
+ using LevelNo = typename InstrumentedOrderBook<Allocator>::LevelNo;
+ QueuesOrderBook<Allocator>& operator<<(const Level2&);
+ inline void UpdateQueues(OrderBookQueues<Allocator>& ds,
+                          const Price tick_size, LevelNo first_tick,
+                          LevelNo last_tick, TickSizeType type) {
+  UpdateQueues(Side::kBid, ds, tick_size, first_tick, last_tick, type);
+  UpdateQueues(Side::kAsk, ds, tick_size, first_tick, last_tick, type);
+ }
 
- private:
-  Price tick_size_;
-  Price price_;
- };
- class LogRelativeAskPriceLevel {
- public:
-  LogRelativeAskPriceLevel(Price tick_size)
-      : tick_size_{tick_size},
-        price_{-std::numeric_limits<Price>::infinity()} {};
-  Price set(Price price, LevelNo lvl) {
-   price_ = AlignDown(std::log(price) + lvl * tick_size_, tick_size_);
-   return std::exp(price_);
-  }
-  inline bool encompass(Price price) {
-   price = std::log(price);
-   return geq(price_, price);
-  }
-  inline Price BestAskPrice(Price actual_ask) {
-   return std::exp(AlignUp(std::log(actual_ask), tick_size_));
-  }
+private:
+ using Prices = std::vector<Price, Allocator<Price>>;
+ void UpdateQueues(Side, OrderBookQueues<Allocator>&, const Price, LevelNo,
+                   LevelNo, TickSizeType);
+
+ Prices touched_bids_;
+ Prices touched_asks_;
+ TickBoundaries<Allocator> bid_boundaries_{Side::kBid};
+ TickBoundaries<Allocator> ask_boundaries_{Side::kAsk};
+};
 
- private:
-  Price tick_size_;
-  Price price_;
- };
- class AbsoluteAskPriceLevel {
- public:
-  AbsoluteAskPriceLevel(Price tick_size)
-      : tick_size_{tick_size},
-        price_{-std::numeric_limits<Price>::infinity()} {};
-  Price set(Price price, LevelNo lvl) {
-   price_ = AlignDown(price + lvl * tick_size_, tick_size_);
-   return price_;
-  }
-  inline bool encompass(Price price) { return geq(price_, price); }
-  inline Price BestAskPrice(Price actual_ask) {
-   return AlignUp(actual_ask, tick_size_);
-  }
+template <template <typename> class Allocator>
+Price
+InstrumentedOrderBook<Allocator>::GetReferencePrice(Side s) const {
+ if (s == Side::kBid)
+  return this->asks_.empty() ? std::numeric_limits<Price>::infinity()
+                             : this->asks_.cbegin()->first;
+ else
+  return this->bids_.empty() ? -std::numeric_limits<Price>::infinity()
+                             : this->bids_.crbegin()->first;
+}
 
- private:
-  Price tick_size_;
-  Price price_;
- };
- template <typename T>
- void GetBidsQueues(OrderBookQueues<Allocator>&, LevelNo, LevelNo,
-                    T&& price_level);
- template <typename T>
- void GetAsksQueues(OrderBookQueues<Allocator>&, LevelNo, LevelNo,
-                    T&& price_level);
-};
+template <template <typename> class Allocator>
+void
+InstrumentedOrderBook<Allocator>::GetQueues(OrderBookQueues<Allocator>& ds,
+                                            const Price tick_size,
+                                            LevelNo first_tick,
+                                            LevelNo last_tick,
+                                            TickSizeType type) {
+ Boundaries bids{Side::kBid}, asks{Side::kAsk};
+ bids.Set(GetReferencePrice(Side::kBid), tick_size, first_tick, last_tick,
+          type);
+ asks.Set(GetReferencePrice(Side::kAsk), tick_size, first_tick, last_tick,
+          type);
+ GetBidsQueues(ds, bids);
+ GetAsksQueues(ds, asks);
+}
 
+// Assigns the visible bids to the buckets in one walk from the best bid
 template <template <typename> class Allocator>
-template <typename T>
 void
 InstrumentedOrderBook<Allocator>::GetBidsQueues(OrderBookQueues<Allocator>& ds,
-                                                LevelNo first_tick,
-                                                LevelNo last_tick,
-                                                T&& price_level) {
- auto it = OrderBook<Allocator>::bids_.crbegin();
+                                                const Boundaries& boundaries) {
+ auto it = this->bids_.crbegin();
  if (it != this->bids_.crend())
-  ds.bid_price = price_level.BestBidPrice(it->first);
+  ds.bid_price = boundaries.BestPrice(it->first);
  else
   ds.bid_price = R_NAREAL;
 
- ds.bids.clear();
- ds.bids.reserve(last_tick - first_tick + 1);
- ds.bids.shrink_to_fit();
+ LevelNo first_tick = boundaries.FirstTick(), last_tick = boundaries.LastTick();
+ ds.bids.assign(last_tick - first_tick + 1, 0.0);
+ ds.changed_bids.resize(ds.bids.size());
+ for (std::size_t i = 0; i < ds.changed_bids.size(); ++i)
+  ds.changed_bids[i] = i;
+ if (boundaries.IsEmpty()) return;
 
- Price start = std::numeric_limits<Price>::infinity();
- if (this->asks_.cbegin() != this->asks_.cend())
-  start = this->asks_.cbegin()->first;
  it = typename OrderBook<Allocator>::PriceVolumeMap::reverse_iterator{
-     this->bids_.lower_bound(price_level.set(start, first_tick - 1))};
+     this->bids_.lower_bound(boundaries.Bound(first_tick - 1))};
  for (auto lvl = first_tick; lvl <= last_tick; ++lvl) {
   Volume vol = 0.0;
-  price_level.set(start, lvl);
-  for (; it != this->bids_.crend(); ++it)
-   if (price_level.encompass(it->first))
-    vol += it->second;
-   else
-    break;
-  ds.bids.push_back(vol);
+  for (; it != this->bids_.crend() && boundaries.Encompass(lvl, it->first);
+       ++it)
+   vol += it->second;
+  ds.bids[lvl - first_tick] = vol;
  }
 }
 
+// Assigns the visible asks to the buckets in one walk from the best ask
 template <template <typename> class Allocator>
-template <typename T>
 void
 InstrumentedOrderBook<Allocator>::GetAsksQueues(OrderBookQueues<Allocator>& ds,
-                                                LevelNo first_tick,
-                                                LevelNo last_tick,
-                                                T&& price_level) {
+                                                const Boundaries& boundaries) {
  auto it = this->asks_.cbegin();
  if (it != this->asks_.cend())
-  ds.ask_price = price_level.BestAskPrice(it->first);
+  ds.ask_price = boundaries.BestPrice(it->first);
  else
   ds.ask_price = R_NAREAL;
 
- ds.asks.clear();
- ds.asks.reserve(last_tick - first_tick + 1);
- ds.asks.shrink_to_fit();
+ LevelNo first_tick = boundaries.FirstTick(), last_tick = boundaries.LastTick();
+ ds.asks.assign(last_tick - first_tick + 1, 0.0);
+ ds.changed_asks.resize(ds.asks.size());
+ for (std::size_t i = 0; i < ds.changed_asks.size(); ++i)
+  ds.changed_asks[i] = i;
+ if (boundaries.IsEmpty()) return;
 
- Price start = -std::numeric_limits<Price>::infinity();
- if (this->bids_.crbegin() != this->bids_.crend())
-  start = this->bids_.crbegin()->first;
- it = this->asks_.upper_bound(price_level.set(start, first_tick - 1));
+ it = this->asks_.upper_bound(boundaries.Bound(first_tick - 1));
  for (auto lvl = first_tick; lvl <= last_tick; ++lvl) {
   Volume vol = 0.0;
-  price_level.set(start, lvl);
-  for (; it != this->asks_.cend(); ++it)
-   if (price_level.encompass(it->first))
-    vol += it->second;
-   else
-    break;
-  ds.asks.push_back(vol);
+  for (; it != this->asks_.cend() && boundaries.Encompass(lvl, it->first);
+       ++it)
+   vol += it->second;
+  ds.asks[lvl - first_tick] = vol;
+ }
+}
+
+template <template <typename> class Allocator>
+Volume
+InstrumentedOrderBook<Allocator>::GetBidsQueue(
+    LevelNo lvl, const Boundaries& boundaries) const {
+ Volume vol = 0.0;
+ for (auto it = typename OrderBook<Allocator>::PriceVolumeMap::
+          const_reverse_iterator{
+              this->bids_.lower_bound(boundaries.Bound(lvl - 1))};
+      it != this->bids_.crend() && boundaries.Encompass(lvl, it->first); ++it)
+  vol += it->second;
+ return vol;
+}
+
+template <template <typename> class Allocator>
+Volume
+InstrumentedOrderBook<Allocator>::GetAsksQueue(
+    LevelNo lvl, const Boundaries& boundaries) const {
+ Volume vol = 0.0;
+ for (auto it = this->asks_.upper_bound(boundaries.Bound(lvl - 1));
+      it != this->asks_.cend() && boundaries.Encompass(lvl, it->first); ++it)
+  vol += it->second;
+ return vol;
+}
+
+template <template <typename> class Allocator>
+QueuesOrderBook<Allocator>&
+QueuesOrderBook<Allocator>::operator<<(const Level2& next_depth) {
+ if (next_depth.s == Side::kBid)
+  touched_bids_.push_back(next_depth.p);
+ else
+  touched_asks_.push_back(next_depth.p);
+ OrderBook<Allocator>::operator<<(next_depth);
+ return *this;
+}
+
+template <template <typename> class Allocator>
+void
+QueuesOrderBook<Allocator>::UpdateQueues(Side s, OrderBookQueues<Allocator>& ds,
+                                         const Price tick_size,
+                                         LevelNo first_tick, LevelNo last_tick,
+                                         TickSizeType type) {
+ bool is_bid = s == Side::kBid;
+ auto& queues = is_bid ? ds.bids : ds.asks;
+ auto& changed = is_bid ? ds.changed_bids : ds.changed_asks;
+ auto& touched = is_bid ? touched_bids_ : touched_asks_;
+ auto& boundaries = is_bid ? bid_boundaries_ : ask_boundaries_;
+
+ Price reference = this->GetReferencePrice(s);
+ if (!boundaries.IsSetFor(reference, tick_size, first_tick, last_tick, type) ||
+     queues.size() != last_tick - first_tick + 1) {
+  boundaries.Set(reference, tick_size, first_tick, last_tick, type);
+  if (is_bid)
+   this->GetBidsQueues(ds, boundaries);
+  else
+   this->GetAsksQueues(ds, boundaries);
+  touched.clear();
+  return;
  }
+
+ if (is_bid)
+  ds.bid_price = this->bids_.empty()
+                     ? R_NAREAL
+                     : boundaries.BestPrice(this->bids_.crbegin()->first);
+ else
+  ds.ask_price = this->asks_.empty()
+                     ? R_NAREAL
+                     : boundaries.BestPrice(this->asks_.cbegin()->first);
+
+ changed.clear();
+ // From the best price, so the ticks go up
+ if (is_bid)
+  std::sort(touched.begin(), touched.end(),
+            [](Price a, Price b) { return a > b; });
+ else
+  std::sort(touched.begin(), touched.end());
+ for (Price price : touched) {
+  LevelNo lvl = boundaries.Find(price);
+  if (lvl > last_tick) continue;
+  unsigned i = lvl - first_tick;
+  if (!changed.empty() && changed.back() == i) continue;
+  queues[i] = is_bid ? this->GetBidsQueue(lvl, boundaries)
+                     : this->GetAsksQueue(lvl, boundaries);
+  changed.push_back(i);
+ }
+ touched.clear();
 }
 
 template <template <typename> class Allocator>
@@ -233,6 +395,49 @@ InstrumentedOrderBook<Allocator>::GetVolume(Price p, Side s) {
   return OrderBook<Allocator>::asks_.at(p);
 }
 
+template <template <typename> class Allocator>
+void
+InstrumentedOrderBook<Allocator>::GetVolumes(Side s, Price tick_size,
+                                             const Price* prices,
+                                             std::size_t n,
+                                             Volume* volumes) const noexcept {
+ // How far the walk may step over levels between two buckets before it
+ // looks the next bucket up instead
+ constexpr int kMaxSkip = 8;
+ const auto& levels = s == Side::kBid ? this->bids_ : this->asks_;
+ // Buckets are [from, to) for bids, (from, to] for asks and [p, p] if there
+ // is no tick_size, as in GetVolume()
+ const bool is_closed_from = s == Side::kBid || !tick_size;
+ const bool is_open_to = s == Side::kBid && tick_size;
+ auto it = levels.cbegin();
+ for (std::size_t i = 0; i < n; ++i) {
+  Price from = prices[i], to = prices[i];
+  if (tick_size) {
+   if (s == Side::kBid) {
+    from = AlignDown(prices[i], tick_size);
+    to = from + tick_size;
+   } else {
+    to = AlignUp(prices[i], tick_size);
+    from = to - tick_size;
+   }
+  }
+  for (int skipped = 0;
+       it != levels.cend() &&
+       (is_closed_from ? !geq(it->first, from) : geq(from, it->first));
+       ++it)
+   if (++skipped > kMaxSkip) {
+    it = is_closed_from ? levels.lower_bound(from) : levels.upper_bound(from);
+    break;
+   }
+  Volume volume = 0.0;
+  for (; it != levels.cend() &&
+         (is_open_to ? !geq(it->first, to) : geq(to, it->first));
+       ++it)
+   volume += it->second;
+  volumes[i] = volume;
+ }
+}
+
 template <template <typename> class Allocator>
 Volume
 InstrumentedOrderBook<Allocator>::GetVolume(Price p, Side s,
@@ -251,11 +456,9 @@ InstrumentedOrderBook<Allocator>::GetVolume(Price p, Side s,
    if (geq(it->first, price_to)) break;
    volume += it->second;
   }
-#ifndef NDEBUG
-  BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug5)
+  OBADIAH_LOG(this->lg, SeverityLevel::kDebug5)
       << "Price: " << p << " Side: " << static_cast<char>(s)
       << " Volume: " << volume;
-#endif
   return volume;
  } else {
   auto price_to = AlignUp(p, tick_size);
@@ -265,15 +468,52 @@ InstrumentedOrderBook<Allocator>::GetVolume(Price p, Side s,
    if (!geq(price_to, it->first)) break;
    volume += it->second;
   }
-#ifndef NDEBUG
-  BOOST_LOG_SEV(this->lg, SeverityLevel::kDebug5)
+  OBADIAH_LOG(this->lg, SeverityLevel::kDebug5)
       << "Price: " << p << " Side: " << static_cast<char>(s)
       << " Volume: " << volume;
-#endif
   return volume;
  }
 }
 
+template <template <typename> class Allocator>
+void
+InstrumentedOrderBook<Allocator>::GetDepthSummary(DepthSummary<Allocator>& ds,
+                                                  int bps_step,
+                                                  int max_bps_level,
+                                                  int decimal_places) const {
+ Price scale = std::pow(10.0, decimal_places);
+ ds.levels.clear();
+ GetSideSummary(this->asks_.cbegin(), this->asks_.cend(), Side::kAsk, bps_step,
+                max_bps_level, scale, ds.levels);
+ GetSideSummary(this->bids_.crbegin(), this->bids_.crend(), Side::kBid,
+                bps_step, max_bps_level, scale, ds.levels);
+}
+
+template <template <typename> class Allocator>
+template <class Iterator>
+void
+InstrumentedOrderBook<Allocator>::GetSideSummary(
+    Iterator it, Iterator end, Side s, int bps_step, int max_bps_level,
+    Price scale, typename DepthSummary<Allocator>::Levels& levels) {
+ if (it == end) return;
+ const Price best = it->first;
+ const Price direction = s == Side::kAsk ? 1.0 : -1.0;
+ // The levels go away from the best price, so do the buckets
+ for (; it != end; ++it) {
+  // AlignUp() is the ceiling of the SQL version. Its tolerance keeps a price
+  // exactly at a bucket's boundary in that bucket
+  int bps_level = static_cast<int>(std::lround(
+      AlignUp(direction * (it->first - best) / best * 10000, bps_step)));
+  if (bps_level > max_bps_level) break;
+  if (levels.empty() || levels.back().s != s ||
+      levels.back().bps_level != bps_level)
+   levels.push_back(
+       {std::round(best * (1 + direction * bps_level / 10000) * scale) / scale,
+        0.0, s, bps_level});
+  levels.back().v += it->second;
+ }
+}
+
 using ChainId = int;
 
 struct DepthChange : public Level2 {
@@ -285,8 +525,15 @@ struct DepthChange : public Level2 {
 template <template <typename> class Allocator = std::allocator>
 class DepthChanges : public ObjectStream<DepthChange> {
 public:
- DepthChanges(ObjectStream<Level2>* depth_updates)
-     : depth_updates_{depth_updates}, next_chain_id_{1}, current_{0} {
+ // A chain not seen for more than expiry seconds is forgotten and its
+ // volume starts a new chain. Zero means chains never expire.
+ DepthChanges(ObjectStream<Level2>* depth_updates, double expiry = 0)
+     : ObjectStream<DepthChange>{"DepthChanges"},
+       depth_updates_{depth_updates},
+       next_chain_id_{1},
+       expiry_{expiry},
+       current_{0},
+       purged_{0} {
   ObjectStream<DepthChange>::is_all_processed_ =
       false;  // static_cast<bool>(*depth_updates);
   spread_.p_bid = R_NAREAL;
@@ -296,45 +543,81 @@ public:
 
 protected:
  ChainId GetChainId(const DepthChange&);
+ void PurgeExpiredChains();
+
+ // Volumes are quantized to kVolumePrecision so that the same volume
+ // arriving through different arithmetic still finds its chain
+ using VolumeKey = long long;
+ static inline VolumeKey Quantize(Volume v) {
+  return std::llround(std::abs(v) / kVolumePrecision);
+ }
+ struct Chain {
+  ChainId id;
+  Timestamp seen;
+ };
 
  InstrumentedOrderBook<Allocator> ob_;
  ObjectStream<Level2>* depth_updates_;
- using ChainIds = std::map<Volume, ChainId, std::less<Volume>,
-                           Allocator<std::pair<const Volume, ChainId>>>;
+ using ChainIds =
+     std::unordered_map<VolumeKey, Chain, std::hash<VolumeKey>,
+                        std::equal_to<VolumeKey>,
+                        Allocator<std::pair<const VolumeKey, Chain>>>;
  ChainIds bid_chains_;
  ChainIds ask_chains_;
  ChainId next_chain_id_;
+ double expiry_;
  Timestamp current_;
+ Timestamp purged_;  // when expired chains were purged last time
  BidAskSpread spread_;
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ Logger lg;
 };
 
 template <template <typename> class Allocator>
 ChainId
 DepthChanges<Allocator>::GetChainId(const DepthChange& depth_change) {
- ChainIds* chain_ids;
- if (depth_change.s == Side::kBid)
-  chain_ids = &bid_chains_;
- else
-  chain_ids = &ask_chains_;
- auto chain = chain_ids->find(std::abs(depth_change.v));
- if (chain != chain_ids->end()) {
-  return chain->second;
+ ChainIds& chain_ids =
+     depth_change.s == Side::kBid ? bid_chains_ : ask_chains_;
+ auto inserted = chain_ids.emplace(Quantize(depth_change.v),
+                                   Chain{next_chain_id_, depth_change.t});
+ Chain& chain = inserted.first->second;
+ if (inserted.second) {
+  ++next_chain_id_;
  } else {
-  return (*chain_ids)[std::abs(depth_change.v)] = next_chain_id_++;
+  if (expiry_ > 0 && depth_change.t.t - chain.seen.t > expiry_)
+   chain.id = next_chain_id_++;
+  chain.seen = depth_change.t;
  }
+ return chain.id;
+}
+
+// Called once per episode, but sweeps the tables at most once per expiry_
+// seconds, so the cost of a sweep is amortized over many updates
+template <template <typename> class Allocator>
+void
+DepthChanges<Allocator>::PurgeExpiredChains() {
+ if (!(expiry_ > 0) || current_.t - purged_.t < expiry_) return;
+ for (ChainIds* chain_ids : {&bid_chains_, &ask_chains_})
+  for (auto it = chain_ids->begin(); it != chain_ids->end();)
+   if (current_.t - it->second.seen.t > expiry_)
+    it = chain_ids->erase(it);
+   else
+    ++it;
+ purged_ = current_;
 }
 
 template <template <typename> class Allocator>
 DepthChanges<Allocator>&
 DepthChanges<Allocator>::operator>>(DepthChange& depth_change) {
+ StageTimer timer{metrics_};
  Level2 depth_update;
  if (*depth_updates_ >> depth_update) {
+  ++metrics_.in;
   if (!(current_ == depth_update.t)) {
    spread_ = ob_.GetBidAskSpread(0);
    current_ = depth_update.t;
+   PurgeExpiredChains();
+   ++metrics_.episodes;
+   metrics_.BookSize(ob_.GetSize());
   }
   depth_change.t = depth_update.t;
   depth_change.p = depth_update.p;
@@ -349,115 +632,275 @@ DepthChanges<Allocator>::operator>>(DepthChange& depth_change) {
   depth_change.bid_price = spread_.p_bid;
   depth_change.ask_price = spread_.p_ask;
   ob_ << depth_update;
+  ++metrics_.out;
  } else
   is_all_processed_ = true;
  return *this;
 }
 
+// A grid which depth is resampled to: every frequency seconds (or every
+// episode if zero) with prices aligned to tick_size (or not if zero)
+struct Resolution {
+ Frequency frequency;
+ Price tick_size;
+};
+
+struct ResampledLevel2 : public Level2 {
+ unsigned resolution = 0;  // index of the Resolution it has been produced for
+};
+
+// Resamples depth to several resolutions in one pass over depth updates and
+// one order book. A resolution which frequency and tick size are multiples
+// of those of a finer one (its parent) takes the touched prices from the
+// parent's output instead of aligning every depth update again.
 template <template <typename> class Allocator = std::allocator>
-class DepthResampler : public ObjectStream<Level2> {
+class DepthResampler : public ObjectStream<ResampledLevel2> {
 public:
+ using Resolutions = std::vector<Resolution>;
+
  DepthResampler(ObjectStream<Level2>* depth_updates, Price tick_size,
                 Timestamp start_time, Timestamp end_time, Frequency frequency)
-     : depth_updates_{depth_updates},
-       tick_size_{tick_size},
-       start_time_{start_time},
-       end_time_{end_time},
-       frequency_{frequency} {
-  if (*depth_updates >> unprocessed_) is_all_processed_ = false;
-  start_time_.AlignUp(frequency);
-  end_time_.AlignDown(frequency);
-  if (start_time_ > end_time_) unprocessed_.falsify();
- }
- DepthResampler<Allocator>& operator>>(Level2&);
+     : DepthResampler{depth_updates, Resolutions{{frequency, tick_size}},
+                      start_time, end_time} {};
+ DepthResampler(ObjectStream<Level2>* depth_updates,
+                const Resolutions& resolutions, Timestamp start_time,
+                Timestamp end_time);
+ DepthResampler<Allocator>& operator>>(ResampledLevel2&);
 
 private:
+ // Touched prices are appended as they come and sorted once per output
+ using Prices = std::vector<Price, Allocator<Price>>;
+ struct Grid {
+  Resolution resolution;
+  unsigned id;  // the index of the resolution as passed to the constructor
+  int parent;   // the grid which touched prices are taken from, if >= 0
+  Timestamp start_time;
+  Timestamp end_time;
+  Timestamp boundary;  // the time of the pending output
+  bool is_pending;
+  bool is_active;
+  Prices bid_prices;
+  Prices ask_prices;
+ };
+
+ static bool IsMultiple(double coarse, double fine);
+ static inline void Touch(Prices& prices, Price price) {
+  if (prices.empty() || prices.back() != price) prices.push_back(price);
+ }
+ static void SortUnique(Prices&);
+ void Emit(const Grid&, Side, Prices&);
+ // The time of the output which a depth update at t goes to
+ static Timestamp GetBoundary(const Grid&, Timestamp t);
+ Timestamp GetNextBoundary(const Grid&) const;
+ void Touch(Grid&, Timestamp boundary);
+ void Emit(Grid&);
  void ProcessNextEpisode();
 
  InstrumentedOrderBook<Allocator> ob_;
  ObjectStream<Level2>* depth_updates_;
- Price tick_size_;
- Timestamp start_time_;
- Timestamp end_time_;
+ std::vector<Grid, Allocator<Grid>> grids_;  // parents go before children
  Level2 unprocessed_;
- Frequency frequency_;
- std::deque<Level2, Allocator<Level2>> output_;
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ // Buffers below are reused, so no allocations happen once they are large
+ // enough for the busiest interval
+ std::vector<Volume, Allocator<Volume>> volumes_;
+ std::vector<ResampledLevel2, Allocator<ResampledLevel2>> output_;
+ std::size_t next_output_ = 0;
+ Logger lg;
 };
 
+template <template <typename> class Allocator>
+DepthResampler<Allocator>::DepthResampler(ObjectStream<Level2>* depth_updates,
+                                          const Resolutions& resolutions,
+                                          Timestamp start_time,
+                                          Timestamp end_time)
+    : ObjectStream<ResampledLevel2>{"DepthResampler"},
+      depth_updates_{depth_updates} {
+ for (unsigned i = 0; i < resolutions.size(); ++i) {
+  Grid grid;
+  grid.resolution = resolutions[i];
+  grid.id = i;
+  grid.parent = -1;
+  grid.start_time = start_time;
+  grid.start_time.AlignUp(grid.resolution.frequency);
+  grid.end_time = end_time;
+  grid.end_time.AlignDown(grid.resolution.frequency);
+  grid.is_pending = false;
+  grid.is_active = !(grid.start_time > grid.end_time);
+  grids_.push_back(grid);
+ }
+ std::stable_sort(grids_.begin(), grids_.end(),
+                  [](const Grid& a, const Grid& b) {
+                   return a.resolution.frequency < b.resolution.frequency ||
+                          (a.resolution.frequency == b.resolution.frequency &&
+                           a.resolution.tick_size < b.resolution.tick_size);
+                  });
+ // The coarsest of the finer grids is the cheapest parent
+ for (int i = 0; i < static_cast<int>(grids_.size()); ++i)
+  for (int j = i - 1; j >= 0; --j)
+   if (IsMultiple(grids_[i].resolution.frequency,
+                  grids_[j].resolution.frequency) &&
+       IsMultiple(grids_[i].resolution.tick_size,
+                  grids_[j].resolution.tick_size)) {
+    grids_[i].parent = j;
+    break;
+   }
+ if (*depth_updates >> unprocessed_) is_all_processed_ = false;
+}
+
+// Zero frequency (every episode) and zero tick size (exact prices) are finer
+// than any other
+template <template <typename> class Allocator>
+bool
+DepthResampler<Allocator>::IsMultiple(double coarse, double fine) {
+ if (!(fine > kPricePrecision)) return true;
+ double ratio = coarse / fine;
+ return ratio >= 1 && std::abs(ratio - std::round(ratio)) < kPricePrecision;
+}
+
+template <template <typename> class Allocator>
+Timestamp
+DepthResampler<Allocator>::GetBoundary(const Grid& grid, Timestamp t) {
+ t.AlignUp(grid.resolution.frequency);
+ return t > grid.start_time ? t : grid.start_time;
+}
+
+template <template <typename> class Allocator>
+Timestamp
+DepthResampler<Allocator>::GetNextBoundary(const Grid& grid) const {
+ return grid.is_pending ? grid.boundary : GetBoundary(grid, unprocessed_.t);
+}
+
+template <template <typename> class Allocator>
+void
+DepthResampler<Allocator>::Touch(Grid& grid, Timestamp boundary) {
+ if (grid.is_pending) return;
+ if (boundary > grid.end_time) {
+  grid.is_active = false;
+ } else {
+  grid.boundary = boundary;
+  grid.is_pending = true;
+ }
+}
+
+template <template <typename> class Allocator>
+void
+DepthResampler<Allocator>::SortUnique(Prices& prices) {
+ std::sort(prices.begin(), prices.end(), less{});
+ prices.erase(std::unique(prices.begin(), prices.end(),
+                          [](Price a, Price b) { return !less{}(a, b); }),
+              prices.end());
+}
+
+// Outputs the touched prices of one side from the highest to the lowest
+template <template <typename> class Allocator>
+void
+DepthResampler<Allocator>::Emit(const Grid& grid, Side side, Prices& prices) {
+ SortUnique(prices);
+ if (volumes_.size() < prices.size()) volumes_.resize(prices.size());
+ ob_.GetVolumes(side, grid.resolution.tick_size, prices.data(), prices.size(),
+                volumes_.data());
+ ResampledLevel2 o;
+ o.t = grid.boundary;
+ o.s = side;
+ o.resolution = grid.id;
+ for (std::size_t i = prices.size(); i-- > 0;) {
+  o.p = prices[i];
+  o.v = volumes_[i];
+  output_.push_back(o);
+ }
+}
+
+template <template <typename> class Allocator>
+void
+DepthResampler<Allocator>::Emit(Grid& grid) {
+ OBADIAH_LOG(lg, SeverityLevel::kDebug4)
+     << "DepthResampler " << static_cast<char*>(grid.boundary)
+     << " resolution: " << grid.id;
+ Emit(grid, Side::kAsk, grid.ask_prices);
+ Emit(grid, Side::kBid, grid.bid_prices);
+ for (auto& child : grids_) {
+  if (child.parent < 0 || &grids_[child.parent] != &grid || !child.is_active)
+   continue;
+  Touch(child, GetBoundary(child, grid.boundary));
+  if (!child.is_active) continue;
+  const Price tick_size = child.resolution.tick_size;
+  for (auto price : grid.bid_prices)
+   Touch(child.bid_prices, AlignDown(price, tick_size));
+  for (auto price : grid.ask_prices)
+   Touch(child.ask_prices, AlignUp(price, tick_size));
+ }
+ grid.bid_prices.clear();
+ grid.ask_prices.clear();
+ grid.is_pending = false;
+}
+
+// Processes depth updates up to the nearest boundary of all grids, then
+// emits every grid which will see no more depth updates before its boundary
 template <template <typename> class Allocator>
 void
 DepthResampler<Allocator>::ProcessNextEpisode() {
  if (unprocessed_) {
-  std::set<Price, less, Allocator<Price>> bid_prices;
-  std::set<Price, less, Allocator<Price>> ask_prices;
+  const Grid* step = nullptr;  // the grid with the nearest boundary
+  Timestamp step_end;
+  for (auto& grid : grids_) {
+   if (!grid.is_active) continue;
+   Timestamp next = GetNextBoundary(grid);
+   if (next > grid.end_time) {
+    grid.is_active = false;  // the grid is beyond its end_time
+    continue;
+   }
+   if (!step || step_end > next) {
+    step = &grid;
+    step_end = next;
+   }
+  }
+  if (!step) {
+   unprocessed_.falsify();  // all grids are beyond their end_time
+   return;
+  }
+  for (auto& grid : grids_)
+   if (grid.is_active && grid.parent < 0) Touch(grid, GetNextBoundary(grid));
   do {
-   if (unprocessed_.t > start_time_) {
+   if (GetBoundary(*step, unprocessed_.t) > step_end) {
     break;
    }
-   if (unprocessed_.s == Side::kBid) {
-    Price aligned = AlignDown(unprocessed_.p, tick_size_);
-    bid_prices.insert(aligned);
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, SeverityLevel::kDebug5)
-        << "BID: timestamp: " << static_cast<char*>(start_time_)
-        << " price: " << unprocessed_.p << " AlignedDown: " << aligned
-        << " bid_prices.size() " << bid_prices.size();
-#endif
-   } else {
-    Price aligned = AlignUp(unprocessed_.p, tick_size_);
-    ask_prices.insert(aligned);
-#ifndef NDEBUG
-    BOOST_LOG_SEV(lg, SeverityLevel::kDebug5)
-        << "ASK: timestamp: " << static_cast<char*>(start_time_)
-        << " price: " << unprocessed_.p << " AlignedUp: " << aligned
-        << " ask_prices.size() " << ask_prices.size();
-    ;
-#endif
+   for (auto& grid : grids_) {
+    if (!grid.is_active || grid.parent >= 0) continue;
+    const Price tick_size = grid.resolution.tick_size;
+    if (unprocessed_.s == Side::kBid)
+     Touch(grid.bid_prices, AlignDown(unprocessed_.p, tick_size));
+    else
+     Touch(grid.ask_prices, AlignUp(unprocessed_.p, tick_size));
    }
+   OBADIAH_LOG(lg, SeverityLevel::kDebug5)
+       << "DepthResampler " << static_cast<char*>(unprocessed_);
    ob_ << unprocessed_;
+   ++metrics_.in;
    unprocessed_.falsify();
   } while (*depth_updates_ >> unprocessed_);
-#ifndef NDEBUG
-  BOOST_LOG_SEV(lg, SeverityLevel::kDebug4)
-      << "DepthResampler " << static_cast<char*>(start_time_);
-#endif
-
-  for (auto price = ask_prices.rbegin(); price != ask_prices.rend(); ++price) {
-   Level2 o;
-   o.t = start_time_;
-   o.p = *price;
-   o.v = ob_.GetVolume(*price, Side::kAsk, tick_size_);
-   o.s = Side::kAsk;
-   output_.push_front(o);
-  }
-  for (auto price = bid_prices.rbegin(); price != bid_prices.rend(); ++price) {
-   Level2 o;
-   o.t = start_time_;
-   o.p = *price;
-   o.v = ob_.GetVolume(*price, Side::kBid, tick_size_);
-   o.s = Side::kBid;
-   output_.push_front(o);
-  }
-  start_time_ = unprocessed_.t;
-  start_time_.AlignUp(frequency_);
-  if (start_time_ > end_time_)
-   unprocessed_
-       .falsify();  // Level2's is beyond end_time_, so processing is stopped
+  ++metrics_.episodes;
+  metrics_.BookSize(ob_.GetSize());
  }
+ for (auto& grid : grids_)
+  if (grid.is_pending &&
+      (!unprocessed_ || GetBoundary(grid, unprocessed_.t) > grid.boundary))
+   Emit(grid);
 }
 
 template <template <typename> class Allocator>
 DepthResampler<Allocator>&
-DepthResampler<Allocator>::operator>>(Level2& out) {
+DepthResampler<Allocator>::operator>>(ResampledLevel2& out) {
+ StageTimer timer{metrics_};
  if (!is_all_processed_) {
-  if (output_.empty()) ProcessNextEpisode();
+  if (next_output_ == output_.size()) {
+   output_.clear();
+   next_output_ = 0;
+   while (output_.empty() && unprocessed_) ProcessNextEpisode();
+  }
 
-  if (!output_.empty()) {
-   out = output_.back();
-   output_.pop_back();
+  if (next_output_ < output_.size()) {
+   out = output_[next_output_++];
+   ++metrics_.out;
   } else {
    is_all_processed_ = true;
   }
@@ -469,11 +912,12 @@ template <template <typename> class Allocator = std::allocator>
 class DepthToQueues
     : public EpisodeProcessor<Allocator, OrderBookQueues<Allocator>> {
 public:
- using LevelNo = typename InstrumentedOrderBook<Allocator>::LevelNo;
+ using LevelNo = typename QueuesOrderBook<Allocator>::LevelNo;
 
  DepthToQueues(ObjectStream<Level2>* depth_updates, const Price tick_size,
                LevelNo first_tick, LevelNo last_tick, std::string type)
-     : EpisodeProcessor<Allocator, OrderBookQueues<Allocator>>{depth_updates},
+     : EpisodeProcessor<Allocator, OrderBookQueues<Allocator>>{depth_updates,
+                                                               "DepthToQueues"},
        tick_size_{tick_size},
        first_tick_{first_tick},
        last_tick_{last_tick},
@@ -481,7 +925,8 @@ public:
  DepthToQueues<Allocator>& operator>>(OrderBookQueues<Allocator>&);
 
 protected:
- InstrumentedOrderBook<Allocator> ob_;
+ QueuesOrderBook<Allocator> ob_;
+ OrderBookQueues<Allocator> queues_;
  Price tick_size_;
  LevelNo first_tick_;
  LevelNo last_tick_;
@@ -492,11 +937,52 @@ template <template <typename> class Allocator>
 DepthToQueues<Allocator>&
 DepthToQueues<Allocator>::operator>>(
     OrderBookQueues<Allocator>& to_be_returned) {
+ StageTimer timer{this->metrics_};
+ if (!this->is_all_processed_) {
+  Timestamp current_timestamp = this->unprocessed_.t;
+  if (this->ProcessNextEpisode(ob_)) {
+   ob_.UpdateQueues(queues_, tick_size_, first_tick_, last_tick_, type_);
+   queues_.t = current_timestamp.t;
+   to_be_returned = queues_;
+   ++this->metrics_.out;
+  } else
+   this->is_all_processed_ = true;
+ }
+ return *this;
+}
+
+// Produces the depth summary (see DepthSummaryLevel) after every episode
+template <template <typename> class Allocator = std::allocator>
+class DepthToSummary
+    : public EpisodeProcessor<Allocator, DepthSummary<Allocator>> {
+public:
+ DepthToSummary(ObjectStream<Level2>* depth_updates, int bps_step,
+                int max_bps_level, int decimal_places)
+     : EpisodeProcessor<Allocator, DepthSummary<Allocator>>{depth_updates,
+                                                            "DepthToSummary"},
+       bps_step_{bps_step},
+       max_bps_level_{max_bps_level},
+       decimal_places_{decimal_places} {};
+ DepthToSummary<Allocator>& operator>>(DepthSummary<Allocator>&);
+
+protected:
+ InstrumentedOrderBook<Allocator> ob_;
+ int bps_step_;
+ int max_bps_level_;
+ int decimal_places_;
+};
+
+template <template <typename> class Allocator>
+DepthToSummary<Allocator>&
+DepthToSummary<Allocator>::operator>>(DepthSummary<Allocator>& to_be_returned) {
+ StageTimer timer{this->metrics_};
  if (!this->is_all_processed_) {
   Timestamp current_timestamp = this->unprocessed_.t;
   if (this->ProcessNextEpisode(ob_)) {
-   ob_.GetQueues(to_be_returned, tick_size_, first_tick_, last_tick_, type_);
+   ob_.GetDepthSummary(to_be_returned, bps_step_, max_bps_level_,
+                       decimal_places_);
    to_be_returned.t = current_timestamp.t;
+   ++this->metrics_.out;
   } else
    this->is_all_processed_ = true;
  }
@@ -49,9 +49,7 @@ protected:
  InstantPrice ss_;  // start short
  InstantPrice es_;  // end short
 
-#ifndef NDEBUG
- src::severity_logger<SeverityLevel> lg;
-#endif
+ Logger lg;
 };
 
 }